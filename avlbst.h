@@ -1,39 +1,129 @@
-#ifndef RBBST_H
-#define RBBST_H
+#ifndef AVLBST_H
+#define AVLBST_H
 
 #include <iostream>
 #include <exception>
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <vector>
 #include "bst.h"
+#include "task_pool.h"
 
 struct KeyError { };
 
+/**
+* Subtree size bookkeeping for order-statistic AVL trees (AVLTree<Key, Value, true>).
+* The node counts itself plus everything below it, which is what select() and rank()
+* steer by.
+*/
+template <bool CountSizes>
+class AVLSubtreeSize
+{
+public:
+    AVLSubtreeSize();
+
+    size_t getSize() const;
+    void setSize(size_t size);
+
+protected:
+    size_t size_;
+};
+
+/**
+* The default (size-less) version holds no data, so ordinary AVL nodes pay no memory
+* for it, and its setter does nothing so the updates compile away.
+*/
+template <>
+class AVLSubtreeSize<false>
+{
+public:
+    size_t getSize() const;
+    void setSize(size_t size);
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the AVLSubtreeSize class.
+  -------------------------------------------------
+*/
+
+/**
+* A new node is a subtree of one.
+*/
+template<bool CountSizes>
+AVLSubtreeSize<CountSizes>::AVLSubtreeSize() : size_(1)
+{
+
+}
+
+/**
+* A getter for the number of nodes in the subtree.
+*/
+template<bool CountSizes>
+size_t AVLSubtreeSize<CountSizes>::getSize() const
+{
+    return size_;
+}
+
+/**
+* A setter for the number of nodes in the subtree.
+*/
+template<bool CountSizes>
+void AVLSubtreeSize<CountSizes>::setSize(size_t size)
+{
+    size_ = size;
+}
+
+/**
+* Sizes are not tracked, so there is nothing to report.
+*/
+inline size_t AVLSubtreeSize<false>::getSize() const
+{
+    return 0;
+}
+
+/**
+* Sizes are not tracked, so there is nothing to store.
+*/
+inline void AVLSubtreeSize<false>::setSize(size_t)
+{
+
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the AVLSubtreeSize class.
+  -----------------------------------------------
+*/
+
 /**
 * A special kind of node for an AVL tree, which adds the balance as a data member, plus
 * other additional helper functions. You do NOT need to implement any functionality or
 * add additional data members or helper functions.
+* With CountSizes set, the node also keeps the size of its subtree (see AVLSubtreeSize).
 */
-template <typename Key, typename Value>
-class AVLNode : public Node<Key, Value>
+template <typename Key, typename Value, bool CountSizes = false>
+class AVLNode : public BasicNode<Key, Value, AVLNode<Key, Value, CountSizes> >, public AVLSubtreeSize<CountSizes>
 {
 public:
-    // Constructor/destructor.
-    AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
-    virtual ~AVLNode();
+    // Constructor.
+    AVLNode(const Key& key, const Value& value, AVLNode<Key, Value, CountSizes>* parent);
+    template<typename... ItemArgs>
+    explicit AVLNode(AVLNode<Key, Value, CountSizes>* parent, ItemArgs&&... itemArgs);
 
     // Getter/setter for the node's height.
     int8_t getBalance () const;
     void setBalance (int8_t balance);
     void updateBalance(int8_t diff);
 
-    // Getters for parent, left, and right. These need to be redefined since they
-    // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
-    // for more information.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
+    // Sets the height (and subtree size, if counted) from the (already correct) children.
+    void updateFromChildren();
+    void copySubtreeData(const AVLNode<Key, Value, CountSizes>& other);
+
+    // The getters for parent, left, and right come from BasicNode and already
+    // return pointers to AVLNodes - not plain Nodes. See the BasicNode class in
+    // bst.h for more information.
 
 protected:
     int8_t balance_;    // effectively a signed char
@@ -49,18 +139,21 @@ protected:
 * An explicit constructor to initialize the elements by calling the base class constructor and setting
 * the color to red since every new node will be red when it is first inserted.
 */
-template<class Key, class Value>
-AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value> *parent) :
-    Node<Key, Value>(key, value, parent), balance_(0)
+template<class Key, class Value, bool CountSizes>
+AVLNode<Key, Value, CountSizes>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value, CountSizes> *parent) :
+    BasicNode<Key, Value, AVLNode<Key, Value, CountSizes> >(key, value, parent), balance_(0)
 {
 
 }
 
 /**
-* A destructor which does nothing.
+* A constructor that builds the item in place from the given arguments,
+* so keys and values can be moved in. See BasicNode in bst.h.
 */
-template<class Key, class Value>
-AVLNode<Key, Value>::~AVLNode()
+template<class Key, class Value, bool CountSizes>
+template<typename... ItemArgs>
+AVLNode<Key, Value, CountSizes>::AVLNode(AVLNode<Key, Value, CountSizes>* parent, ItemArgs&&... itemArgs) :
+    BasicNode<Key, Value, AVLNode<Key, Value, CountSizes> >(parent, std::forward<ItemArgs>(itemArgs)...), balance_(0)
 {
 
 }
@@ -68,8 +161,8 @@ AVLNode<Key, Value>::~AVLNode()
 /**
 * A getter for the balance of a AVLNode.
 */
-template<class Key, class Value>
-int8_t AVLNode<Key, Value>::getBalance() const
+template<class Key, class Value, bool CountSizes>
+int8_t AVLNode<Key, Value, CountSizes>::getBalance() const
 {
     return balance_;
 }
@@ -77,8 +170,8 @@ int8_t AVLNode<Key, Value>::getBalance() const
 /**
 * A setter for the balance of a AVLNode.
 */
-template<class Key, class Value>
-void AVLNode<Key, Value>::setBalance(int8_t balance)
+template<class Key, class Value, bool CountSizes>
+void AVLNode<Key, Value, CountSizes>::setBalance(int8_t balance)
 {
     balance_ = balance;
 }
@@ -86,365 +179,355 @@ void AVLNode<Key, Value>::setBalance(int8_t balance)
 /**
 * Adds diff to the balance of a AVLNode.
 */
-template<class Key, class Value>
-void AVLNode<Key, Value>::updateBalance(int8_t diff)
+template<class Key, class Value, bool CountSizes>
+void AVLNode<Key, Value, CountSizes>::updateBalance(int8_t diff)
 {
     balance_ += diff;
 }
 
 /**
-* An overridden function for getting the parent since a static_cast is necessary to make sure
-* that our node is a AVLNode.
+* Recomputes the height stored in balance_ from the children, treating a
+* missing child as height 0, and the subtree size when sizes are counted.
+* Used whenever a node's children change (rotations, retracing, bulk builds).
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
+template<class Key, class Value, bool CountSizes>
+void AVLNode<Key, Value, CountSizes>::updateFromChildren()
 {
-    return static_cast<AVLNode<Key, Value>*>(this->parent_);
+    int8_t leftHeight = this->left_ == NULL ? 0 : this->left_->balance_;
+    int8_t rightHeight = this->right_ == NULL ? 0 : this->right_->balance_;
+    balance_ = 1 + std::max(leftHeight, rightHeight);
+    if(CountSizes){
+        size_t leftSize = this->left_ == NULL ? 0 : this->left_->getSize();
+        size_t rightSize = this->right_ == NULL ? 0 : this->right_->getSize();
+        this->setSize(1 + leftSize + rightSize);
+    }
 }
 
 /**
-* Overridden for the same reasons as above.
+* Takes over other's height (and subtree size) when this node moves into its
+* place, so retracing from below can fix them up like any other ancestor's.
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
+template<class Key, class Value, bool CountSizes>
+void AVLNode<Key, Value, CountSizes>::copySubtreeData(const AVLNode<Key, Value, CountSizes>& other)
 {
-    return static_cast<AVLNode<Key, Value>*>(this->left_);
+    balance_ = other.balance_;
+    this->setSize(other.getSize());
 }
 
+/*
+  -----------------------------------------------
+  End implementations for the AVLNode class.
+  -----------------------------------------------
+*/
+
 /**
-* Overridden for the same reasons as above.
+* One update for AVLTree::applyBatch(): UPSERT puts item in the tree (adding
+* it, or overwriting the value if the key is already there), ERASE removes the
+* item with key item.first and ignores item.second.
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
+template <typename Key, typename Value>
+struct BatchOp
 {
-    return static_cast<AVLNode<Key, Value>*>(this->right_);
-}
+    enum Kind { UPSERT, ERASE };
 
+    static BatchOp upsert(const Key& key, const Value& value);
+    static BatchOp erase(const Key& key);
 
-/*
-  -----------------------------------------------
-  End implementations for the AVLNode class.
-  -----------------------------------------------
+    Kind kind;
+    std::pair<Key, Value> item;
+};
+
+/**
+* Returns an operation that puts key with value in the tree.
 */
+template<typename Key, typename Value>
+BatchOp<Key, Value> BatchOp<Key, Value>::upsert(const Key& key, const Value& value)
+{
+    BatchOp op = { UPSERT, std::pair<Key, Value>(key, value) };
+    return op;
+}
 
+/**
+* Returns an operation that removes key from the tree; Value must be default constructible.
+*/
+template<typename Key, typename Value>
+BatchOp<Key, Value> BatchOp<Key, Value>::erase(const Key& key)
+{
+    BatchOp op = { ERASE, std::pair<Key, Value>(key, Value()) };
+    return op;
+}
 
-template <class Key, class Value>
-class AVLTree : public BinarySearchTree<Key, Value>
+
+template <class Key, class Value, bool CountSizes = false, class Compare = std::less<Key>, class Stats = NoStats>
+class AVLTree : public BinarySearchTree<Key, Value, AVLNode<Key, Value, CountSizes>, Compare, Stats>
 {
 public:
-    virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
-    virtual void remove(const Key& key);  // TODO
+    typedef typename BinarySearchTree<Key, Value, AVLNode<Key, Value, CountSizes>, Compare, Stats>::iterator iterator;
+
+    AVLTree();
+    explicit AVLTree(const Compare& comp);
+    template<typename ForwardIt>
+    AVLTree(ForwardIt first, ForwardIt last, const Compare& comp = Compare());
+    AVLTree(AVLTree&& other);
+    AVLTree& operator=(AVLTree&& other);
+    using BinarySearchTree<Key, Value, AVLNode<Key, Value, CountSizes>, Compare, Stats>::erase;
+    iterator erase(iterator first, iterator last);
+
+    // Order statistics; these need sizes to be counted (AVLTree<Key, Value, true>)
+    size_t size() const;
+    iterator select(size_t k) const;
+    size_t rank(const Key& key) const;
+    size_t countInRange(const Key& lo, const Key& hi) const;
+
+    // Set operations that take over other's nodes and leave it empty
+    void unionWith(AVLTree&& other, TaskPool& pool = TaskPool::shared());
+    void intersectWith(AVLTree&& other, TaskPool& pool = TaskPool::shared());
+    void differenceWith(AVLTree&& other, TaskPool& pool = TaskPool::shared());
+
+    // Many upserts and erases merged into the tree in one pass
+    void applyBatch(std::vector<BatchOp<Key, Value> > ops, TaskPool& pool = TaskPool::shared());
+
+    // Cutting and gluing by key in O(log n), reusing the nodes
+    AVLTree split(const Key& key);
+    void join(AVLTree&& other);
 protected:
-    virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
+    virtual void insertFix(AVLNode<Key, Value, CountSizes>* node);
+    virtual void removeFix(AVLNode<Key, Value, CountSizes>* node);
+    virtual uint8_t snapshotKind() const;
 
     // Add helper functions here
-		void BSTinsert(const std::pair<const Key, Value> &newPair); //regular BST insert (no rotations)
-		AVLNode<Key, Value>* BSTremove(const Key &key); //regular BST remove (no rotations), return AVLNode of subtree root
-		int findHeight(AVLNode<Key, Value>* a); //finds the height of the subtree starting from the passed in node
-		void rightRotate(AVLNode<Key, Value>* y); //performs the right rotation
-		void leftRotate(AVLNode<Key, Value>* x); //performs the left rotation
-
+		int findHeight(AVLNode<Key, Value, CountSizes>* a); //finds the height of the subtree starting from the passed in node
+		void rightRotate(AVLNode<Key, Value, CountSizes>* y); //performs the right rotation
+		void leftRotate(AVLNode<Key, Value, CountSizes>* x); //performs the left rotation
+		AVLNode<Key, Value, CountSizes>* rebalance(AVLNode<Key, Value, CountSizes>* node); //fixes the height of node, rotating if needed; returns the new subtree root
+		void updateSizesAbove(AVLNode<Key, Value, CountSizes>* node); //fixes the subtree sizes of the ancestors of node (order-statistic trees only)
+
+    // Join-based building blocks. They work on detached subtrees (the parent of the
+    // root they return is NULL) and never touch root_ or pool_, so different threads
+    // can run them on different subtrees at the same time.
+    AVLNode<Key, Value, CountSizes>* attachNodes(AVLNode<Key, Value, CountSizes>* left, AVLNode<Key, Value, CountSizes>* mid, AVLNode<Key, Value, CountSizes>* right);
+    static AVLNode<Key, Value, CountSizes>* detachNode(AVLNode<Key, Value, CountSizes>* node);
+    AVLNode<Key, Value, CountSizes>* rotateLeftNodes(AVLNode<Key, Value, CountSizes>* x);
+    AVLNode<Key, Value, CountSizes>* rotateRightNodes(AVLNode<Key, Value, CountSizes>* y);
+    AVLNode<Key, Value, CountSizes>* joinNodes(AVLNode<Key, Value, CountSizes>* left, AVLNode<Key, Value, CountSizes>* mid, AVLNode<Key, Value, CountSizes>* right);
+    AVLNode<Key, Value, CountSizes>* joinRightSpine(AVLNode<Key, Value, CountSizes>* left, AVLNode<Key, Value, CountSizes>* mid, AVLNode<Key, Value, CountSizes>* right);
+    AVLNode<Key, Value, CountSizes>* joinLeftSpine(AVLNode<Key, Value, CountSizes>* left, AVLNode<Key, Value, CountSizes>* mid, AVLNode<Key, Value, CountSizes>* right);
+    AVLNode<Key, Value, CountSizes>* concatNodes(AVLNode<Key, Value, CountSizes>* left, AVLNode<Key, Value, CountSizes>* right);
+    AVLNode<Key, Value, CountSizes>* splitLastNode(AVLNode<Key, Value, CountSizes>* root, AVLNode<Key, Value, CountSizes>*& last);
+    void splitNodes(AVLNode<Key, Value, CountSizes>* root, const Key& key, AVLNode<Key, Value, CountSizes>*& left,
+                    AVLNode<Key, Value, CountSizes>*& found, AVLNode<Key, Value, CountSizes>*& right);
+
+    // Nodes a set operation leaves out, chained through their parent pointers and
+    // destroyed by finishSetOperation() once every thread is done
+    struct DroppedNodes
+    {
+        AVLNode<Key, Value, CountSizes>* head;
+        AVLNode<Key, Value, CountSizes>* tail;
+    };
+    static void dropSubtree(DroppedNodes& dropped, AVLNode<Key, Value, CountSizes>* root);
+    static void dropNode(DroppedNodes& dropped, AVLNode<Key, Value, CountSizes>* node);
+    static void appendDropped(DroppedNodes& into, const DroppedNodes& from);
+
+    // Below this height on either side a set operation stops forking tasks
+    static const int PARALLEL_HEIGHT = 10;
+
+    TaskPool* setOperationPool(AVLNode<Key, Value, CountSizes>* a, AVLNode<Key, Value, CountSizes>* b, TaskPool& pool);
+    bool fewItemsBeside(AVLNode<Key, Value, CountSizes>* small, AVLNode<Key, Value, CountSizes>* big); //small enough to apply item by item?
+    void insertNodes(AVLNode<Key, Value, CountSizes>* root, bool replace); //links a detached subtree's nodes in one at a time
+    void removeKeysOf(AVLNode<Key, Value, CountSizes>* root); //removes a detached subtree's keys one at a time, then its nodes
+    void finishSetOperation(AVLNode<Key, Value, CountSizes>* root, DroppedNodes& dropped);
+    AVLNode<Key, Value, CountSizes>* unionNodes(AVLNode<Key, Value, CountSizes>* a, AVLNode<Key, Value, CountSizes>* b, DroppedNodes& dropped, TaskPool* pool);
+    AVLNode<Key, Value, CountSizes>* intersectNodes(AVLNode<Key, Value, CountSizes>* a, AVLNode<Key, Value, CountSizes>* b, DroppedNodes& dropped, TaskPool* pool);
+    AVLNode<Key, Value, CountSizes>* differenceNodes(AVLNode<Key, Value, CountSizes>* a, AVLNode<Key, Value, CountSizes>* b, DroppedNodes& dropped, bool& removed, TaskPool* pool);
+    AVLNode<Key, Value, CountSizes>* batchNodes(AVLNode<Key, Value, CountSizes>* a, const BatchOp<Key, Value>* ops, AVLNode<Key, Value, CountSizes>* const* nodes,
+                                                size_t count, DroppedNodes& dropped, TaskPool* pool);
+    AVLNode<Key, Value, CountSizes>* batchOneNode(AVLNode<Key, Value, CountSizes>* a, const BatchOp<Key, Value>* op, AVLNode<Key, Value, CountSizes>* node,
+                                                  DroppedNodes& dropped);
+    static const Key& batchKey(const BatchOp<Key, Value>* ops, AVLNode<Key, Value, CountSizes>* const* nodes, size_t i);
 };
 
-/*
- * Recall: If key is already in the tree, you should 
- * overwrite the current value with the updated value.
- */
-template<class Key, class Value>
-void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
+/**
+* Default constructor for an empty AVL tree.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+AVLTree<Key, Value, CountSizes, Compare, Stats>::AVLTree()
 {
-    // TODO
-		if(this->root_ == NULL){ //if the tree is empty
-			this->root_ = new AVLNode<Key, Value>(new_item.first, new_item.second, NULL);
-			return;
-		}
-		else if(BinarySearchTree<Key, Value>::internalFind(new_item.first) != NULL){ //if the key already exists within the tree
-			Node<Key, Value>* toUpdate = BinarySearchTree<Key, Value>::internalFind(new_item.first);
-			toUpdate->setValue(new_item.second);
-			return;
-		}
 
-		//if we get here, we know we have to add this node in somewhere (so we use BST insert and make the balance)
-		BSTinsert(new_item);
+}
 
-		AVLNode<Key, Value>* subtreeRoot = (AVLNode<Key, Value>*) BinarySearchTree<Key, Value>::internalFind(new_item.first);
-		//subtreeRoot = subtreeRoot->getParent();
-		Key newsKey = new_item.first;
+/**
+* Constructor for an empty AVL tree that orders its keys with comp.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+AVLTree<Key, Value, CountSizes, Compare, Stats>::AVLTree(const Compare& comp) :
+    BinarySearchTree<Key, Value, AVLNode<Key, Value, CountSizes>, Compare, Stats>(comp)
+{
 
-		while(subtreeRoot != NULL){
-			int leftHeight = findHeight(subtreeRoot->getLeft());
-			int rightHeight = findHeight(subtreeRoot->getRight());
-			subtreeRoot->setBalance((1+std::max(leftHeight, rightHeight))); //sets balance_ to the height of the biggest subtree
-
-
-			if((std::abs(leftHeight-rightHeight))>1){ //if the difference between the two trees is >1 (so it is unbalanced)
-
-				if(rightHeight>leftHeight){ //if the right subtree is longer than the left subtree, then it is either needs a left rotation or a right-left rotation
-					Key child = subtreeRoot->getRight()->getKey();
-					if(newsKey > child){ //new node is to the right of the "current root's" right child (zig-zig): needs a left rotation
-						leftRotate(subtreeRoot);
-					}
-					else if(newsKey < child){ //new node is to the left of the "current root's" right child (zig-zag): needs a right rotation and then a left
-						rightRotate(subtreeRoot->getRight()); //turns the tree into a zig-zig
-						leftRotate(subtreeRoot);
-					}
-				}
-
-				else if(leftHeight>rightHeight){ //if the left subtree is longer than the right subtree, then it either needs a right rotation or a left-right rotation
-					Key child = subtreeRoot->getLeft()->getKey();
-					if(newsKey < child){ //new node is to the left of the "current root's" left child (zag-zag): needs a right rotation
-						rightRotate(subtreeRoot);
-					}
-					else if(newsKey > child){ //new node is to the right of the "current root's" left zhild (zag-zig): needs a left rotation and then a right
-						leftRotate(subtreeRoot->getLeft()); //turns the tree into a zag-zag
-						rightRotate(subtreeRoot);
-					}
-				}
-			}
+}
+
+/**
+* Builds an AVL tree from a range of key/value pairs sorted by key in O(n),
+* with every height already set. See BinarySearchTree::assign().
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+template<typename ForwardIt>
+AVLTree<Key, Value, CountSizes, Compare, Stats>::AVLTree(ForwardIt first, ForwardIt last, const Compare& comp) :
+    BinarySearchTree<Key, Value, AVLNode<Key, Value, CountSizes>, Compare, Stats>(first, last, comp)
+{
 
-			subtreeRoot = subtreeRoot->getParent(); //iterate to update the balances above
-		}
-		
-		/*AVLNode<Key, Value>* rootroot = (AVLNode<Key, Value>*)this->root_;
-		rootroot->setBalance(1+std::max(findHeight(subtreeRoot->getLeft()), findHeight(subtreeRoot->getRight()))); //finalizes the balance_ factor of the now root
-		return;*/
 }
 
-/*
- * Recall: The writeup specifies that if a node has 2 children you
- * should swap with the predecessor and then remove.
- */
-template<class Key, class Value>
-void AVLTree<Key, Value>:: remove(const Key& key)
+/**
+* Move constructor, which takes over other's nodes in O(1).
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+AVLTree<Key, Value, CountSizes, Compare, Stats>::AVLTree(AVLTree&& other) :
+    BinarySearchTree<Key, Value, AVLNode<Key, Value, CountSizes>, Compare, Stats>(std::move(other))
 {
-    // TODO
-		if(BinarySearchTree<Key, Value>::internalFind(key) == NULL){
-			return;
-		}
 
-		AVLNode<Key, Value>* subtreeRoot = BSTremove(key); //remove the node and return the root of the subtree that needs to be checked (aka removed's parent)
+}
 
-		if(this->root_ == NULL){ //if we just removed the last element, we're done
-			return;
-		}
+/**
+* Move assignment, which frees this tree's nodes and takes over other's in O(1).
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+AVLTree<Key, Value, CountSizes, Compare, Stats>& AVLTree<Key, Value, CountSizes, Compare, Stats>::operator=(AVLTree&& other)
+{
+    BinarySearchTree<Key, Value, AVLNode<Key, Value, CountSizes>, Compare, Stats>::operator=(std::move(other));
+    return *this;
+}
 
-		//update balances of the left and right
-		if(subtreeRoot->getRight() != NULL){ 
-			subtreeRoot->getRight()->setBalance(1+std::max(findHeight(subtreeRoot->getRight()->getLeft()), findHeight(subtreeRoot->getRight()->getRight())));
-		}
-		if(subtreeRoot->getLeft() != NULL){
-			subtreeRoot->getLeft()->setBalance(1+std::max(findHeight(subtreeRoot->getLeft()->getLeft()), findHeight(subtreeRoot->getLeft()->getRight())));
-		}
+/*
+ * Called by BinarySearchTree::linkNode() right after the new node has been
+ * linked in (existing keys are overwritten there without ever reaching here),
+ * so the balances only have to be fixed from the new node upwards.
+ *
+ * An insertion can only make a subtree one taller. Once a subtree comes out
+ * of rebalance() as tall as it was before (because its other side was the
+ * taller one, or because a rotation brought it back down), nothing above it
+ * changes, so the walk stops there. That happens after at most one (single
+ * or double) rotation, and on average after about two levels.
+ */
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+void AVLTree<Key, Value, CountSizes, Compare, Stats>::insertFix(AVLNode<Key, Value, CountSizes>* node)
+{
+		node->updateFromChildren(); //a new leaf, so height 1 (nodes are created with 0)
+		AVLNode<Key, Value, CountSizes>* subtreeRoot = node->getParent();
 
 		while(subtreeRoot != NULL){
-			//int leftHeight = subtreeRoot->getLeft()->getBalance();
-			//int rightHeight = subtreeRoot->getRight()->getBalance();
-			int leftHeight = findHeight(subtreeRoot->getLeft());
-			int rightHeight = findHeight(subtreeRoot->getRight());
-			subtreeRoot->setBalance((1+std::max(leftHeight, rightHeight))); //sets balance_ to the height of the biggest subtree
-
-			if((std::abs(leftHeight-rightHeight))>1){ //if the difference between the two trees is >1 (so it is unbalanced)
-				AVLNode<Key, Value>* child = NULL;
-				AVLNode<Key, Value>* grandchild = NULL;
-
-				if(rightHeight>leftHeight){ //if the right child is the larger subtree
-					child = subtreeRoot->getRight();
-				}
-				else if(leftHeight>rightHeight){ //if the left child is the larger subtree
-					child = subtreeRoot->getLeft();
-				}
-
-				if(findHeight(child->getRight())>findHeight(child->getLeft())){ //if the right grandchild is the larger subtree
-					grandchild = child->getRight();
-				}
-				else if(findHeight(child->getLeft())>findHeight(child->getRight())){ //if the left child is the larger subtree
-					grandchild = child->getLeft();
-				}
-				else if(findHeight(child->getRight()) == findHeight(child->getLeft())){ //the grandchildren are equal heights
-					if(subtreeRoot->getLeft()==child){
-						grandchild = child->getLeft();
-					}
-					else if(subtreeRoot->getRight()==child){
-						grandchild = child->getRight();
-					}
-				}
-
-				//if(grandchild != NULL){ //account for no grandchild?? hard-coded, remove later
-					if(rightHeight>leftHeight){ //if the right subtree is longer than the left subtree, then it is either needs a left rotation or a right-left rotation
-						if(grandchild->getKey() > child->getKey()){  //if the grandchild key is greater than the child, then we know its zig-zig
-							leftRotate(subtreeRoot);
-						}
-						else if(grandchild->getKey() < child->getKey()){ //zig-zag
-							rightRotate(subtreeRoot->getRight()); //turns the tree into a zig-zig
-							leftRotate(subtreeRoot);
-						}
-					}
-
-					else if(leftHeight>rightHeight){ //if the left subtree is longer than the right subtree, then it either needs a right rotation or a left-right rotation
-						if(grandchild->getKey() < child->getKey()){  //if the grandchild key is greater than the child, then we know its zag-zag
-							rightRotate(subtreeRoot);
-						}
-						else if(grandchild->getKey() > child->getKey()){  //zag-zig
-							leftRotate(subtreeRoot->getLeft()); //turns the tree into a zag-zag
-							rightRotate(subtreeRoot);
-						}
-					}
-				//}
+			int oldHeight = subtreeRoot->getBalance();
+			subtreeRoot = rebalance(subtreeRoot); //returns whatever node now heads this subtree
+			if(subtreeRoot->getBalance() == oldHeight){ //same height as before, so the ancestors are unaffected
+				break;
 			}
-			subtreeRoot = subtreeRoot->getParent(); //advance up the tree
+			subtreeRoot = subtreeRoot->getParent(); //iterate to update the balances above
 		}
 
+		updateSizesAbove(subtreeRoot); //the ancestors above the stop still hold one node more
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+/*
+ * Called by BinarySearchTree::remove() and erase() once the node is out of
+ * the tree (a node with 2 children has been replaced by its predecessor),
+ * with the lowest node whose subtree lost a node.
+ *
+ * A removal can only make a subtree one shorter. Unlike an insertion, a
+ * rotation does not always undo that, so the walk goes on until a subtree
+ * comes out of rebalance() as tall as it was before.
+ */
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+void AVLTree<Key, Value, CountSizes, Compare, Stats>::removeFix(AVLNode<Key, Value, CountSizes>* node)
 {
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
-    int8_t tempB = n1->getBalance();
-    n1->setBalance(n2->getBalance());
-    n2->setBalance(tempB);
-}
+		AVLNode<Key, Value, CountSizes>* subtreeRoot = node;
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::BSTinsert(const std::pair<const Key, Value> &newPair){ //copied from bst.h
-	bool done = false;
-	AVLNode<Key, Value>* toUpdate = (AVLNode<Key, Value>*)this->root_;
-
-	while(!done){ //traverse to find the correct spot
-		if(newPair.first>toUpdate->getKey()){ //go right
-			if(toUpdate->getRight()==NULL){ //if there's an empty spot, put it there and finish
-				toUpdate->setRight(new AVLNode<Key, Value>(newPair.first, newPair.second, toUpdate));
-				done = true;
-			}
-			else{ //no empty spot, continuing going down this tree
-				toUpdate = toUpdate->getRight();
+		while(subtreeRoot != NULL){
+			int oldHeight = subtreeRoot->getBalance();
+			subtreeRoot = rebalance(subtreeRoot); //returns whatever node now heads this subtree
+			if(subtreeRoot->getBalance() == oldHeight){ //same height as before, so the ancestors are unaffected
+				break;
 			}
+			subtreeRoot = subtreeRoot->getParent(); //advance up the tree
 		}
 
-		else if(newPair.first<toUpdate->getKey()){ //go left
-			if(toUpdate->getLeft()==NULL){ //if there's an empty spot, put it there and finish
-				toUpdate->setLeft(new AVLNode<Key, Value>(newPair.first, newPair.second, toUpdate));
-				done = true;
-			}
-			else{ //no empty spot, continue going down this tree
-				toUpdate = toUpdate->getLeft();
-			}
-		}
-	}
+		updateSizesAbove(subtreeRoot); //the ancestors above the stop still count the removed node
 }
 
-template<class Key, class Value>
-AVLNode<Key, Value>* AVLTree<Key, Value>::BSTremove(const Key &key){ //copied from bst.h
-	AVLNode<Key, Value>* toRemove = (AVLNode<Key, Value>*) BinarySearchTree<Key, Value>::internalFind(key);
-	AVLNode<Key, Value>* p = toRemove->getParent(); //keep the parent so that we can use it later in 'remove fix' (remove())
-
+/**
+ * Snapshots of an AVL tree are height balanced, and only those can be loaded
+ * into one: load() keeps the saved shape as it is.
+ */
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+uint8_t AVLTree<Key, Value, CountSizes, Compare, Stats>::snapshotKind() const
+{
+    return this->HEIGHT_BALANCED_SHAPE;
+}
 
-	if(toRemove->getLeft() == NULL && toRemove->getRight() == NULL){ //no children
-		if(toRemove == this->root_){ //if this is the root
-			this->root_ = NULL;
-		}
-		else if(toRemove->getParent()->getLeft() == toRemove){ //if this node is the left child of its parent
-			toRemove->getParent()->setLeft(NULL);
-		}
-		else if(toRemove->getParent()->getRight() == toRemove){ //if this node is the right child of its parent
-			toRemove->getParent()->setRight(NULL);
-		}
-	}
+/**
+* Recomputes the height of node from its (already correct) children and, if
+* the two sides now differ by more than one, rotates it back into shape. The
+* rotation is picked from the heights of the taller child's children: if the
+* inner grandchild is the taller one it is a double rotation, otherwise a
+* single one (an equal split only happens after a removal, where the single
+* rotation is the one that keeps the result balanced). Returns the node that
+* heads the subtree afterwards, which is node itself if nothing was rotated.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+AVLNode<Key, Value, CountSizes>* AVLTree<Key, Value, CountSizes, Compare, Stats>::rebalance(AVLNode<Key, Value, CountSizes>* node)
+{
+		int leftHeight = findHeight(node->getLeft());
+		int rightHeight = findHeight(node->getRight());
 
-	else if((toRemove->getLeft() != NULL && toRemove->getRight() == NULL) || (toRemove->getLeft() == NULL && toRemove->getRight() != NULL)){ //if only one child
-		if(toRemove->getLeft() != NULL && toRemove->getRight() == NULL){ //left child, no right child
-			AVLNode<Key, Value>* n = toRemove->getLeft();
-			if(toRemove->getParent()==NULL){ //if this is the root 
-				this->root_ = n;
-				n->setParent(NULL);
-			}
-			else{ 
-				if(toRemove->getParent()->getRight()==toRemove){ //if the node is the right child of its parent
-					toRemove->getParent()->setRight(n); //make the child be the new right child
-				}
-				else if(toRemove->getParent()->getLeft()==toRemove){ //if the node is the left child of its parent
-					toRemove->getParent()->setLeft(n); //make the child be the new left child
-				}
-				n->setParent(toRemove->getParent()); //make the parent of the new child the parent
+		if(rightHeight - leftHeight > 1){ //right side is too tall: a left rotation, or a right-left rotation
+			AVLNode<Key, Value, CountSizes>* child = node->getRight();
+			if(findHeight(child->getLeft()) > findHeight(child->getRight())){ //zig-zag
+				rightRotate(child); //turns the tree into a zig-zig
 			}
+			leftRotate(node);
+			return node->getParent();
 		}
-
-		else if(toRemove->getLeft() == NULL && toRemove->getRight() != NULL){ //right child, no left child
-			AVLNode<Key, Value>* n = toRemove->getRight();
-			if(toRemove->getParent()==NULL){ //if this is the root
-				this->root_ = n;
-				n->setParent(NULL);
-			}
-			else{ 
-				if(toRemove->getParent()->getRight()==toRemove){ //if the node is the right child of its parent
-					toRemove->getParent()->setRight(n); //make the child be the new right child
-				}
-				else if(toRemove->getParent()->getLeft()==toRemove){ //if the node is the left child of its parent
-					toRemove->getParent()->setLeft(n); //make the child be the new left child
-				}
-				n->setParent(toRemove->getParent()); //make the parent of the new child the parent
+		if(leftHeight - rightHeight > 1){ //left side is too tall: a right rotation, or a left-right rotation
+			AVLNode<Key, Value, CountSizes>* child = node->getLeft();
+			if(findHeight(child->getRight()) > findHeight(child->getLeft())){ //zag-zig
+				leftRotate(child); //turns the tree into a zag-zag
 			}
+			rightRotate(node);
+			return node->getParent();
 		}
-	}
 
-	else{ //both children exist
-		AVLNode<Key, Value>* pred = (AVLNode<Key, Value>*)BinarySearchTree<Key, Value>::predecessor(toRemove);
-		nodeSwap(toRemove, pred);
-		p = toRemove->getParent(); // !!!UPDATE PARENT AFTER SWAPPING TO MAKE SURE WE RETURN THE CORRECT NODE TO LOOK AT IN REMOVE() !!
-		if(toRemove->getLeft() == NULL && toRemove->getRight() == NULL){ //leaf (0 children case)
-			if(toRemove->getParent()==NULL){ //if we're at the root
-				this->root_ = NULL;
-			}
-			else if(toRemove->getParent()->getLeft() == toRemove){ //if this node is the left child of its parent
-				toRemove->getParent()->setLeft(NULL);
-			}
-			else if(toRemove->getParent()->getRight() == toRemove){ //if this node is the right child of its parent
-				toRemove->getParent()->setRight(NULL);
-			}
+		node->updateFromChildren(); //sets balance_ to the height of the biggest subtree (and the subtree size, if counted)
+		return node;
+}
+
+/**
+* Brings the subtree sizes of node's ancestors up to date after retracing
+* stopped at node (or ran off the top, when node is NULL). Only order-statistic
+* trees count sizes; for the others this compiles to nothing.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+void AVLTree<Key, Value, CountSizes, Compare, Stats>::updateSizesAbove(AVLNode<Key, Value, CountSizes>* node)
+{
+		if(!CountSizes || node == NULL){
+			return;
 		}
-		else if(toRemove->getLeft() != NULL && toRemove->getRight() == NULL){ //left child, no right child (1 child case)
-			Node<Key, Value>* n = toRemove->getLeft();
-			if(toRemove->getParent()==NULL){ //if this is the root
-				this->root_ = n;
-				n->setParent(NULL);
-			}
-			else{ 
-				if(toRemove->getParent()->getRight()==toRemove){ //if the node is the right child of its parent
-					toRemove->getParent()->setRight(n); //make the child be the new right child
-				}
-				else if(toRemove->getParent()->getLeft()==toRemove){ //if the node is the left child of its parent
-					toRemove->getParent()->setLeft(n); //make the child be the new left child
-				}
-				n->setParent(toRemove->getParent()); //make the parent of the new child the parent
-			}
+		for(AVLNode<Key, Value, CountSizes>* p = node->getParent(); p != NULL; p = p->getParent()){
+			p->updateFromChildren(); //its height is already right, so only the size changes
 		}
-	}
-
-	delete toRemove;
-
-	if(p==NULL && this->root_!=NULL){ //we ended up deleting the root
-		p = (AVLNode<Key, Value>*)this->root_; //we're going to have to check the entire tree
-	}
-	else if(this->root_ == NULL){ //we removed the root and the tree is empty now
-		return NULL;
-	}
-	return p;
-
 }
 
-template<class Key, class Value>
-int AVLTree<Key, Value>::findHeight(AVLNode<Key, Value>* a){
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+int AVLTree<Key, Value, CountSizes, Compare, Stats>::findHeight(AVLNode<Key, Value, CountSizes>* a){
 	if (a==NULL){
 		return 0; //no node is 0 
 	}
 	return a->getBalance(); //the balance is updated through setBalance(), usually end up setting the balance within the functions where it is used
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rightRotate(AVLNode<Key, Value>* y){ //based off of slide 24 in L14_BalancedBST_AVL.pdf
-	AVLNode<Key, Value>* p = y->getParent();
-	AVLNode<Key, Value>* x = y->getLeft();
-	AVLNode<Key, Value>* b = x->getRight();
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+void AVLTree<Key, Value, CountSizes, Compare, Stats>::rightRotate(AVLNode<Key, Value, CountSizes>* y){ //based off of slide 24 in L14_BalancedBST_AVL.pdf
+	AVLNode<Key, Value, CountSizes>* p = y->getParent();
+	AVLNode<Key, Value, CountSizes>* x = y->getLeft();
+	AVLNode<Key, Value, CountSizes>* b = x->getRight();
+	this->stats_.rotated();
 
 	if(y == this->root_){
 		this->root_ = x;
@@ -461,8 +544,8 @@ void AVLTree<Key, Value>::rightRotate(AVLNode<Key, Value>* y){ //based off of sl
 	x->setRight(y); //make x's right child y 
 
 		//update the balances, starting from the bottom
-	y->setBalance(1+std::max(findHeight(y->getLeft()), findHeight(y->getRight())));
-	x->setBalance(1+std::max(findHeight(x->getLeft()), findHeight(x->getRight()))); 
+	y->updateFromChildren();
+	x->updateFromChildren(); 
 
 	if(p!=NULL){ //if y was not the root
 		if(p->getLeft()==y){ //if y was the left child of p, make p's new left child x
@@ -471,16 +554,16 @@ void AVLTree<Key, Value>::rightRotate(AVLNode<Key, Value>* y){ //based off of sl
 		else if(p->getRight()==y){ //if y was the right child of p, make p's new right child x
 			p->setRight(x);
 		}
-		p->setBalance(1+std::max(findHeight(p->getLeft()), findHeight(p->getRight()))); //update the balance of p
 	}
 	
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::leftRotate(AVLNode<Key, Value>* x){ //based off of slide 23 in L14_BalancedBST_AVL.pdf
-	AVLNode<Key, Value>* p = x->getParent();
-	AVLNode<Key, Value>* y = x->getRight();
-	AVLNode<Key, Value>* b = x->getRight()->getLeft();
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+void AVLTree<Key, Value, CountSizes, Compare, Stats>::leftRotate(AVLNode<Key, Value, CountSizes>* x){ //based off of slide 23 in L14_BalancedBST_AVL.pdf
+	AVLNode<Key, Value, CountSizes>* p = x->getParent();
+	AVLNode<Key, Value, CountSizes>* y = x->getRight();
+	AVLNode<Key, Value, CountSizes>* b = x->getRight()->getLeft();
+	this->stats_.rotated();
 
 	if(x == this->root_){
 		this->root_ = y;
@@ -496,8 +579,8 @@ void AVLTree<Key, Value>::leftRotate(AVLNode<Key, Value>* x){ //based off of sli
 	x->setParent(y); //make x's parent y
 
 	//update the balances, starting from the bottom
-	x->setBalance(1+std::max(findHeight(x->getLeft()), findHeight(x->getRight())));
-	y->setBalance(1+std::max(findHeight(y->getLeft()), findHeight(y->getRight()))); 
+	x->updateFromChildren();
+	y->updateFromChildren(); 
 
 	if(p!=NULL){ //if x was not the root
 		if(p->getLeft()==x){ //if x was the left child of p, make p's new left child y
@@ -506,10 +589,1050 @@ void AVLTree<Key, Value>::leftRotate(AVLNode<Key, Value>* x){ //based off of sli
 		else if(p->getRight()==x){ //if x was the right child of p, make p's new right child y
 			p->setRight(y);
 		}
-		p->setBalance(1+std::max(findHeight(p->getLeft()), findHeight(p->getRight()))); //update the balance of p
 	}
 
 }
 
 
+/**
+* Returns the number of items in the tree in O(1).
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+size_t AVLTree<Key, Value, CountSizes, Compare, Stats>::size() const
+{
+    static_assert(CountSizes, "size() needs an order-statistic tree, AVLTree<Key, Value, true>");
+    return this->root_ == NULL ? 0 : this->root_->getSize();
+}
+
+/**
+* Returns an iterator to the item with the k-th smallest key (counting from 0),
+* or the end iterator if k is not less than size(). Runs in O(log n).
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+typename AVLTree<Key, Value, CountSizes, Compare, Stats>::iterator AVLTree<Key, Value, CountSizes, Compare, Stats>::select(size_t k) const
+{
+    static_assert(CountSizes, "select() needs an order-statistic tree, AVLTree<Key, Value, true>");
+    AVLNode<Key, Value, CountSizes>* curr = this->root_;
+    while(curr != NULL){
+        size_t leftSize = curr->getLeft() == NULL ? 0 : curr->getLeft()->getSize();
+        if(k < leftSize){ //it is in the left subtree
+            curr = curr->getLeft();
+        }
+        else if(k == leftSize){ //exactly leftSize keys are smaller than this one
+            break;
+        }
+        else{ //skip the left subtree and this node
+            k -= leftSize + 1;
+            curr = curr->getRight();
+        }
+    }
+    return this->makeIterator(curr);
+}
+
+/**
+* Returns the number of keys in the tree that are less than key (whether or not
+* key itself is present), i.e. the position key has or would have. Runs in O(log n).
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+size_t AVLTree<Key, Value, CountSizes, Compare, Stats>::rank(const Key& key) const
+{
+    static_assert(CountSizes, "rank() needs an order-statistic tree, AVLTree<Key, Value, true>");
+    size_t smaller = 0;
+    AVLNode<Key, Value, CountSizes>* curr = this->root_;
+    while(curr != NULL){
+        if(this->comp_(curr->getKey(), key)){ //this node and its whole left subtree are smaller
+            smaller += 1 + (curr->getLeft() == NULL ? 0 : curr->getLeft()->getSize());
+            curr = curr->getRight();
+        }
+        else{
+            curr = curr->getLeft();
+        }
+    }
+    return smaller;
+}
+
+/**
+* Returns the number of keys k with lo <= k < hi in O(log n).
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+size_t AVLTree<Key, Value, CountSizes, Compare, Stats>::countInRange(const Key& lo, const Key& hi) const
+{
+    static_assert(CountSizes, "countInRange() needs an order-statistic tree, AVLTree<Key, Value, true>");
+    if(!this->comp_(lo, hi)){ //empty range
+        return 0;
+    }
+    return rank(hi) - rank(lo);
+}
+
+/**
+* Adds every item of other to this tree, leaving other empty. For keys in both
+* trees other's value wins, as if each of its items had been insert()ed.
+*
+* The trees are combined with the join-based algorithm of Blelloch, Ferizovic
+* and Sun ("Just Join for Parallel Ordered Sets", SPAA 2016): other is split
+* around this tree's root, the two halves are combined with this tree's
+* subtrees recursively, and the results are joined back under the root. Only
+* pointers are relinked; other's nodes move over without being copied, and
+* only the nodes of duplicate keys are destroyed. For trees of sizes m <= n
+* this takes O(m log(n/m + 1)) time, so merging a small tree into a big one
+* costs about as much as m inserts, and never more than a linear merge.
+* The two recursive calls touch disjoint subtrees, so on big inputs they run
+* as separate tasks on pool. That only happens when pool has at least two
+* threads; it has only been run on a single-CPU machine, where the tasks take
+* turns, so whether it actually scales is unmeasured.
+*
+* When one tree has fewer than about n / log n items (n the size of the other)
+* the splits and joins cost more than they save, so its nodes are instead
+* linked into the other tree one at a time, each like an insert().
+*
+* Comparing keys and move-assigning values must not throw.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+void AVLTree<Key, Value, CountSizes, Compare, Stats>::unionWith(AVLTree&& other, TaskPool& pool)
+{
+    if(this == &other){
+        return;
+    }
+    AVLNode<Key, Value, CountSizes>* a = this->root_;
+    AVLNode<Key, Value, CountSizes>* b = other.root_;
+    this->root_ = NULL;
+    other.setRoot(NULL);
+    this->pool_.splice(other.pool_); //other's nodes now belong to this tree
+
+    if(fewItemsBeside(b, a)){ //a handful of other's items: insert them one at a time
+        this->setRoot(a);
+        insertNodes(b, true);
+        return;
+    }
+    if(fewItemsBeside(a, b)){ //a handful of this tree's items: add them to other's tree instead
+        this->setRoot(b);
+        insertNodes(a, false);
+        return;
+    }
+
+    DroppedNodes dropped = { NULL, NULL };
+    AVLNode<Key, Value, CountSizes>* result = NULL;
+    TaskPool* workers = setOperationPool(a, b, pool);
+    if(workers == NULL){
+        result = unionNodes(a, b, dropped, NULL);
+    }
+    else{
+        workers->run([&]() { result = unionNodes(a, b, dropped, workers); });
+    }
+    finishSetOperation(result, dropped);
+}
+
+/**
+* Keeps only the items whose keys are also in other (with this tree's values)
+* and leaves other empty. Works like unionWith(), in the same time.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+void AVLTree<Key, Value, CountSizes, Compare, Stats>::intersectWith(AVLTree&& other, TaskPool& pool)
+{
+    if(this == &other){
+        return;
+    }
+    AVLNode<Key, Value, CountSizes>* a = this->root_;
+    AVLNode<Key, Value, CountSizes>* b = other.root_;
+    this->root_ = NULL;
+    other.setRoot(NULL);
+    this->pool_.splice(other.pool_);
+
+    DroppedNodes dropped = { NULL, NULL };
+    AVLNode<Key, Value, CountSizes>* result = NULL;
+    TaskPool* workers = setOperationPool(a, b, pool);
+    if(workers == NULL){
+        result = intersectNodes(a, b, dropped, NULL);
+    }
+    else{
+        workers->run([&]() { result = intersectNodes(a, b, dropped, workers); });
+    }
+    finishSetOperation(result, dropped);
+}
+
+/**
+* Removes every item whose key is in other and leaves other empty. Works like
+* unionWith(), in the same time, except that split-and-join only runs on
+* pool's threads: on one thread removing other's keys one at a time (or
+* looking each of this tree's keys up in other, if this tree is the smaller)
+* was faster at every size in bst-setops-bench, so that is done instead.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+void AVLTree<Key, Value, CountSizes, Compare, Stats>::differenceWith(AVLTree&& other, TaskPool& pool)
+{
+    if(this == &other){
+        this->clear();
+        return;
+    }
+    AVLNode<Key, Value, CountSizes>* a = this->root_;
+    AVLNode<Key, Value, CountSizes>* b = other.root_;
+    this->root_ = NULL;
+    other.setRoot(NULL);
+    this->pool_.splice(other.pool_);
+
+    TaskPool* workers = setOperationPool(a, b, pool);
+    bool fewRemoved = fewItemsBeside(b, a);
+    bool fewKept = !fewRemoved && fewItemsBeside(a, b);
+    if(workers == NULL && !fewRemoved && !fewKept){ //on one thread the joins never beat item by item, so go from the smaller side
+        fewRemoved = findHeight(b) <= findHeight(a);
+        fewKept = !fewRemoved;
+    }
+    if(fewRemoved){ //remove other's keys one at a time
+        this->setRoot(a);
+        removeKeysOf(b);
+        return;
+    }
+    DroppedNodes dropped = { NULL, NULL };
+    if(fewKept){ //look each of our items up in other
+        this->setRoot(a);
+        for(iterator it = this->begin(); it != this->end(); ){
+            AVLNode<Key, Value, CountSizes>* parent;
+            bool goLeft;
+            if(this->findInsertPositionBelow(b, it->first, parent, goLeft) != NULL){
+                it = this->erase(it);
+            }
+            else{
+                ++it;
+            }
+        }
+        dropSubtree(dropped, b);
+        finishSetOperation(this->root_, dropped);
+        return;
+    }
+
+    AVLNode<Key, Value, CountSizes>* result = NULL;
+    bool removed = false;
+    workers->run([&]() { result = differenceNodes(a, b, dropped, removed, workers); });
+    finishSetOperation(result, dropped);
+}
+
+/**
+* Applies a batch of upserts and erases. The batch is sorted by key (unless it
+* already is), and of several operations on one key only the last counts, so
+* the outcome is the same as calling insert() and remove() in batch order.
+*
+* The sorted batch is merged in like unionWith() merges a tree, with the
+* batch split by binary search instead of by splitting a tree: the operations
+* are divided around the root's key, each part is applied to one subtree of
+* the root (as separate tasks on pool when both are big), and the results are
+* joined back under the root, or concatenated if the root's key is erased.
+* Subtrees that no operation falls into are not visited and every subtree is
+* rebalanced once, by the join that puts it back together. After the sort
+* this is O(m log(n/m + 1)) for m operations on n items: about m inserts for a
+* small batch, and linear like a rebuild for one as big as the tree.
+*
+* Upserted keys that are already in the tree keep their node (iterators to
+* them stay valid) and get the new value. The nodes for new keys are created
+* before the tree is touched, so if that throws the tree is unchanged.
+* Comparing keys and move-assigning values must not throw. A tree that counts
+* its operations (see CountingStats) applies the batch on the calling thread.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+void AVLTree<Key, Value, CountSizes, Compare, Stats>::applyBatch(std::vector<BatchOp<Key, Value> > ops, TaskPool& pool)
+{
+    Compare comp = this->comp_;
+    auto byKey = [comp](const BatchOp<Key, Value>& a, const BatchOp<Key, Value>& b) { return comp(a.item.first, b.item.first); };
+    if(!std::is_sorted(ops.begin(), ops.end(), byKey)){
+        std::stable_sort(ops.begin(), ops.end(), byKey); //stable, so operations on the same key stay in batch order
+    }
+    size_t kept = 0;
+    for(size_t i = 0; i < ops.size(); ++i){
+        if(i + 1 < ops.size() && !byKey(ops[i], ops[i + 1])){ //a later operation on the same key overrides this one
+            continue;
+        }
+        if(kept != i){
+            ops[kept] = std::move(ops[i]);
+        }
+        ++kept;
+    }
+    ops.erase(ops.begin() + kept, ops.end());
+
+    std::vector<AVLNode<Key, Value, CountSizes>*> nodes(ops.size(), NULL); //the new node of each upsert
+    try{
+        for(size_t i = 0; i < ops.size(); ++i){
+            if(ops[i].kind == BatchOp<Key, Value>::UPSERT){
+                nodes[i] = this->createNode(NULL, std::move(ops[i].item));
+            }
+        }
+    }
+    catch(...){
+        for(size_t i = 0; i < nodes.size(); ++i){
+            if(nodes[i] != NULL){
+                this->destroyNode(nodes[i]);
+            }
+        }
+        throw;
+    }
+
+    AVLNode<Key, Value, CountSizes>* a = this->root_;
+    this->root_ = NULL;
+    DroppedNodes dropped = { NULL, NULL };
+    AVLNode<Key, Value, CountSizes>* result = NULL;
+    bool counting = !std::is_same<Stats, NoStats>::value; //single operations count their rotations (see batchOneNode())
+    if(counting || pool.size() < 2 || ops.size() < ((size_t)1 << PARALLEL_HEIGHT)){
+        result = batchNodes(a, ops.data(), nodes.data(), ops.size(), dropped, NULL);
+    }
+    else{
+        TaskPool* workers = &pool;
+        workers->run([&]() { result = batchNodes(a, ops.data(), nodes.data(), ops.size(), dropped, workers); });
+    }
+    finishSetOperation(result, dropped);
+}
+
+/**
+* Moves every item whose key is not less than key into a new tree, which is
+* returned; this tree keeps the smaller keys. Both are valid AVL trees. The
+* nodes are not copied: the search path to key is cut and the pieces hanging
+* off it are joined back together on either side (see splitNodes()), so this
+* runs in O(log n). The nodes of the returned tree stay in this tree's slabs,
+* which the two trees share from then on (see NodePool::share()).
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+AVLTree<Key, Value, CountSizes, Compare, Stats> AVLTree<Key, Value, CountSizes, Compare, Stats>::split(const Key& key)
+{
+    AVLTree upper(this->comp_);
+    AVLNode<Key, Value, CountSizes>* left;
+    AVLNode<Key, Value, CountSizes>* found;
+    AVLNode<Key, Value, CountSizes>* right;
+    splitNodes(this->root_, key, left, found, right);
+    if(found != NULL){ //key itself goes up, as the smallest key there
+        right = joinNodes(NULL, found, right);
+    }
+    this->setRoot(detachNode(left)); //the finger may have gone up
+    upper.setRoot(detachNode(right));
+    if(upper.root_ != NULL){
+        this->pool_.share(upper.pool_);
+    }
+    return upper;
+}
+
+/**
+* Moves every item of other into this tree and leaves other empty. The keys
+* of the two trees must not interleave: all of other's keys have to be bigger
+* than all of this tree's, or all smaller. The trees are glued together
+* through the biggest node of the lower one without copying any node, in
+* O(log n). This tree keeps its comparator and rememberInserts() setting even
+* when it starts out empty. Throws std::invalid_argument if the key ranges
+* overlap.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+void AVLTree<Key, Value, CountSizes, Compare, Stats>::join(AVLTree&& other)
+{
+    if(other.root_ == NULL){
+        return;
+    }
+    if(this == &other){
+        throw std::invalid_argument("Trees overlap");
+    }
+    if(this->root_ == NULL){ //other's nodes become ours as they are; comp_ and rememberInserts() stay ours
+        this->setRoot(other.root_);
+        other.setRoot(NULL);
+        this->pool_.splice(other.pool_);
+        return;
+    }
+
+    AVLNode<Key, Value, CountSizes>* thisMin = this->root_;
+    AVLNode<Key, Value, CountSizes>* thisMax = this->root_;
+    AVLNode<Key, Value, CountSizes>* otherMin = other.root_;
+    AVLNode<Key, Value, CountSizes>* otherMax = other.root_;
+    while(thisMin->getLeft() != NULL){
+        thisMin = thisMin->getLeft();
+    }
+    while(thisMax->getRight() != NULL){
+        thisMax = thisMax->getRight();
+    }
+    while(otherMin->getLeft() != NULL){
+        otherMin = otherMin->getLeft();
+    }
+    while(otherMax->getRight() != NULL){
+        otherMax = otherMax->getRight();
+    }
+
+    AVLNode<Key, Value, CountSizes>* root;
+    if(this->comp_(thisMax->getKey(), otherMin->getKey())){ //other goes on the right
+        root = concatNodes(this->root_, other.root_);
+    }
+    else if(this->comp_(otherMax->getKey(), thisMin->getKey())){ //other goes on the left
+        root = concatNodes(other.root_, this->root_);
+    }
+    else{
+        throw std::invalid_argument("Trees overlap");
+    }
+    this->setRoot(root);
+    other.setRoot(NULL);
+    this->pool_.splice(other.pool_);
+}
+
+/**
+* Removes the items in [first, last) and returns last. A range shorter than the
+* tree is tall is erased item by item. A longer one is cut out whole: the tree
+* is split along the paths to first and to last (see splitNodes()), what lies
+* between is destroyed, and the outer pieces are joined back around last's
+* node. That makes the whole call O(k + log n) for k items, subtree sizes
+* included, instead of O(k log n). Iterators to the items kept stay valid.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+typename AVLTree<Key, Value, CountSizes, Compare, Stats>::iterator
+AVLTree<Key, Value, CountSizes, Compare, Stats>::erase(iterator first, iterator last)
+{
+    int shortRange = findHeight(this->root_);
+    iterator probe = first;
+    while(probe != last && shortRange > 0){
+        ++probe;
+        --shortRange;
+    }
+    if(probe == last){
+        return BinarySearchTree<Key, Value, AVLNode<Key, Value, CountSizes>, Compare, Stats>::erase(first, last);
+    }
+
+    AVLNode<Key, Value, CountSizes>* firstNode = this->iteratorNode(first);
+    AVLNode<Key, Value, CountSizes>* lastNode = this->iteratorNode(last);
+    AVLNode<Key, Value, CountSizes>* left;
+    AVLNode<Key, Value, CountSizes>* found;
+    AVLNode<Key, Value, CountSizes>* right;
+    DroppedNodes dropped = { NULL, NULL };
+    splitNodes(this->root_, firstNode->getKey(), left, found, right); //found is firstNode
+    dropNode(dropped, found);
+    if(lastNode == NULL){ //everything from first on goes
+        dropSubtree(dropped, right);
+        finishSetOperation(left, dropped);
+        return last;
+    }
+    AVLNode<Key, Value, CountSizes>* middle;
+    AVLNode<Key, Value, CountSizes>* rest;
+    splitNodes(right, lastNode->getKey(), middle, found, rest); //found is lastNode
+    dropSubtree(dropped, middle);
+    finishSetOperation(joinNodes(left, found, rest), dropped);
+    return last;
+}
+
+/**
+* Returns the pool a set operation on subtrees a and b should fork on, or NULL
+* if the smaller side is too small to be worth handing to other threads.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+TaskPool* AVLTree<Key, Value, CountSizes, Compare, Stats>::setOperationPool(AVLNode<Key, Value, CountSizes>* a, AVLNode<Key, Value, CountSizes>* b, TaskPool& pool)
+{
+    if(pool.size() < 2 || std::min(findHeight(a), findHeight(b)) < PARALLEL_HEIGHT){
+        return NULL;
+    }
+    return &pool;
+}
+
+/**
+* Returns true if subtree small holds so few items next to subtree big that
+* applying them one at a time, about m log n work for m items, clearly beats
+* splitting and joining. big's size is taken as the fewest nodes an AVL tree
+* of its height can have, so the estimate errs towards the join-based path,
+* and small is only counted as far as the limit.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+bool AVLTree<Key, Value, CountSizes, Compare, Stats>::fewItemsBeside(AVLNode<Key, Value, CountSizes>* small, AVLNode<Key, Value, CountSizes>* big)
+{
+    int height = findHeight(big);
+    if(height == 0){
+        return false;
+    }
+    size_t fewest = 1; //fewest nodes at the current height
+    size_t fewestBelow = 0; //and at one less
+    for(int h = 2; h <= height; ++h){
+        size_t next = fewest + fewestBelow + 1;
+        fewestBelow = fewest;
+        fewest = next;
+    }
+    const size_t limit = fewest / height;
+    size_t count = 0;
+    for(AVLNode<Key, Value, CountSizes>* n = this->postorderFirst(small); n != NULL; n = this->postorderNext(n)){
+        if(++count >= limit){
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+* Moves the nodes of the detached subtree root into the tree one at a time,
+* through the same search and insertFix() as insert(). A node whose key is
+* already in the tree is destroyed, after handing its value over if replace
+* is set. The nodes are taken in key order, with the same rotate-left-children-up
+* walk as clearHelper(), so consecutive inserts follow nearby paths.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+void AVLTree<Key, Value, CountSizes, Compare, Stats>::insertNodes(AVLNode<Key, Value, CountSizes>* root, bool replace)
+{
+    AVLNode<Key, Value, CountSizes>* next = root;
+    while(next != NULL){
+        AVLNode<Key, Value, CountSizes>* left = next->getLeft();
+        if(left != NULL){ //rotate it up; only the unvisited part of root is relinked
+            next->setLeft(left->getRight());
+            left->setRight(next);
+            next = left;
+            continue;
+        }
+        AVLNode<Key, Value, CountSizes>* node = next;
+        next = node->getRight();
+        AVLNode<Key, Value, CountSizes>* parent;
+        bool goLeft;
+        AVLNode<Key, Value, CountSizes>* existing = this->findInsertPosition(node->getKey(), parent, goLeft);
+        if(existing != NULL){
+            if(replace){
+                existing->getValue() = std::move(node->getValue());
+            }
+            this->destroyNode(node);
+        }
+        else{
+            node->setParent(parent);
+            node->setLeft(NULL);
+            node->setRight(NULL);
+            this->linkNode(node, parent, goLeft);
+        }
+    }
+}
+
+/**
+* Removes the key of every node of the detached subtree root from the tree
+* with remove(), in key order like insertNodes(), and destroys that node.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+void AVLTree<Key, Value, CountSizes, Compare, Stats>::removeKeysOf(AVLNode<Key, Value, CountSizes>* root)
+{
+    AVLNode<Key, Value, CountSizes>* next = root;
+    while(next != NULL){
+        AVLNode<Key, Value, CountSizes>* left = next->getLeft();
+        if(left != NULL){
+            next->setLeft(left->getRight());
+            left->setRight(next);
+            next = left;
+            continue;
+        }
+        AVLNode<Key, Value, CountSizes>* node = next;
+        next = node->getRight();
+        this->remove(node->getKey());
+        this->destroyNode(node);
+    }
+}
+
+/**
+* Installs the result of a set operation as the tree and destroys the nodes it left out.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+void AVLTree<Key, Value, CountSizes, Compare, Stats>::finishSetOperation(AVLNode<Key, Value, CountSizes>* root, DroppedNodes& dropped)
+{
+    this->setRoot(detachNode(root));
+    AVLNode<Key, Value, CountSizes>* subtree = dropped.head;
+    while(subtree != NULL){
+        AVLNode<Key, Value, CountSizes>* next = subtree->getParent();
+        AVLNode<Key, Value, CountSizes>* curr = subtree;
+        while(curr != NULL){ //same rotate-and-destroy walk as clearHelper(), so no recursion
+            AVLNode<Key, Value, CountSizes>* left = curr->getLeft();
+            if(left != NULL){
+                curr->setLeft(left->getRight());
+                left->setRight(curr);
+                curr = left;
+            }
+            else{
+                AVLNode<Key, Value, CountSizes>* right = curr->getRight();
+                this->destroyNode(curr);
+                curr = right;
+            }
+        }
+        subtree = next;
+    }
+    dropped.head = dropped.tail = NULL;
+}
+
+/**
+* Recursive part of unionWith(): combines subtrees a (this tree's) and b (other's).
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+AVLNode<Key, Value, CountSizes>* AVLTree<Key, Value, CountSizes, Compare, Stats>::unionNodes(AVLNode<Key, Value, CountSizes>* a, AVLNode<Key, Value, CountSizes>* b, DroppedNodes& dropped, TaskPool* pool)
+{
+    if(a == NULL){
+        return detachNode(b);
+    }
+    if(b == NULL){
+        return detachNode(a);
+    }
+    bool parallel = pool != NULL && std::min(findHeight(a), findHeight(b)) >= PARALLEL_HEIGHT;
+    AVLNode<Key, Value, CountSizes>* aLeft = a->getLeft();
+    AVLNode<Key, Value, CountSizes>* aRight = a->getRight();
+    AVLNode<Key, Value, CountSizes>* bLeft;
+    AVLNode<Key, Value, CountSizes>* found;
+    AVLNode<Key, Value, CountSizes>* bRight;
+    splitNodes(b, a->getKey(), bLeft, found, bRight);
+
+    AVLNode<Key, Value, CountSizes>* left;
+    AVLNode<Key, Value, CountSizes>* right;
+    DroppedNodes rightDropped = { NULL, NULL };
+    if(parallel){
+        pool->fork2([&]() { left = unionNodes(aLeft, bLeft, dropped, pool); },
+                    [&]() { right = unionNodes(aRight, bRight, rightDropped, pool); });
+    }
+    else{
+        left = unionNodes(aLeft, bLeft, dropped, pool);
+        right = unionNodes(aRight, bRight, rightDropped, pool);
+    }
+    appendDropped(dropped, rightDropped);
+
+    if(found != NULL){ //the key is in both trees; keep other's item
+        dropNode(dropped, a);
+        return joinNodes(left, found, right);
+    }
+    return joinNodes(left, a, right);
+}
+
+/**
+* Recursive part of intersectWith(): keeps the nodes of subtree a whose keys are in subtree b.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+AVLNode<Key, Value, CountSizes>* AVLTree<Key, Value, CountSizes, Compare, Stats>::intersectNodes(AVLNode<Key, Value, CountSizes>* a, AVLNode<Key, Value, CountSizes>* b, DroppedNodes& dropped, TaskPool* pool)
+{
+    if(a == NULL || b == NULL){
+        dropSubtree(dropped, a);
+        dropSubtree(dropped, b);
+        return NULL;
+    }
+    bool parallel = pool != NULL && std::min(findHeight(a), findHeight(b)) >= PARALLEL_HEIGHT;
+    AVLNode<Key, Value, CountSizes>* aLeft = a->getLeft();
+    AVLNode<Key, Value, CountSizes>* aRight = a->getRight();
+    AVLNode<Key, Value, CountSizes>* bLeft;
+    AVLNode<Key, Value, CountSizes>* found;
+    AVLNode<Key, Value, CountSizes>* bRight;
+    splitNodes(b, a->getKey(), bLeft, found, bRight);
+
+    AVLNode<Key, Value, CountSizes>* left;
+    AVLNode<Key, Value, CountSizes>* right;
+    DroppedNodes rightDropped = { NULL, NULL };
+    if(parallel){
+        pool->fork2([&]() { left = intersectNodes(aLeft, bLeft, dropped, pool); },
+                    [&]() { right = intersectNodes(aRight, bRight, rightDropped, pool); });
+    }
+    else{
+        left = intersectNodes(aLeft, bLeft, dropped, pool);
+        right = intersectNodes(aRight, bRight, rightDropped, pool);
+    }
+    appendDropped(dropped, rightDropped);
+
+    if(found != NULL){ //in both trees, so a's node stays
+        dropNode(dropped, found);
+        return joinNodes(left, a, right);
+    }
+    dropNode(dropped, a);
+    return concatNodes(left, right);
+}
+
+/**
+* Recursive part of differenceWith(): keeps the nodes of subtree a whose keys
+* are not in subtree b, and sets removed if any of a's nodes went. A subtree
+* that lost nothing comes back as it was instead of being joined together again.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+AVLNode<Key, Value, CountSizes>* AVLTree<Key, Value, CountSizes, Compare, Stats>::differenceNodes(AVLNode<Key, Value, CountSizes>* a, AVLNode<Key, Value, CountSizes>* b, DroppedNodes& dropped, bool& removed, TaskPool* pool)
+{
+    if(a == NULL){
+        dropSubtree(dropped, b);
+        return NULL;
+    }
+    if(b == NULL){
+        return detachNode(a);
+    }
+    bool parallel = pool != NULL && std::min(findHeight(a), findHeight(b)) >= PARALLEL_HEIGHT;
+    AVLNode<Key, Value, CountSizes>* aLeft = a->getLeft();
+    AVLNode<Key, Value, CountSizes>* aRight = a->getRight();
+    AVLNode<Key, Value, CountSizes>* bLeft;
+    AVLNode<Key, Value, CountSizes>* found;
+    AVLNode<Key, Value, CountSizes>* bRight;
+    splitNodes(b, a->getKey(), bLeft, found, bRight);
+
+    AVLNode<Key, Value, CountSizes>* left;
+    AVLNode<Key, Value, CountSizes>* right;
+    DroppedNodes rightDropped = { NULL, NULL };
+    bool leftRemoved = false;
+    bool rightRemoved = false;
+    if(parallel){
+        pool->fork2([&]() { left = differenceNodes(aLeft, bLeft, dropped, leftRemoved, pool); },
+                    [&]() { right = differenceNodes(aRight, bRight, rightDropped, rightRemoved, pool); });
+    }
+    else{
+        left = differenceNodes(aLeft, bLeft, dropped, leftRemoved, pool);
+        right = differenceNodes(aRight, bRight, rightDropped, rightRemoved, pool);
+    }
+    appendDropped(dropped, rightDropped);
+
+    if(found != NULL){ //a's key is in b, so both nodes go
+        removed = true;
+        dropNode(dropped, found);
+        dropNode(dropped, a);
+        return concatNodes(left, right);
+    }
+    if(!leftRemoved && !rightRemoved){ //left and right are still a's own children, heights and sizes unchanged
+        if(left != NULL){
+            left->setParent(a);
+        }
+        if(right != NULL){
+            right->setParent(a);
+        }
+        return detachNode(a);
+    }
+    removed = true;
+    return joinNodes(left, a, right);
+}
+
+/**
+* Recursive part of applyBatch(): applies the count sorted operations at ops to
+* subtree a. nodes[i] is the new node of ops[i] if it is an upsert, else NULL.
+* Into an empty subtree the middle operation's node goes on top, so the
+* upserts alone form a balanced subtree.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+AVLNode<Key, Value, CountSizes>* AVLTree<Key, Value, CountSizes, Compare, Stats>::batchNodes(AVLNode<Key, Value, CountSizes>* a, const BatchOp<Key, Value>* ops,
+                                                                                             AVLNode<Key, Value, CountSizes>* const* nodes, size_t count,
+                                                                                             DroppedNodes& dropped, TaskPool* pool)
+{
+    if(count == 0){
+        return detachNode(a);
+    }
+    size_t mid = count / 2;
+    bool found = false;
+    if(a != NULL){ //mid becomes the first operation whose key is not less than a's
+        size_t lo = 0;
+        size_t hi = count;
+        while(lo < hi){
+            size_t probe = lo + (hi - lo) / 2;
+            if(this->comp_(batchKey(ops, nodes, probe), a->getKey())){
+                lo = probe + 1;
+            }
+            else{
+                hi = probe;
+            }
+        }
+        mid = lo;
+        found = mid < count && !this->comp_(a->getKey(), batchKey(ops, nodes, mid));
+        if(count == 1 && !found){
+            return batchOneNode(a, ops, nodes[0], dropped);
+        }
+    }
+    size_t rightFirst = (a == NULL || found) ? mid + 1 : mid;
+
+    bool parallel = pool != NULL && count >= ((size_t)1 << PARALLEL_HEIGHT) && (a == NULL || findHeight(a) >= PARALLEL_HEIGHT);
+    AVLNode<Key, Value, CountSizes>* aLeft = a == NULL ? NULL : a->getLeft();
+    AVLNode<Key, Value, CountSizes>* aRight = a == NULL ? NULL : a->getRight();
+    AVLNode<Key, Value, CountSizes>* left;
+    AVLNode<Key, Value, CountSizes>* right;
+    DroppedNodes rightDropped = { NULL, NULL };
+    if(parallel){
+        pool->fork2([&]() { left = batchNodes(aLeft, ops, nodes, mid, dropped, pool); },
+                    [&]() { right = batchNodes(aRight, ops + rightFirst, nodes + rightFirst, count - rightFirst, rightDropped, pool); });
+    }
+    else{
+        left = batchNodes(aLeft, ops, nodes, mid, dropped, pool);
+        right = batchNodes(aRight, ops + rightFirst, nodes + rightFirst, count - rightFirst, rightDropped, pool);
+    }
+    appendDropped(dropped, rightDropped);
+
+    if(a == NULL){ //an erase of a key that is not there does nothing
+        return nodes[mid] != NULL ? joinNodes(left, nodes[mid], right) : concatNodes(left, right);
+    }
+    if(!found){
+        return joinNodes(left, a, right);
+    }
+    if(nodes[mid] == NULL){ //a's key is erased
+        dropNode(dropped, a);
+        return concatNodes(left, right);
+    }
+    a->getValue() = std::move(nodes[mid]->getValue()); //a's key is upserted; a keeps its place
+    dropNode(dropped, nodes[mid]);
+    return joinNodes(left, a, right);
+}
+
+/**
+* batchNodes() for a single operation whose key is not a's: a plain insert or
+* remove inside subtree a. Joining every level back together would rewrite
+* the whole path and read every sibling on it; the usual retracing stops as
+* soon as a subtree keeps its height. Returns the node heading the subtree.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+AVLNode<Key, Value, CountSizes>* AVLTree<Key, Value, CountSizes, Compare, Stats>::batchOneNode(AVLNode<Key, Value, CountSizes>* a, const BatchOp<Key, Value>* op,
+                                                                                               AVLNode<Key, Value, CountSizes>* node, DroppedNodes& dropped)
+{
+    a->setParent(NULL); //the retracing walks stop at a, which now heads a subtree of its own
+    const Key& key = batchKey(op, &node, 0);
+    AVLNode<Key, Value, CountSizes>* parent = NULL;
+    AVLNode<Key, Value, CountSizes>* curr = a;
+    bool goLeft = false;
+    while(curr != NULL){
+        int order = KeyOrder<Compare>::compare(this->comp_, key, curr->getKey());
+        if(order == 0){
+            break;
+        }
+        parent = curr;
+        goLeft = order < 0;
+        curr = goLeft ? curr->getLeft() : curr->getRight();
+    }
+
+    if(curr != NULL && node != NULL){ //an upsert of a key that is there
+        curr->getValue() = std::move(node->getValue());
+        dropNode(dropped, node);
+        return a;
+    }
+    if(curr != NULL){ //an erase; curr is below a, so unlinkNode() never touches root_
+        AVLNode<Key, Value, CountSizes>* changed = this->unlinkNode(curr);
+        dropNode(dropped, curr);
+        removeFix(changed);
+    }
+    else if(node != NULL){ //an upsert of a new key
+        node->setParent(parent);
+        if(goLeft){
+            parent->setLeft(node);
+        }
+        else{
+            parent->setRight(node);
+        }
+        insertFix(node);
+    }
+    return a->getParent() != NULL ? a->getParent() : a; //a rotation at the top moves a down one level
+}
+
+/**
+* The key of the i-th operation of a batch; an upsert's item has moved into its node.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+const Key& AVLTree<Key, Value, CountSizes, Compare, Stats>::batchKey(const BatchOp<Key, Value>* ops, AVLNode<Key, Value, CountSizes>* const* nodes, size_t i)
+{
+    return nodes[i] != NULL ? nodes[i]->getKey() : ops[i].item.first;
+}
+
+/**
+* Makes mid the root of a subtree with the given children and returns it.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+AVLNode<Key, Value, CountSizes>* AVLTree<Key, Value, CountSizes, Compare, Stats>::attachNodes(AVLNode<Key, Value, CountSizes>* left, AVLNode<Key, Value, CountSizes>* mid, AVLNode<Key, Value, CountSizes>* right)
+{
+    mid->setLeft(left);
+    mid->setRight(right);
+    if(left != NULL){
+        left->setParent(mid);
+    }
+    if(right != NULL){
+        right->setParent(mid);
+    }
+    mid->setParent(NULL);
+    mid->updateFromChildren();
+    return mid;
+}
+
+/**
+* Cuts the link from a subtree root to its former parent and returns it.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+AVLNode<Key, Value, CountSizes>* AVLTree<Key, Value, CountSizes, Compare, Stats>::detachNode(AVLNode<Key, Value, CountSizes>* node)
+{
+    if(node != NULL){
+        node->setParent(NULL);
+    }
+    return node;
+}
+
+/**
+* Left rotation of a detached subtree; returns the new subtree root.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+AVLNode<Key, Value, CountSizes>* AVLTree<Key, Value, CountSizes, Compare, Stats>::rotateLeftNodes(AVLNode<Key, Value, CountSizes>* x)
+{
+    AVLNode<Key, Value, CountSizes>* y = x->getRight();
+    attachNodes(x->getLeft(), x, y->getLeft());
+    return attachNodes(x, y, y->getRight());
+}
+
+/**
+* Right rotation of a detached subtree; returns the new subtree root.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+AVLNode<Key, Value, CountSizes>* AVLTree<Key, Value, CountSizes, Compare, Stats>::rotateRightNodes(AVLNode<Key, Value, CountSizes>* y)
+{
+    AVLNode<Key, Value, CountSizes>* x = y->getLeft();
+    attachNodes(x->getRight(), y, y->getRight());
+    return attachNodes(x->getLeft(), x, y);
+}
+
+/**
+* Returns a valid AVL subtree holding left, then mid, then right, where every
+* key of left is smaller than mid's and every key of right is bigger. If the
+* heights differ by more than one, mid is hung off the spine of the taller
+* side at the height of the shorter one and the spine is rebalanced on the way
+* back up. Takes O(|height(left) - height(right)| + 1) time.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+AVLNode<Key, Value, CountSizes>* AVLTree<Key, Value, CountSizes, Compare, Stats>::joinNodes(AVLNode<Key, Value, CountSizes>* left, AVLNode<Key, Value, CountSizes>* mid, AVLNode<Key, Value, CountSizes>* right)
+{
+    int leftHeight = findHeight(left);
+    int rightHeight = findHeight(right);
+    if(leftHeight > rightHeight + 1){
+        return joinRightSpine(left, mid, right);
+    }
+    if(rightHeight > leftHeight + 1){
+        return joinLeftSpine(left, mid, right);
+    }
+    return attachNodes(left, mid, right);
+}
+
+/**
+* joinNodes() when left is the taller side: walks down left's right spine.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+AVLNode<Key, Value, CountSizes>* AVLTree<Key, Value, CountSizes, Compare, Stats>::joinRightSpine(AVLNode<Key, Value, CountSizes>* left, AVLNode<Key, Value, CountSizes>* mid, AVLNode<Key, Value, CountSizes>* right)
+{
+    AVLNode<Key, Value, CountSizes>* leftLeft = left->getLeft();
+    AVLNode<Key, Value, CountSizes>* leftRight = left->getRight();
+    if(findHeight(leftRight) <= findHeight(right) + 1){ //mid goes here
+        AVLNode<Key, Value, CountSizes>* joined = attachNodes(leftRight, mid, right);
+        if(findHeight(joined) <= findHeight(leftLeft) + 1){
+            return attachNodes(leftLeft, left, joined);
+        }
+        return rotateLeftNodes(attachNodes(leftLeft, left, rotateRightNodes(joined))); //zig-zag
+    }
+    AVLNode<Key, Value, CountSizes>* joined = joinRightSpine(leftRight, mid, right);
+    AVLNode<Key, Value, CountSizes>* top = attachNodes(leftLeft, left, joined);
+    if(findHeight(joined) <= findHeight(leftLeft) + 1){
+        return top;
+    }
+    return rotateLeftNodes(top);
+}
+
+/**
+* joinNodes() when right is the taller side: walks down right's left spine.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+AVLNode<Key, Value, CountSizes>* AVLTree<Key, Value, CountSizes, Compare, Stats>::joinLeftSpine(AVLNode<Key, Value, CountSizes>* left, AVLNode<Key, Value, CountSizes>* mid, AVLNode<Key, Value, CountSizes>* right)
+{
+    AVLNode<Key, Value, CountSizes>* rightLeft = right->getLeft();
+    AVLNode<Key, Value, CountSizes>* rightRight = right->getRight();
+    if(findHeight(rightLeft) <= findHeight(left) + 1){ //mid goes here
+        AVLNode<Key, Value, CountSizes>* joined = attachNodes(left, mid, rightLeft);
+        if(findHeight(joined) <= findHeight(rightRight) + 1){
+            return attachNodes(joined, right, rightRight);
+        }
+        return rotateRightNodes(attachNodes(rotateLeftNodes(joined), right, rightRight)); //zag-zig
+    }
+    AVLNode<Key, Value, CountSizes>* joined = joinLeftSpine(left, mid, rightLeft);
+    AVLNode<Key, Value, CountSizes>* top = attachNodes(joined, right, rightRight);
+    if(findHeight(joined) <= findHeight(rightRight) + 1){
+        return top;
+    }
+    return rotateRightNodes(top);
+}
+
+/**
+* Joins two subtrees where every key of left is smaller than every key of
+* right, using left's biggest node as the middle. O(log n).
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+AVLNode<Key, Value, CountSizes>* AVLTree<Key, Value, CountSizes, Compare, Stats>::concatNodes(AVLNode<Key, Value, CountSizes>* left, AVLNode<Key, Value, CountSizes>* right)
+{
+    if(left == NULL){
+        return detachNode(right);
+    }
+    if(right == NULL){
+        return detachNode(left);
+    }
+    AVLNode<Key, Value, CountSizes>* last;
+    AVLNode<Key, Value, CountSizes>* rest = splitLastNode(left, last);
+    return joinNodes(rest, last, right);
+}
+
+/**
+* Takes the node with the biggest key out of a subtree: sets last to it and
+* returns what is left, rebalanced. O(log n).
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+AVLNode<Key, Value, CountSizes>* AVLTree<Key, Value, CountSizes, Compare, Stats>::splitLastNode(AVLNode<Key, Value, CountSizes>* root, AVLNode<Key, Value, CountSizes>*& last)
+{
+    if(root->getRight() == NULL){
+        last = root;
+        return detachNode(root->getLeft());
+    }
+    AVLNode<Key, Value, CountSizes>* rest = splitLastNode(root->getRight(), last);
+    return joinNodes(root->getLeft(), root, rest);
+}
+
+/**
+* Splits a subtree around key: left gets the nodes with smaller keys, right the
+* ones with bigger keys (both rebalanced), and found the node with that key, on
+* its own, or NULL. The nodes on the search path are joined back onto the side
+* they belong to, from the bottom up; those joins telescope, so it is O(log n).
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+void AVLTree<Key, Value, CountSizes, Compare, Stats>::splitNodes(AVLNode<Key, Value, CountSizes>* root, const Key& key, AVLNode<Key, Value, CountSizes>*& left, AVLNode<Key, Value, CountSizes>*& found, AVLNode<Key, Value, CountSizes>*& right)
+{
+    if(root == NULL){
+        left = found = right = NULL;
+        return;
+    }
+    AVLNode<Key, Value, CountSizes>* rootLeft = root->getLeft();
+    AVLNode<Key, Value, CountSizes>* rootRight = root->getRight();
+    if(this->comp_(key, root->getKey())){
+        AVLNode<Key, Value, CountSizes>* middle;
+        splitNodes(rootLeft, key, left, found, middle);
+        right = joinNodes(middle, root, rootRight);
+    }
+    else if(this->comp_(root->getKey(), key)){
+        AVLNode<Key, Value, CountSizes>* middle;
+        splitNodes(rootRight, key, middle, found, right);
+        left = joinNodes(rootLeft, root, middle);
+    }
+    else{
+        left = detachNode(rootLeft);
+        right = detachNode(rootRight);
+        found = attachNodes(NULL, root, NULL);
+    }
+}
+
+/**
+* Adds a whole subtree (possibly empty) to the dropped nodes.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+void AVLTree<Key, Value, CountSizes, Compare, Stats>::dropSubtree(DroppedNodes& dropped, AVLNode<Key, Value, CountSizes>* root)
+{
+    if(root == NULL){
+        return;
+    }
+    root->setParent(NULL);
+    if(dropped.head == NULL){
+        dropped.head = root;
+    }
+    else{
+        dropped.tail->setParent(root);
+    }
+    dropped.tail = root;
+}
+
+/**
+* Adds a single node to the dropped nodes; its children are kept elsewhere.
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+void AVLTree<Key, Value, CountSizes, Compare, Stats>::dropNode(DroppedNodes& dropped, AVLNode<Key, Value, CountSizes>* node)
+{
+    node->setLeft(NULL);
+    node->setRight(NULL);
+    dropSubtree(dropped, node);
+}
+
+/**
+* Moves the dropped nodes of from to the end of into in O(1).
+*/
+template<class Key, class Value, bool CountSizes, class Compare, class Stats>
+void AVLTree<Key, Value, CountSizes, Compare, Stats>::appendDropped(DroppedNodes& into, const DroppedNodes& from)
+{
+    if(from.head == NULL){
+        return;
+    }
+    if(into.head == NULL){
+        into.head = from.head;
+    }
+    else{
+        into.tail->setParent(from.head);
+    }
+    into.tail = from.tail;
+}
+
 #endif
@@ -0,0 +1,906 @@
+#ifndef BPLUSTREE_H
+#define BPLUSTREE_H
+
+#include <iostream>
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "node_pool.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+* Finds positions within the sorted keys of one B+tree node: lowerBound()
+* counts the keys less than key, upperBound() the keys not greater than it.
+* Keys of any type are binary searched using only operator<.
+*/
+template <typename Key, bool Arithmetic = std::is_arithmetic<Key>::value>
+struct BPlusKeySearch
+{
+    static int lowerBound(const Key* keys, int count, const Key& key)
+    {
+        return std::lower_bound(keys, keys + count, key) - keys;
+    }
+    static int upperBound(const Key* keys, int count, const Key& key)
+    {
+        return std::upper_bound(keys, keys + count, key) - keys;
+    }
+};
+
+/**
+* Arithmetic keys are counted instead: a node holds a few dozen of them, and
+* a compare-and-add over all of them has no branches to mispredict and is
+* vectorized by the compiler.
+*/
+template <typename Key>
+struct BPlusKeySearch<Key, true>
+{
+    static int lowerBound(const Key* keys, int count, Key key)
+    {
+        int n = 0;
+        for(int i = 0; i < count; ++i){
+            n += (keys[i] < key);
+        }
+        return n;
+    }
+    static int upperBound(const Key* keys, int count, Key key)
+    {
+        int n = 0;
+        for(int i = 0; i < count; ++i){
+            n += !(key < keys[i]);
+        }
+        return n;
+    }
+};
+
+#ifdef __SSE2__
+/**
+* The most common key types get explicit SSE2 compares, four (or two) keys
+* at a time, with the matching lanes counted from the compare mask.
+*/
+template <>
+struct BPlusKeySearch<int, true>
+{
+    static int lowerBound(const int* keys, int count, int key)
+    {
+        const __m128i needle = _mm_set1_epi32(key);
+        int i = 0, n = 0;
+        for(; i + 4 <= count; i += 4){
+            __m128i less = _mm_cmplt_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), needle);
+            n += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(less)));
+        }
+        for(; i < count; ++i){
+            n += (keys[i] < key);
+        }
+        return n;
+    }
+    static int upperBound(const int* keys, int count, int key)
+    {
+        const __m128i needle = _mm_set1_epi32(key);
+        int i = 0, n = 0;
+        for(; i + 4 <= count; i += 4){
+            __m128i greater = _mm_cmpgt_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), needle);
+            n += 4 - __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(greater)));
+        }
+        for(; i < count; ++i){
+            n += !(key < keys[i]);
+        }
+        return n;
+    }
+};
+
+template <>
+struct BPlusKeySearch<float, true>
+{
+    static int lowerBound(const float* keys, int count, float key)
+    {
+        const __m128 needle = _mm_set1_ps(key);
+        int i = 0, n = 0;
+        for(; i + 4 <= count; i += 4){
+            n += __builtin_popcount(_mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(keys + i), needle)));
+        }
+        for(; i < count; ++i){
+            n += (keys[i] < key);
+        }
+        return n;
+    }
+    static int upperBound(const float* keys, int count, float key)
+    {
+        const __m128 needle = _mm_set1_ps(key);
+        int i = 0, n = 0;
+        for(; i + 4 <= count; i += 4){
+            n += __builtin_popcount(_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(keys + i), needle)));
+        }
+        for(; i < count; ++i){
+            n += !(key < keys[i]);
+        }
+        return n;
+    }
+};
+
+template <>
+struct BPlusKeySearch<double, true>
+{
+    static int lowerBound(const double* keys, int count, double key)
+    {
+        const __m128d needle = _mm_set1_pd(key);
+        int i = 0, n = 0;
+        for(; i + 2 <= count; i += 2){
+            n += __builtin_popcount(_mm_movemask_pd(_mm_cmplt_pd(_mm_loadu_pd(keys + i), needle)));
+        }
+        for(; i < count; ++i){
+            n += (keys[i] < key);
+        }
+        return n;
+    }
+    static int upperBound(const double* keys, int count, double key)
+    {
+        const __m128d needle = _mm_set1_pd(key);
+        int i = 0, n = 0;
+        for(; i + 2 <= count; i += 2){
+            n += __builtin_popcount(_mm_movemask_pd(_mm_cmple_pd(_mm_loadu_pd(keys + i), needle)));
+        }
+        for(; i < count; ++i){
+            n += !(key < keys[i]);
+        }
+        return n;
+    }
+};
+#endif
+
+/**
+* A templated B+tree map, a drop-in alternative to BinarySearchTree/AVLTree
+* for hot maps: it offers the same insert/remove/find/iterator surface.
+*
+* Every item lives in a leaf, and the leaves are chained in key order so that
+* iteration walks arrays. Inner nodes only route searches. Nodes hold as many
+* keys as fit in NODE_BYTES (a few cache lines), so a lookup touches a handful
+* of nodes instead of one node per level of a binary tree. Leaves keep keys
+* and values in separate arrays, so the search stays in the keys.
+*
+* Key and Value must be default constructible and move assignable, since
+* nodes hold fixed-size arrays of them. Iterators are invalidated by any
+* insert or remove, because items move between array slots.
+*/
+template <typename Key, typename Value>
+class BPlusTree
+{
+public:
+    BPlusTree();
+    BPlusTree(BPlusTree&& other); // trees are moved, never copied
+    BPlusTree& operator=(BPlusTree&& other);
+    ~BPlusTree();
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    void print() const;
+    bool empty() const;
+    size_t size() const;
+
+protected:
+    // Target size of a node; the capacities below follow from the key and value sizes
+    static const size_t NODE_BYTES = 256;
+
+    struct BNode
+    {
+        explicit BNode(bool isLeaf) : leaf(isLeaf), count(0) {}
+        bool leaf;
+        int count; // keys in an inner node, items in a leaf
+    };
+
+    static const int INNER_KEYS = (NODE_BYTES - sizeof(BNode) - sizeof(BNode*)) / (sizeof(Key) + sizeof(BNode*)) < 4 ?
+        4 : (NODE_BYTES - sizeof(BNode) - sizeof(BNode*)) / (sizeof(Key) + sizeof(BNode*));
+    static const int MIN_INNER_KEYS = (INNER_KEYS - 1) / 2;
+
+    struct Inner : BNode
+    {
+        Inner() : BNode(false) {}
+        Key keys[INNER_KEYS];               // children[i + 1] holds the keys >= keys[i]
+        BNode* children[INNER_KEYS + 1];
+    };
+
+    static const int LEAF_ITEMS = (NODE_BYTES - sizeof(BNode) - sizeof(BNode*)) / (sizeof(Key) + sizeof(Value)) < 4 ?
+        4 : (NODE_BYTES - sizeof(BNode) - sizeof(BNode*)) / (sizeof(Key) + sizeof(Value));
+    static const int MIN_LEAF_ITEMS = LEAF_ITEMS / 2;
+
+    struct Leaf : BNode
+    {
+        Leaf() : BNode(true), next(NULL) {}
+        Key keys[LEAF_ITEMS];
+        Value values[LEAF_ITEMS];
+        Leaf* next; // the leaf holding the next larger keys
+    };
+
+    typedef BPlusKeySearch<Key> Search;
+
+public:
+    /**
+    * An iterator over the tree in increasing key order. Keys and values are
+    * kept apart, so dereferencing yields a pair of references rather than a
+    * reference to a stored pair; it->second can still be assigned through.
+    */
+    class iterator
+    {
+    public:
+        typedef std::pair<const Key&, Value&> reference;
+
+        // Lets it->first and it->second work on the pair made by operator*
+        struct ArrowProxy
+        {
+            reference item;
+            const reference* operator->() const { return &item; }
+        };
+
+        iterator();
+
+        reference operator*() const;
+        ArrowProxy operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class BPlusTree<Key, Value>;
+        iterator(Leaf* leaf, int index);
+        Leaf* leaf_;
+        int index_;
+    };
+
+public:
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lowerBound(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+protected:
+    // A tree owns its nodes, so it cannot be copied
+    BPlusTree(const BPlusTree& other);
+    BPlusTree& operator=(const BPlusTree& other);
+
+    Leaf* newLeaf();
+    Inner* newInner();
+    void destroySubtree(BNode* node);
+    Leaf* findLeaf(const Key& key) const;
+    void insertInto(BNode* node, const Key& key, const Value& value, Key& splitKey, BNode*& splitNode);
+    static void insertItemAt(Leaf* leaf, int pos, const Key& key, const Value& value);
+    static void insertChildAt(Inner* inner, int pos, const Key& key, BNode* child);
+    bool removeFrom(BNode* node, const Key& key);
+    void fixUnderflow(Inner* parent, int i);
+    static bool underfull(const BNode* node);
+
+protected:
+    BNode* root_;
+    size_t size_;
+    NodePool leafPool_;  // every leaf of this tree lives in one of these slabs
+    NodePool innerPool_; // and every inner node in one of these
+};
+
+/*
+--------------------------------------------------------
+Begin implementations for the BPlusTree::iterator class.
+--------------------------------------------------------
+*/
+
+/**
+* Default constructor for an iterator that points at nothing (the end).
+*/
+template<class Key, class Value>
+BPlusTree<Key, Value>::iterator::iterator() : leaf_(NULL), index_(0)
+{
+
+}
+
+/**
+* Explicit constructor that initializes an iterator with a slot of a leaf.
+*/
+template<class Key, class Value>
+BPlusTree<Key, Value>::iterator::iterator(Leaf* leaf, int index) : leaf_(leaf), index_(index)
+{
+
+}
+
+/**
+* Provides access to the key and value of the item.
+*/
+template<class Key, class Value>
+typename BPlusTree<Key, Value>::iterator::reference
+BPlusTree<Key, Value>::iterator::operator*() const
+{
+    return reference(leaf_->keys[index_], leaf_->values[index_]);
+}
+
+/**
+* Provides member access to the key and value of the item.
+*/
+template<class Key, class Value>
+typename BPlusTree<Key, Value>::iterator::ArrowProxy
+BPlusTree<Key, Value>::iterator::operator->() const
+{
+    ArrowProxy proxy = { **this };
+    return proxy;
+}
+
+/**
+* Checks if 'this' iterator's internals have the same value as 'rhs'.
+*/
+template<class Key, class Value>
+bool BPlusTree<Key, Value>::iterator::operator==(const iterator& rhs) const
+{
+    return leaf_ == rhs.leaf_ && index_ == rhs.index_;
+}
+
+/**
+* Checks if 'this' iterator's internals have a different value as 'rhs'.
+*/
+template<class Key, class Value>
+bool BPlusTree<Key, Value>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances the iterator's location to the next item, following the leaf
+* chain once the current leaf is used up.
+*/
+template<class Key, class Value>
+typename BPlusTree<Key, Value>::iterator&
+BPlusTree<Key, Value>::iterator::operator++()
+{
+    if(++index_ == leaf_->count){
+        leaf_ = leaf_->next;
+        index_ = 0;
+    }
+    return *this;
+}
+
+/*
+------------------------------------------------------
+End implementations for the BPlusTree::iterator class.
+------------------------------------------------------
+*/
+
+/*
+----------------------------------------------
+Begin implementations for the BPlusTree class.
+----------------------------------------------
+*/
+
+/**
+* Default constructor for an empty tree.
+*/
+template<class Key, class Value>
+BPlusTree<Key, Value>::BPlusTree()
+    : root_(NULL), size_(0), leafPool_(sizeof(Leaf)), innerPool_(sizeof(Inner))
+{
+
+}
+
+/**
+* Move constructor: takes over other's nodes in O(1) and leaves it empty.
+*/
+template<class Key, class Value>
+BPlusTree<Key, Value>::BPlusTree(BPlusTree&& other)
+    : root_(other.root_), size_(other.size_), leafPool_(sizeof(Leaf)), innerPool_(sizeof(Inner))
+{
+    leafPool_.swap(other.leafPool_);
+    innerPool_.swap(other.innerPool_);
+    other.root_ = NULL;
+    other.size_ = 0;
+}
+
+/**
+* Move assignment: drops this tree's items and takes over other's nodes.
+*/
+template<class Key, class Value>
+BPlusTree<Key, Value>& BPlusTree<Key, Value>::operator=(BPlusTree&& other)
+{
+    if(this != &other){
+        clear();
+        std::swap(root_, other.root_);
+        std::swap(size_, other.size_);
+        leafPool_.swap(other.leafPool_);
+        innerPool_.swap(other.innerPool_);
+    }
+    return *this;
+}
+
+/**
+* Destructor, which frees every node.
+*/
+template<class Key, class Value>
+BPlusTree<Key, Value>::~BPlusTree()
+{
+    clear();
+}
+
+/**
+* Returns true if the tree holds no items.
+*/
+template<class Key, class Value>
+bool BPlusTree<Key, Value>::empty() const
+{
+    return root_ == NULL;
+}
+
+/**
+* Returns the number of items in the tree.
+*/
+template<class Key, class Value>
+size_t BPlusTree<Key, Value>::size() const
+{
+    return size_;
+}
+
+/**
+* Deletes all items. Nodes only need their destructors run when the keys or
+* values have one; the memory itself goes back a slab at a time.
+*/
+template<class Key, class Value>
+void BPlusTree<Key, Value>::clear()
+{
+    if(!(std::is_trivially_destructible<Key>::value && std::is_trivially_destructible<Value>::value)){
+        destroySubtree(root_);
+    }
+    root_ = NULL;
+    size_ = 0;
+    leafPool_.release();
+    innerPool_.release();
+}
+
+/**
+* Runs the destructors of every node below node. The tree is only
+* O(log n) levels deep, so recursion is safe here.
+*/
+template<class Key, class Value>
+void BPlusTree<Key, Value>::destroySubtree(BNode* node)
+{
+    if(node == NULL){
+        return;
+    }
+    if(node->leaf){
+        static_cast<Leaf*>(node)->~Leaf();
+        return;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    for(int i = 0; i <= inner->count; ++i){
+        destroySubtree(inner->children[i]);
+    }
+    inner->~Inner();
+}
+
+/**
+* Allocates an empty leaf from leafPool_.
+*/
+template<class Key, class Value>
+typename BPlusTree<Key, Value>::Leaf* BPlusTree<Key, Value>::newLeaf()
+{
+    return new (leafPool_.allocate()) Leaf;
+}
+
+/**
+* Allocates an empty inner node from innerPool_.
+*/
+template<class Key, class Value>
+typename BPlusTree<Key, Value>::Inner* BPlusTree<Key, Value>::newInner()
+{
+    return new (innerPool_.allocate()) Inner;
+}
+
+/**
+* Prints the keys of every node, one line per level, leaves last.
+*/
+template<class Key, class Value>
+void BPlusTree<Key, Value>::print() const
+{
+    std::vector<const BNode*> level;
+    if(root_ != NULL){
+        level.push_back(root_);
+    }
+    while(!level.empty()){
+        std::vector<const BNode*> below;
+        for(size_t n = 0; n < level.size(); ++n){
+            const Key* keys = level[n]->leaf ? static_cast<const Leaf*>(level[n])->keys
+                                             : static_cast<const Inner*>(level[n])->keys;
+            std::cout << (n == 0 ? "[" : " [");
+            for(int i = 0; i < level[n]->count; ++i){
+                std::cout << (i == 0 ? "" : " ") << keys[i];
+            }
+            std::cout << "]";
+            if(!level[n]->leaf){
+                const Inner* inner = static_cast<const Inner*>(level[n]);
+                below.insert(below.end(), inner->children, inner->children + inner->count + 1);
+            }
+        }
+        std::cout << std::endl;
+        level.swap(below);
+    }
+}
+
+/**
+* Returns an iterator to the item with the smallest key.
+*/
+template<class Key, class Value>
+typename BPlusTree<Key, Value>::iterator
+BPlusTree<Key, Value>::begin() const
+{
+    BNode* node = root_;
+    if(node == NULL){
+        return end();
+    }
+    while(!node->leaf){
+        node = static_cast<Inner*>(node)->children[0];
+    }
+    return iterator(static_cast<Leaf*>(node), 0);
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value>
+typename BPlusTree<Key, Value>::iterator
+BPlusTree<Key, Value>::end() const
+{
+    return iterator(NULL, 0);
+}
+
+/**
+* Returns the leaf that holds key if it is in the tree, or NULL if the tree is empty.
+*/
+template<class Key, class Value>
+typename BPlusTree<Key, Value>::Leaf* BPlusTree<Key, Value>::findLeaf(const Key& key) const
+{
+    BNode* node = root_;
+    if(node == NULL){
+        return NULL;
+    }
+    while(!node->leaf){
+        Inner* inner = static_cast<Inner*>(node);
+        node = inner->children[Search::upperBound(inner->keys, inner->count, key)];
+    }
+    return static_cast<Leaf*>(node);
+}
+
+/**
+* Returns an iterator to the item with the given key,
+* or the end iterator if the key does not exist in the tree
+*/
+template<class Key, class Value>
+typename BPlusTree<Key, Value>::iterator
+BPlusTree<Key, Value>::find(const Key& key) const
+{
+    Leaf* leaf = findLeaf(key);
+    if(leaf == NULL){
+        return end();
+    }
+    int pos = Search::lowerBound(leaf->keys, leaf->count, key);
+    if(pos == leaf->count || key < leaf->keys[pos]){
+        return end();
+    }
+    return iterator(leaf, pos);
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key,
+* or the end iterator if there is none.
+*/
+template<class Key, class Value>
+typename BPlusTree<Key, Value>::iterator
+BPlusTree<Key, Value>::lowerBound(const Key& key) const
+{
+    Leaf* leaf = findLeaf(key);
+    if(leaf == NULL){
+        return end();
+    }
+    int pos = Search::lowerBound(leaf->keys, leaf->count, key);
+    if(pos == leaf->count){ //every key here is smaller, so the bound starts the next leaf
+        return iterator(leaf->next, 0);
+    }
+    return iterator(leaf, pos);
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value>
+Value& BPlusTree<Key, Value>::operator[](const Key& key)
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+template<class Key, class Value>
+Value const & BPlusTree<Key, Value>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+/**
+* Inserts a key/value pair, overwriting the value if the key is already in
+* the tree. A full node splits in half and hands its new right half up to
+* its parent; the tree only grows taller when the root itself splits.
+*/
+template<class Key, class Value>
+void BPlusTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    if(root_ == NULL){
+        Leaf* leaf = newLeaf();
+        insertItemAt(leaf, 0, keyValuePair.first, keyValuePair.second);
+        root_ = leaf;
+        size_ = 1;
+        return;
+    }
+    Key splitKey = Key();
+    BNode* splitNode = NULL;
+    insertInto(root_, keyValuePair.first, keyValuePair.second, splitKey, splitNode);
+    if(splitNode != NULL){ //the root split, so add a level above it
+        Inner* root = newInner();
+        root->keys[0] = splitKey;
+        root->children[0] = root_;
+        root->children[1] = splitNode;
+        root->count = 1;
+        root_ = root;
+    }
+}
+
+/**
+* Inserts key/value below node. If node has to split, splitNode is set to
+* its new right sibling and splitKey to the smallest key that sibling covers.
+*/
+template<class Key, class Value>
+void BPlusTree<Key, Value>::insertInto(BNode* node, const Key& key, const Value& value,
+                                       Key& splitKey, BNode*& splitNode)
+{
+    if(node->leaf){
+        Leaf* leaf = static_cast<Leaf*>(node);
+        int pos = Search::lowerBound(leaf->keys, leaf->count, key);
+        if(pos < leaf->count && !(key < leaf->keys[pos])){ //key exists, overwrite
+            leaf->values[pos] = value;
+            return;
+        }
+        ++size_;
+        if(leaf->count < LEAF_ITEMS){
+            insertItemAt(leaf, pos, key, value);
+            return;
+        }
+
+        Leaf* right = newLeaf(); //full: move the upper half into a new leaf
+        const int half = (LEAF_ITEMS + 1) / 2;
+        std::move(leaf->keys + half, leaf->keys + leaf->count, right->keys);
+        std::move(leaf->values + half, leaf->values + leaf->count, right->values);
+        right->count = leaf->count - half;
+        leaf->count = half;
+        right->next = leaf->next;
+        leaf->next = right;
+        if(pos <= half){
+            insertItemAt(leaf, pos, key, value);
+        }
+        else{
+            insertItemAt(right, pos - half, key, value);
+        }
+        splitKey = right->keys[0];
+        splitNode = right;
+        return;
+    }
+
+    Inner* inner = static_cast<Inner*>(node);
+    int i = Search::upperBound(inner->keys, inner->count, key);
+    Key childKey = Key();
+    BNode* childSplit = NULL;
+    insertInto(inner->children[i], key, value, childKey, childSplit);
+    if(childSplit == NULL){
+        return;
+    }
+    if(inner->count < INNER_KEYS){
+        insertChildAt(inner, i, childKey, childSplit);
+        return;
+    }
+
+    Inner* right = newInner(); //full: the middle key moves up, the keys after it move right
+    const int mid = INNER_KEYS / 2;
+    splitKey = inner->keys[mid];
+    std::move(inner->keys + mid + 1, inner->keys + inner->count, right->keys);
+    std::copy(inner->children + mid + 1, inner->children + inner->count + 1, right->children);
+    right->count = inner->count - mid - 1;
+    inner->count = mid;
+    if(i <= mid){
+        insertChildAt(inner, i, childKey, childSplit);
+    }
+    else{
+        insertChildAt(right, i - mid - 1, childKey, childSplit);
+    }
+    splitNode = right;
+}
+
+/**
+* Opens a gap at pos in a leaf that has room and puts the item there.
+*/
+template<class Key, class Value>
+void BPlusTree<Key, Value>::insertItemAt(Leaf* leaf, int pos, const Key& key, const Value& value)
+{
+    std::move_backward(leaf->keys + pos, leaf->keys + leaf->count, leaf->keys + leaf->count + 1);
+    std::move_backward(leaf->values + pos, leaf->values + leaf->count, leaf->values + leaf->count + 1);
+    leaf->keys[pos] = key;
+    leaf->values[pos] = value;
+    ++leaf->count;
+}
+
+/**
+* Adds key at position pos of an inner node that has room, with child
+* (which holds the keys >= key) right after it.
+*/
+template<class Key, class Value>
+void BPlusTree<Key, Value>::insertChildAt(Inner* inner, int pos, const Key& key, BNode* child)
+{
+    std::move_backward(inner->keys + pos, inner->keys + inner->count, inner->keys + inner->count + 1);
+    std::copy_backward(inner->children + pos + 1, inner->children + inner->count + 1,
+                       inner->children + inner->count + 2);
+    inner->keys[pos] = key;
+    inner->children[pos + 1] = child;
+    ++inner->count;
+}
+
+/**
+* Removes the item with the given key, if there is one. Nodes left less than
+* half full borrow from or merge with a sibling on the way back up, and the
+* tree only gets shorter when the root is left with a single child.
+*/
+template<class Key, class Value>
+void BPlusTree<Key, Value>::remove(const Key& key)
+{
+    if(root_ == NULL || !removeFrom(root_, key)){
+        return;
+    }
+    if(root_->leaf && root_->count == 0){ //removed the last item
+        Leaf* leaf = static_cast<Leaf*>(root_);
+        leaf->~Leaf();
+        leafPool_.deallocate(leaf);
+        root_ = NULL;
+    }
+    else if(!root_->leaf && root_->count == 0){ //the root's only child takes its place
+        Inner* inner = static_cast<Inner*>(root_);
+        root_ = inner->children[0];
+        inner->~Inner();
+        innerPool_.deallocate(inner);
+    }
+}
+
+/**
+* Removes key from below node and returns whether it was found. Separators in
+* inner nodes may keep naming a removed key; they still route correctly.
+*/
+template<class Key, class Value>
+bool BPlusTree<Key, Value>::removeFrom(BNode* node, const Key& key)
+{
+    if(node->leaf){
+        Leaf* leaf = static_cast<Leaf*>(node);
+        int pos = Search::lowerBound(leaf->keys, leaf->count, key);
+        if(pos == leaf->count || key < leaf->keys[pos]){
+            return false;
+        }
+        std::move(leaf->keys + pos + 1, leaf->keys + leaf->count, leaf->keys + pos);
+        std::move(leaf->values + pos + 1, leaf->values + leaf->count, leaf->values + pos);
+        --leaf->count;
+        --size_;
+        return true;
+    }
+
+    Inner* inner = static_cast<Inner*>(node);
+    int i = Search::upperBound(inner->keys, inner->count, key);
+    if(!removeFrom(inner->children[i], key)){
+        return false;
+    }
+    if(underfull(inner->children[i])){
+        fixUnderflow(inner, i);
+    }
+    return true;
+}
+
+/**
+* Returns true if node holds fewer keys than a non-root node may.
+*/
+template<class Key, class Value>
+bool BPlusTree<Key, Value>::underfull(const BNode* node)
+{
+    return node->count < (node->leaf ? MIN_LEAF_ITEMS : MIN_INNER_KEYS);
+}
+
+/**
+* Refills parent's child i, which just fell below the minimum: take one key
+* from a sibling that can spare it, or else merge the child with a sibling
+* (dropping the separator between them from parent).
+*/
+template<class Key, class Value>
+void BPlusTree<Key, Value>::fixUnderflow(Inner* parent, int i)
+{
+    BNode* child = parent->children[i];
+    BNode* left = i > 0 ? parent->children[i - 1] : NULL;
+    BNode* right = i < parent->count ? parent->children[i + 1] : NULL;
+
+    if(child->leaf){
+        Leaf* c = static_cast<Leaf*>(child);
+        Leaf* l = static_cast<Leaf*>(left);
+        Leaf* r = static_cast<Leaf*>(right);
+        if(l != NULL && l->count > MIN_LEAF_ITEMS){ //borrow the left sibling's largest item
+            insertItemAt(c, 0, l->keys[l->count - 1], l->values[l->count - 1]);
+            --l->count;
+            parent->keys[i - 1] = c->keys[0];
+            return;
+        }
+        if(r != NULL && r->count > MIN_LEAF_ITEMS){ //borrow the right sibling's smallest item
+            insertItemAt(c, c->count, r->keys[0], r->values[0]);
+            std::move(r->keys + 1, r->keys + r->count, r->keys);
+            std::move(r->values + 1, r->values + r->count, r->values);
+            --r->count;
+            parent->keys[i] = r->keys[0];
+            return;
+        }
+        if(l == NULL){ //merge the right sibling into the child instead
+            l = c;
+            c = r;
+            ++i;
+        }
+        std::move(c->keys, c->keys + c->count, l->keys + l->count);
+        std::move(c->values, c->values + c->count, l->values + l->count);
+        l->count += c->count;
+        l->next = c->next;
+        c->~Leaf();
+        leafPool_.deallocate(c);
+    }
+    else{
+        Inner* c = static_cast<Inner*>(child);
+        Inner* l = static_cast<Inner*>(left);
+        Inner* r = static_cast<Inner*>(right);
+        if(l != NULL && l->count > MIN_INNER_KEYS){ //rotate through the parent from the left
+            insertChildAt(c, 0, parent->keys[i - 1], c->children[0]);
+            c->children[0] = l->children[l->count];
+            parent->keys[i - 1] = l->keys[l->count - 1];
+            --l->count;
+            return;
+        }
+        if(r != NULL && r->count > MIN_INNER_KEYS){ //rotate through the parent from the right
+            c->keys[c->count] = parent->keys[i];
+            c->children[c->count + 1] = r->children[0];
+            ++c->count;
+            parent->keys[i] = r->keys[0];
+            std::move(r->keys + 1, r->keys + r->count, r->keys);
+            std::copy(r->children + 1, r->children + r->count + 1, r->children);
+            --r->count;
+            return;
+        }
+        if(l == NULL){
+            l = c;
+            c = r;
+            ++i;
+        }
+        l->keys[l->count] = parent->keys[i - 1]; //the separator comes down between the halves
+        std::move(c->keys, c->keys + c->count, l->keys + l->count + 1);
+        std::copy(c->children, c->children + c->count + 1, l->children + l->count + 1);
+        l->count += c->count + 1;
+        c->~Inner();
+        innerPool_.deallocate(c);
+    }
+
+    // child i has been merged into child i - 1: drop it and the separator before it
+    std::move(parent->keys + i, parent->keys + parent->count, parent->keys + i - 1);
+    std::copy(parent->children + i + 1, parent->children + parent->count + 1, parent->children + i);
+    --parent->count;
+}
+
+/*
+--------------------------------------------
+End implementations for the BPlusTree class.
+--------------------------------------------
+*/
+
+#endif
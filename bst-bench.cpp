@@ -0,0 +1,564 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "bst.h"
+#include "avlbst.h"
+#include "rbbst.h"
+#include "bplustree.h"
+#include "compact_avl.h"
+#include "mapped_tree.h"
+
+using namespace std;
+
+/*
+ * Throughput and latency benchmark for BinarySearchTree, AVLTree, RedBlackTree,
+ * CompactAVLTree, BPlusTree and std::map.
+ *
+ * Every (container, key distribution, size) combination runs these phases on a
+ * fresh map: insert all keys, find keys drawn from the same distribution, iterate
+ * over everything, remove every key, and clear a full map. Each phase prints one
+ * CSV row (see printHeader()) to stdout, so runs from different versions can be
+ * diffed or loaded into a spreadsheet. Progress and skipped runs go to stderr.
+ * FrozenTree snapshots are read-only, so they only run the freeze (build from an
+ * AVLTree), find and iterate phases. MappedTree runs open (mapping a file the
+ * FrozenTree saved), find and iterate. AVLTree and std::map also run insert-hint,
+ * which passes each insert the iterator the previous one returned, and AVLTree
+ * runs insert-remembered, the same stream with rememberInserts() on. AVLTree
+ * snapshots are timed as save and load phases through an in-memory stream.
+ * std::map, AVLTree and RedBlackTree also run two write-heavy mixes on a full
+ * map: churn removes a key and puts it back, and write-mix is a quarter
+ * removes, a quarter inserts and half finds. Phases that handle the whole map
+ * in one call (iterate, freeze, save, load) are reported per item, latencies
+ * included (see measureEach()).
+ *
+ * Usage: ./bst-bench [--max N] [--label NAME]
+ *   --max N       largest size to run (sizes are 1K, 10K, ... up to 10M; default 1M)
+ *   --label NAME  value for the "label" column, e.g. a version or commit id
+ */
+
+typedef chrono::steady_clock Clock;
+
+// Per-operation latencies are recorded for roughly this many operations per phase
+static const size_t LATENCY_SAMPLES = 16384;
+
+// File the MappedTree runs map; removed again before exiting
+static const char* MAPPED_FILE = "bst-bench-mapped.tmp";
+
+// Every checksum of a run is added here, so the compiler cannot drop the timed work
+static volatile long long checksumSink = 0;
+
+// A plain BST fed sorted keys degenerates into a list, so larger runs are skipped
+static const size_t DEGENERATE_BST_LIMIT = 20000;
+
+enum Distribution { RANDOM, SORTED, REVERSE, ZIPF };
+
+static const char* distributionName(Distribution d)
+{
+    switch(d){
+    case RANDOM: return "random";
+    case SORTED: return "sorted";
+    case REVERSE: return "reverse";
+    default: return "zipf";
+    }
+}
+
+/**
+ * Timing results of one phase, accumulated over all repetitions.
+ */
+struct Phase
+{
+    Phase() : ops(0), totalNs(0) {}
+
+    size_t ops;
+    double totalNs;
+    vector<double> samples; // latencies of individually timed operations, in ns
+};
+
+/**
+ * Draws from a Zipf distribution over ranks [0, n) with exponent s by
+ * binary searching a precomputed cumulative distribution.
+ */
+class ZipfGenerator
+{
+public:
+    ZipfGenerator(size_t n, double s) : cdf_(n)
+    {
+        double sum = 0;
+        for(size_t i = 0; i < n; ++i){
+            sum += 1.0 / pow((double)(i + 1), s);
+            cdf_[i] = sum;
+        }
+        for(size_t i = 0; i < n; ++i){
+            cdf_[i] /= sum;
+        }
+    }
+
+    size_t operator()(mt19937_64& rng) const
+    {
+        double u = uniform_real_distribution<double>(0.0, 1.0)(rng);
+        return lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin();
+    }
+
+private:
+    vector<double> cdf_;
+};
+
+/**
+ * Spreads Zipf ranks over the key space so the hot keys are not also the smallest.
+ */
+static int scrambleRank(size_t rank)
+{
+    uint64_t x = rank * 0x9E3779B97F4A7C15ULL;
+    return (int)((x >> 33) & 0x7fffffff);
+}
+
+/**
+ * Builds the stream of n keys inserted for the given distribution.
+ */
+static vector<int> makeInsertKeys(Distribution d, size_t n, mt19937_64& rng)
+{
+    vector<int> keys(n);
+    if(d == ZIPF){
+        ZipfGenerator zipf(n, 0.99);
+        for(size_t i = 0; i < n; ++i){
+            keys[i] = scrambleRank(zipf(rng));
+        }
+        return keys;
+    }
+    for(size_t i = 0; i < n; ++i){
+        keys[i] = (int)(i * 2);
+    }
+    if(d == RANDOM){
+        shuffle(keys.begin(), keys.end(), rng);
+    }
+    else if(d == REVERSE){
+        reverse(keys.begin(), keys.end());
+    }
+    return keys;
+}
+
+/**
+ * Builds the stream of n keys looked up: Zipf maps see the same skew as their
+ * inserts, the others look up every inserted key in random order.
+ */
+static vector<int> makeFindKeys(Distribution d, const vector<int>& inserted, mt19937_64& rng)
+{
+    vector<int> keys(inserted);
+    if(d == ZIPF){
+        ZipfGenerator zipf(inserted.size(), 0.99);
+        for(size_t i = 0; i < keys.size(); ++i){
+            keys[i] = scrambleRank(zipf(rng));
+        }
+    }
+    else{
+        shuffle(keys.begin(), keys.end(), rng);
+    }
+    return keys;
+}
+
+// Container adapters: the trees and std::map spell insert/remove differently
+
+template<typename Map>
+void benchInsert(Map& m, int key, int value)
+{
+    m.insert(make_pair(key, value));
+}
+
+void benchInsert(map<int, int>& m, int key, int value)
+{
+    m[key] = value;
+}
+
+template<typename Map>
+typename Map::iterator benchInsertHint(Map& m, typename Map::iterator hint, int key, int value)
+{
+    return m.insert(hint, make_pair(key, value));
+}
+
+map<int, int>::iterator benchInsertHint(map<int, int>& m, map<int, int>::iterator hint, int key, int value)
+{
+    map<int, int>::iterator it = m.insert(hint, make_pair(key, value));
+    it->second = value; // the trees overwrite, so std::map does too
+    return it;
+}
+
+template<typename Map>
+void benchRemove(Map& m, int key)
+{
+    m.remove(key);
+}
+
+void benchRemove(map<int, int>& m, int key)
+{
+    m.erase(key);
+}
+
+/**
+ * Runs op(i) for i in [0, ops), timing the whole loop and every stride-th
+ * operation on its own, and adds the results to phase.
+ */
+template<typename Op>
+void measure(Phase& phase, size_t ops, Op op)
+{
+    size_t stride = 1;
+    while(ops / stride > LATENCY_SAMPLES){
+        stride *= 2;
+    }
+    const size_t mask = stride - 1;
+
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < ops; ++i){
+        if((i & mask) == 0){
+            Clock::time_point before = Clock::now();
+            op(i);
+            phase.samples.push_back(chrono::duration<double, nano>(Clock::now() - before).count());
+        }
+        else{
+            op(i);
+        }
+    }
+    phase.totalNs += chrono::duration<double, nano>(Clock::now() - start).count();
+    phase.ops += ops;
+}
+
+/**
+ * Times one call of op that works through elements items at once (a
+ * pass over the map, a build or a snapshot) and adds it to phase as that many
+ * operations. Its latency sample is the call's time divided by elements, so
+ * the percentiles are per element like ops_per_sec, taken across repetitions.
+ */
+template<typename Op>
+void measureEach(Phase& phase, size_t elements, Op op)
+{
+    measure(phase, 1, [&](size_t) { op(); });
+    phase.ops += elements - 1;
+    phase.samples.back() /= elements;
+}
+
+/**
+ * Returns how many different keys the stream holds, which is the size of the
+ * map once they are all in. Only Zipf streams repeat keys.
+ */
+static size_t distinctKeys(const vector<int>& keys)
+{
+    vector<int> sorted(keys);
+    sort(sorted.begin(), sorted.end());
+    return unique(sorted.begin(), sorted.end()) - sorted.begin();
+}
+
+static double percentile(vector<double>& sorted, double p)
+{
+    if(sorted.empty()){
+        return 0;
+    }
+    size_t index = (size_t)(p * (sorted.size() - 1));
+    return sorted[index];
+}
+
+/**
+ * n is the length of the key stream and items the number of distinct keys in
+ * it (smaller than n only for Zipf streams, which repeat hot keys).
+ */
+static void printHeader()
+{
+    cout << "label,container,distribution,n,items,operation,ops,total_ns,ops_per_sec,"
+         << "p50_ns,p90_ns,p99_ns,p999_ns,max_ns" << endl;
+}
+
+static void printPhase(const string& label, const char* container, Distribution d, size_t n,
+                       size_t items, const char* operation, Phase& phase)
+{
+    sort(phase.samples.begin(), phase.samples.end());
+    double opsPerSec = phase.totalNs > 0 ? phase.ops / (phase.totalNs / 1e9) : 0;
+    cout << label << ',' << container << ',' << distributionName(d) << ',' << n << ',' << items << ','
+         << operation << ',' << phase.ops << ',' << (long long)phase.totalNs << ','
+         << (long long)opsPerSec << ','
+         << percentile(phase.samples, 0.50) << ',' << percentile(phase.samples, 0.90) << ','
+         << percentile(phase.samples, 0.99) << ',' << percentile(phase.samples, 0.999) << ','
+         << (phase.samples.empty() ? 0 : phase.samples.back()) << endl;
+}
+
+/**
+ * Runs every phase for one container type on one key stream.
+ */
+template<typename Map>
+void runContainer(const string& label, const char* container, Distribution d,
+                  const vector<int>& insertKeys, const vector<int>& findKeys,
+                  const vector<int>& removeKeys)
+{
+    const size_t n = insertKeys.size();
+    const size_t items = distinctKeys(insertKeys);
+    const size_t reps = max((size_t)1, (size_t)100000 / n); // keep small runs long enough to time
+    Phase insertPhase, findPhase, iteratePhase, removePhase, clearPhase;
+    long long checksum = 0;
+
+    for(size_t rep = 0; rep < reps; ++rep){
+        Map m;
+        measure(insertPhase, n, [&](size_t i) { benchInsert(m, insertKeys[i], (int)i); });
+        measure(findPhase, n, [&](size_t i) { checksum += (m.find(findKeys[i]) != m.end()); });
+        measureEach(iteratePhase, items, [&]() {
+            for(typename Map::iterator it = m.begin(); it != m.end(); ++it){
+                checksum += it->second;
+            }
+        });
+        measure(removePhase, n, [&](size_t i) { benchRemove(m, removeKeys[i]); });
+
+        for(size_t i = 0; i < n; ++i){ //refill for the clear phase
+            benchInsert(m, insertKeys[i], (int)i);
+        }
+        measure(clearPhase, 1, [&](size_t) { m.clear(); });
+    }
+
+    printPhase(label, container, d, n, items, "insert", insertPhase);
+    printPhase(label, container, d, n, items, "find", findPhase);
+    printPhase(label, container, d, n, items, "iterate", iteratePhase);
+    printPhase(label, container, d, n, items, "remove", removePhase);
+    printPhase(label, container, d, n, items, "clear", clearPhase);
+    checksumSink += checksum;
+}
+
+/**
+ * Times inserting the key stream with hints: each insert is handed the iterator
+ * the previous one returned, starting from end(). For AVLTree it also times the
+ * same stream through plain insert() with rememberInserts() on.
+ */
+template<typename Map>
+void runHinted(const string& label, const char* container, Distribution d,
+               const vector<int>& insertKeys)
+{
+    const size_t n = insertKeys.size();
+    const size_t items = distinctKeys(insertKeys);
+    const size_t reps = max((size_t)1, (size_t)100000 / n);
+    Phase hintPhase;
+
+    for(size_t rep = 0; rep < reps; ++rep){
+        Map m;
+        typename Map::iterator hint = m.end();
+        measure(hintPhase, n, [&](size_t i) { hint = benchInsertHint(m, hint, insertKeys[i], (int)i); });
+    }
+    printPhase(label, container, d, n, items, "insert-hint", hintPhase);
+}
+
+/**
+ * Times the write-heavy mixes on a map already holding every key of the stream.
+ * churn does one remove and one insert per operation (the key goes straight
+ * back in); write-mix cycles through remove, insert of the key just removed,
+ * and two finds. Either way the map stays at about n items.
+ */
+template<typename Map>
+void runWriteMix(const string& label, const char* container, Distribution d,
+                 const vector<int>& insertKeys, const vector<int>& findKeys,
+                 const vector<int>& removeKeys)
+{
+    const size_t n = insertKeys.size();
+    const size_t items = distinctKeys(insertKeys);
+    const size_t reps = max((size_t)1, (size_t)100000 / n);
+    Phase churnPhase, mixPhase;
+    long long checksum = 0;
+
+    for(size_t rep = 0; rep < reps; ++rep){
+        Map m;
+        for(size_t i = 0; i < n; ++i){
+            benchInsert(m, insertKeys[i], (int)i);
+        }
+        measure(churnPhase, n, [&](size_t i) {
+            benchRemove(m, removeKeys[i]);
+            benchInsert(m, removeKeys[i], (int)i);
+        });
+        measure(mixPhase, n, [&](size_t i) {
+            switch(i & 3){
+            case 0: benchRemove(m, removeKeys[i]); break;
+            case 1: benchInsert(m, removeKeys[i - 1], (int)i); break;
+            default: checksum += (m.find(findKeys[i]) != m.end()); break;
+            }
+        });
+    }
+
+    printPhase(label, container, d, n, items, "churn", churnPhase);
+    printPhase(label, container, d, n, items, "write-mix", mixPhase);
+    checksumSink += checksum;
+}
+
+void runRemembered(const string& label, Distribution d, const vector<int>& insertKeys)
+{
+    const size_t n = insertKeys.size();
+    const size_t items = distinctKeys(insertKeys);
+    const size_t reps = max((size_t)1, (size_t)100000 / n);
+    Phase insertPhase;
+
+    for(size_t rep = 0; rep < reps; ++rep){
+        AVLTree<int, int> m;
+        m.rememberInserts(true);
+        measure(insertPhase, n, [&](size_t i) { benchInsert(m, insertKeys[i], (int)i); });
+    }
+    printPhase(label, "AVLTree", d, n, items, "insert-remembered", insertPhase);
+}
+
+/**
+ * Runs the read-only phases on a FrozenTree frozen from an AVLTree of the key stream.
+ */
+void runFrozen(const string& label, Distribution d, const vector<int>& insertKeys,
+               const vector<int>& findKeys)
+{
+    const size_t n = insertKeys.size();
+    const size_t items = distinctKeys(insertKeys);
+    const size_t reps = max((size_t)1, (size_t)100000 / n);
+    Phase freezePhase, findPhase, iteratePhase;
+    long long checksum = 0;
+
+    AVLTree<int, int> source;
+    for(size_t i = 0; i < n; ++i){
+        benchInsert(source, insertKeys[i], (int)i);
+    }
+    for(size_t rep = 0; rep < reps; ++rep){
+        FrozenTree<int, int> frozen;
+        measureEach(freezePhase, items, [&]() { frozen = source.freeze(); });
+        measure(findPhase, n, [&](size_t i) { checksum += (frozen.find(findKeys[i]) != frozen.end()); });
+        measureEach(iteratePhase, items, [&]() {
+            for(FrozenTree<int, int>::iterator it = frozen.begin(); it != frozen.end(); ++it){
+                checksum += it->second;
+            }
+        });
+    }
+
+    printPhase(label, "FrozenTree", d, n, items, "freeze", freezePhase);
+    printPhase(label, "FrozenTree", d, n, items, "find", findPhase);
+    printPhase(label, "FrozenTree", d, n, items, "iterate", iteratePhase);
+    checksumSink += checksum;
+}
+
+/**
+ * Runs the read-only phases on a MappedTree of a file saved from a FrozenTree
+ * of the key stream. The file was just written, so its pages are in the page
+ * cache and open measures the mapping rather than the disk.
+ */
+void runMapped(const string& label, Distribution d, const vector<int>& insertKeys,
+               const vector<int>& findKeys)
+{
+    const size_t n = insertKeys.size();
+    const size_t items = distinctKeys(insertKeys);
+    const size_t reps = max((size_t)1, (size_t)100000 / n);
+    Phase openPhase, findPhase, iteratePhase;
+    long long checksum = 0;
+
+    AVLTree<int, int> source;
+    for(size_t i = 0; i < n; ++i){
+        benchInsert(source, insertKeys[i], (int)i);
+    }
+    {
+        ofstream out(MAPPED_FILE, ios::binary);
+        source.freeze().save(out);
+    }
+    for(size_t rep = 0; rep < reps; ++rep){
+        MappedTree<int, int>* view = NULL;
+        measure(openPhase, 1, [&](size_t) { view = new MappedTree<int, int>(MAPPED_FILE); });
+        measure(findPhase, n, [&](size_t i) { checksum += (view->find(findKeys[i]) != view->end()); });
+        measureEach(iteratePhase, items, [&]() {
+            for(MappedTree<int, int>::iterator it = view->begin(); it != view->end(); ++it){
+                checksum += it->second;
+            }
+        });
+        delete view;
+    }
+    remove(MAPPED_FILE);
+
+    printPhase(label, "MappedTree", d, n, items, "open", openPhase);
+    printPhase(label, "MappedTree", d, n, items, "find", findPhase);
+    printPhase(label, "MappedTree", d, n, items, "iterate", iteratePhase);
+    checksumSink += checksum;
+}
+
+/**
+ * Times AVLTree::save() of a tree built from the key stream, and load() of that
+ * snapshot into an empty tree, through a stringstream so the disk is left out.
+ */
+void runSnapshot(const string& label, Distribution d, const vector<int>& insertKeys)
+{
+    const size_t n = insertKeys.size();
+    const size_t items = distinctKeys(insertKeys);
+    const size_t reps = max((size_t)1, (size_t)100000 / n);
+    Phase savePhase, loadPhase;
+    long long checksum = 0;
+
+    AVLTree<int, int> source;
+    for(size_t i = 0; i < n; ++i){
+        benchInsert(source, insertKeys[i], (int)i);
+    }
+    for(size_t rep = 0; rep < reps; ++rep){
+        stringstream snapshot;
+        measureEach(savePhase, items, [&]() { source.save(snapshot); });
+        AVLTree<int, int> loaded;
+        measureEach(loadPhase, items, [&]() { loaded.load(snapshot); });
+        checksum += loaded.begin()->second;
+    }
+
+    printPhase(label, "AVLTree", d, n, items, "save", savePhase);
+    printPhase(label, "AVLTree", d, n, items, "load", loadPhase);
+    checksumSink += checksum;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t maxSize = 1000000;
+    string label = "current";
+    for(int i = 1; i < argc; ++i){
+        if(strcmp(argv[i], "--max") == 0 && i + 1 < argc){
+            maxSize = strtoul(argv[++i], NULL, 10);
+        }
+        else if(strcmp(argv[i], "--label") == 0 && i + 1 < argc){
+            label = argv[++i];
+        }
+        else{
+            cerr << "Usage: " << argv[0] << " [--max N] [--label NAME]" << endl;
+            return 1;
+        }
+    }
+
+    cout << fixed << setprecision(0);
+    printHeader();
+    const Distribution distributions[] = { RANDOM, SORTED, REVERSE, ZIPF };
+    for(size_t n = 1000; n <= maxSize && n <= 10000000; n *= 10){
+        for(size_t di = 0; di < sizeof(distributions) / sizeof(distributions[0]); ++di){
+            Distribution d = distributions[di];
+            mt19937_64 rng(n * 31 + di);
+            vector<int> insertKeys = makeInsertKeys(d, n, rng);
+            vector<int> findKeys = makeFindKeys(d, insertKeys, rng);
+            vector<int> removeKeys(insertKeys);
+            shuffle(removeKeys.begin(), removeKeys.end(), rng);
+
+            cerr << "n=" << n << " " << distributionName(d) << endl;
+            runContainer<map<int, int> >(label, "std::map", d, insertKeys, findKeys, removeKeys);
+            runContainer<AVLTree<int, int> >(label, "AVLTree", d, insertKeys, findKeys, removeKeys);
+            runContainer<RedBlackTree<int, int> >(label, "RedBlackTree", d, insertKeys, findKeys, removeKeys);
+            runWriteMix<map<int, int> >(label, "std::map", d, insertKeys, findKeys, removeKeys);
+            runWriteMix<AVLTree<int, int> >(label, "AVLTree", d, insertKeys, findKeys, removeKeys);
+            runWriteMix<RedBlackTree<int, int> >(label, "RedBlackTree", d, insertKeys, findKeys, removeKeys);
+            runHinted<map<int, int> >(label, "std::map", d, insertKeys);
+            runHinted<AVLTree<int, int> >(label, "AVLTree", d, insertKeys);
+            runRemembered(label, d, insertKeys);
+            runSnapshot(label, d, insertKeys);
+            runContainer<CompactAVLTree<int, int> >(label, "CompactAVLTree", d, insertKeys, findKeys, removeKeys);
+            runFrozen(label, d, insertKeys, findKeys);
+            runMapped(label, d, insertKeys, findKeys);
+            runContainer<BPlusTree<int, int> >(label, "BPlusTree", d, insertKeys, findKeys, removeKeys);
+            if((d == SORTED || d == REVERSE) && n > DEGENERATE_BST_LIMIT){
+                cerr << "  skipping BinarySearchTree (degenerates to a list on " << distributionName(d) << " keys)" << endl;
+            }
+            else{
+                runContainer<BinarySearchTree<int, int> >(label, "BinarySearchTree", d, insertKeys, findKeys, removeKeys);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,165 @@
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "avlbst.h"
+#include "concurrent_avl.h"
+
+using namespace std;
+
+/*
+ * Multi-threaded read/write scaling benchmark: ConcurrentAVLTree against an
+ * AVLTree behind one global mutex (how shared maps were protected before).
+ *
+ * Each run pre-fills a map with n random keys out of a key space of 2n, then
+ * starts T threads that for a fixed time pick random keys and either look
+ * them up or (split evenly) insert or remove them, so the size stays about n.
+ * One CSV row per (container, read percentage, thread count) goes to stdout.
+ *
+ * Usage: ./bst-mt-bench [--threads MAX] [--n N] [--ms MILLIS] [--label NAME]
+ *   --threads MAX  largest thread count; runs 1, 2, 4, ... up to it (default: 2x the cores)
+ *   --n N          number of keys in the map (default 1M)
+ *   --ms MILLIS    duration of each run (default 500)
+ *   --label NAME   value for the "label" column
+ */
+
+typedef chrono::steady_clock Clock;
+
+// Lookup results end up here so they cannot be optimized away
+static atomic<long long> hitSink(0);
+
+/**
+ * The baseline: every operation takes the one lock.
+ */
+class LockedAVLTree
+{
+public:
+    void insert(const pair<const int, int>& item)
+    {
+        lock_guard<mutex> hold(lock_);
+        tree_.insert(item);
+    }
+    void remove(int key)
+    {
+        lock_guard<mutex> hold(lock_);
+        tree_.remove(key);
+    }
+    bool contains(int key)
+    {
+        lock_guard<mutex> hold(lock_);
+        return tree_.find(key) != tree_.end();
+    }
+
+private:
+    mutex lock_;
+    AVLTree<int, int> tree_;
+};
+
+class SharedConcurrentTree
+{
+public:
+    void insert(const pair<const int, int>& item) { tree_.insert(item); }
+    void remove(int key) { tree_.remove(key); }
+    bool contains(int key) { return tree_.find(key) != tree_.end(); }
+
+private:
+    ConcurrentAVLTree<int, int> tree_;
+};
+
+/**
+ * Runs threads threads against m for ms milliseconds and returns the total number of operations.
+ */
+template<typename Map>
+long long runThreads(Map& m, size_t n, int threads, int readPercent, int ms)
+{
+    atomic<bool> stop(false);
+    atomic<long long> total(0);
+    vector<thread> workers;
+    for(int t = 0; t < threads; ++t){
+        workers.push_back(thread([&, t]() {
+            mt19937_64 rng(1000 + t);
+            long long ops = 0, hits = 0;
+            while(!stop.load(memory_order_relaxed)){
+                for(int i = 0; i < 64; ++i, ++ops){ //check the clock flag only every so often
+                    int key = (int)(rng() % (2 * n));
+                    int roll = (int)(rng() % 200);
+                    if(roll < 2 * readPercent){
+                        hits += m.contains(key);
+                    }
+                    else if(roll & 1){
+                        m.insert(make_pair(key, i));
+                    }
+                    else{
+                        m.remove(key);
+                    }
+                }
+            }
+            total += ops;
+            hitSink += hits;
+        }));
+    }
+    this_thread::sleep_for(chrono::milliseconds(ms));
+    stop = true;
+    for(size_t t = 0; t < workers.size(); ++t){
+        workers[t].join();
+    }
+    return total.load();
+}
+
+template<typename Map>
+void runContainer(const string& label, const char* container, size_t n, int maxThreads, int ms)
+{
+    const int readPercents[] = { 100, 90, 50 };
+    for(size_t r = 0; r < sizeof(readPercents) / sizeof(readPercents[0]); ++r){
+        for(int threads = 1; threads <= maxThreads; threads *= 2){
+            Map m;
+            mt19937_64 rng(n);
+            for(size_t i = 0; i < n; ++i){
+                m.insert(make_pair((int)(rng() % (2 * n)), (int)i));
+            }
+            cerr << container << " read=" << readPercents[r] << "% threads=" << threads << endl;
+            Clock::time_point start = Clock::now();
+            long long ops = runThreads(m, n, threads, readPercents[r], ms);
+            double seconds = chrono::duration<double>(Clock::now() - start).count();
+            cout << label << ',' << container << ',' << n << ',' << readPercents[r] << ',' << threads << ','
+                 << ops << ',' << seconds << ',' << (long long)(ops / seconds) << endl;
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int maxThreads = 2 * max(1, (int)thread::hardware_concurrency());
+    size_t n = 1000000;
+    int ms = 500;
+    string label = "current";
+    for(int i = 1; i < argc; ++i){
+        if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc){
+            maxThreads = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--n") == 0 && i + 1 < argc){
+            n = strtoul(argv[++i], NULL, 10);
+        }
+        else if(strcmp(argv[i], "--ms") == 0 && i + 1 < argc){
+            ms = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--label") == 0 && i + 1 < argc){
+            label = argv[++i];
+        }
+        else{
+            cerr << "Usage: " << argv[0] << " [--threads MAX] [--n N] [--ms MILLIS] [--label NAME]" << endl;
+            return 1;
+        }
+    }
+
+    cout << "label,container,n,read_pct,threads,ops,seconds,ops_per_sec" << endl;
+    runContainer<LockedAVLTree>(label, "AVLTree+mutex", n, maxThreads, ms);
+    runContainer<SharedConcurrentTree>(label, "ConcurrentAVLTree", n, maxThreads, ms);
+    return 0;
+}
@@ -0,0 +1,304 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "avlbst.h"
+
+using namespace std;
+
+/*
+ * Benchmark for the bulk set operations of AVLTree (unionWith, intersectWith,
+ * differenceWith) against doing the same with one insert/find/remove per item.
+ *
+ * Each run builds a tree of n random keys and a second tree of m random keys
+ * out of the same key space of 2n (so about a quarter of the smaller tree's
+ * keys are in both), then times only the operation itself. The join-based
+ * versions run on a TaskPool of 1, 2, 4, ... threads. One CSV row per
+ * (operation, method, m, threads) goes to stdout.
+ *
+ * split and join rows move half of the keys between trees: split() cuts the
+ * tree at the middle of the key space, join() glues on a tree whose keys all
+ * come after the first one's. The baseline copies the items over one by one.
+ *
+ * batch rows apply m unsorted operations (three upserts to one erase, keys
+ * from the same key space) to a tree of n keys with applyBatch(), with one
+ * insert/remove per operation, and by rebuilding: sorting the batch, merging
+ * it with the tree's items and building a new tree from the result.
+ *
+ * Usage: ./bst-setops-bench [--threads MAX] [--n N] [--label NAME]
+ *   --threads MAX  largest pool size; runs 1, 2, 4, ... up to it (default: the cores)
+ *   --n N          size of the bigger tree (default 1M); m runs n/1000, n/10 and n
+ *   --label NAME   value for the "label" column
+ */
+
+typedef chrono::steady_clock Clock;
+typedef AVLTree<int, int> Tree;
+
+enum Operation { UNION, INTERSECTION, DIFFERENCE, SPLIT, JOIN, BATCH };
+
+static const char* operationName(Operation op)
+{
+    switch(op){
+    case UNION: return "union";
+    case INTERSECTION: return "intersection";
+    case DIFFERENCE: return "difference";
+    case SPLIT: return "split";
+    case JOIN: return "join";
+    default: return "batch";
+    }
+}
+
+static void fill(Tree& tree, size_t count, size_t keySpace, unsigned seed, size_t offset = 0)
+{
+    mt19937_64 rng(seed);
+    for(size_t i = 0; i < count; ++i){
+        tree.insert(make_pair((int)(offset + rng() % keySpace), (int)i));
+    }
+}
+
+/**
+ * The baseline: walk the second tree (or the first, for an intersection) and
+ * apply one ordinary operation per item.
+ */
+static void itemByItem(Operation op, Tree& a, Tree& b)
+{
+    if(op == UNION){
+        for(Tree::iterator it = b.begin(); it != b.end(); ++it){
+            a.insert(*it);
+        }
+    }
+    else if(op == DIFFERENCE){
+        for(Tree::iterator it = b.begin(); it != b.end(); ++it){
+            a.remove(it->first);
+        }
+    }
+    else{
+        vector<int> gone;
+        for(Tree::iterator it = a.begin(); it != a.end(); ++it){
+            if(b.find(it->first) == b.end()){
+                gone.push_back(it->first);
+            }
+        }
+        for(size_t i = 0; i < gone.size(); ++i){
+            a.remove(gone[i]);
+        }
+    }
+}
+
+static void joinBased(Operation op, Tree& a, Tree& b, TaskPool& pool)
+{
+    if(op == UNION){
+        a.unionWith(std::move(b), pool);
+    }
+    else if(op == INTERSECTION){
+        a.intersectWith(std::move(b), pool);
+    }
+    else{
+        a.differenceWith(std::move(b), pool);
+    }
+}
+
+static void printRow(const string& label, Operation op, const char* method, size_t n, size_t m,
+                     unsigned threads, double seconds)
+{
+    cout << label << ',' << operationName(op) << ',' << method << ',' << n << ',' << m << ','
+         << threads << ',' << seconds << ',' << (long long)((n + m) / seconds) << endl;
+}
+
+/**
+ * Times splitting a tree of n keys at the middle of its key space, and joining
+ * two trees of n keys each, both ways.
+ */
+static void runSplitJoin(const string& label, size_t n)
+{
+    const int middle = (int)n;
+    {
+        Tree a;
+        fill(a, n, 2 * n, 1);
+        Clock::time_point start = Clock::now();
+        Tree upper;
+        vector<int> moved;
+        for(Tree::iterator it = a.lowerBound(middle); it != a.end(); ++it){
+            upper.insert(*it);
+            moved.push_back(it->first);
+        }
+        for(size_t i = 0; i < moved.size(); ++i){
+            a.remove(moved[i]);
+        }
+        printRow(label, SPLIT, "item-by-item", n, moved.size(), 1, chrono::duration<double>(Clock::now() - start).count());
+    }
+    {
+        Tree a;
+        fill(a, n, 2 * n, 1);
+        Clock::time_point start = Clock::now();
+        Tree upper = a.split(middle);
+        double seconds = chrono::duration<double>(Clock::now() - start).count();
+        size_t moved = 0;
+        for(Tree::iterator it = upper.begin(); it != upper.end(); ++it){
+            ++moved;
+        }
+        printRow(label, SPLIT, "join", n, moved, 1, seconds);
+    }
+    {
+        Tree a, b;
+        fill(a, n, 2 * n, 1);
+        fill(b, n, 2 * n, 2, 2 * n);
+        Clock::time_point start = Clock::now();
+        for(Tree::iterator it = b.begin(); it != b.end(); ++it){
+            a.insert(*it);
+        }
+        b.clear();
+        printRow(label, JOIN, "item-by-item", n, n, 1, chrono::duration<double>(Clock::now() - start).count());
+    }
+    {
+        Tree a, b;
+        fill(a, n, 2 * n, 1);
+        fill(b, n, 2 * n, 2, 2 * n);
+        Clock::time_point start = Clock::now();
+        a.join(std::move(b));
+        printRow(label, JOIN, "join", n, n, 1, chrono::duration<double>(Clock::now() - start).count());
+    }
+}
+
+static vector<BatchOp<int, int> > makeBatch(size_t count, size_t keySpace, unsigned seed)
+{
+    mt19937_64 rng(seed);
+    vector<BatchOp<int, int> > ops;
+    ops.reserve(count);
+    for(size_t i = 0; i < count; ++i){
+        int key = (int)(rng() % keySpace);
+        ops.push_back(rng() % 4 == 0 ? BatchOp<int, int>::erase(key) : BatchOp<int, int>::upsert(key, (int)i));
+    }
+    return ops;
+}
+
+/**
+ * The rebuild baseline: sorts the batch, merges it with the tree's items and
+ * builds a fresh tree from the merged, sorted items in O(n + m).
+ */
+static void rebuildWithBatch(Tree& tree, vector<BatchOp<int, int> >& ops)
+{
+    stable_sort(ops.begin(), ops.end(), [](const BatchOp<int, int>& a, const BatchOp<int, int>& b) {
+        return a.item.first < b.item.first;
+    });
+    vector<pair<int, int> > merged;
+    Tree::iterator it = tree.begin();
+    for(size_t i = 0; i < ops.size(); ++i){
+        if(i + 1 < ops.size() && ops[i + 1].item.first == ops[i].item.first){ //the last operation on a key wins
+            continue;
+        }
+        for(; it != tree.end() && it->first < ops[i].item.first; ++it){
+            merged.push_back(*it);
+        }
+        if(it != tree.end() && it->first == ops[i].item.first){
+            ++it;
+        }
+        if(ops[i].kind == BatchOp<int, int>::UPSERT){
+            merged.push_back(ops[i].item);
+        }
+    }
+    for(; it != tree.end(); ++it){
+        merged.push_back(*it);
+    }
+    tree = Tree(merged.begin(), merged.end());
+}
+
+/**
+ * Times applying a batch of m operations to a tree of n keys three ways.
+ */
+static void runBatch(const string& label, size_t n, size_t m, unsigned maxThreads)
+{
+    {
+        Tree a;
+        fill(a, n, 2 * n, 1);
+        vector<BatchOp<int, int> > ops = makeBatch(m, 2 * n, 3);
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < ops.size(); ++i){
+            if(ops[i].kind == BatchOp<int, int>::UPSERT){
+                a.insert(ops[i].item);
+            }
+            else{
+                a.remove(ops[i].item.first);
+            }
+        }
+        printRow(label, BATCH, "item-by-item", n, m, 1, chrono::duration<double>(Clock::now() - start).count());
+    }
+    {
+        Tree a;
+        fill(a, n, 2 * n, 1);
+        vector<BatchOp<int, int> > ops = makeBatch(m, 2 * n, 3);
+        Clock::time_point start = Clock::now();
+        rebuildWithBatch(a, ops);
+        printRow(label, BATCH, "rebuild", n, m, 1, chrono::duration<double>(Clock::now() - start).count());
+    }
+    for(unsigned threads = 1; threads <= maxThreads; threads *= 2){
+        TaskPool pool(threads);
+        Tree a;
+        fill(a, n, 2 * n, 1);
+        vector<BatchOp<int, int> > ops = makeBatch(m, 2 * n, 3);
+        Clock::time_point start = Clock::now();
+        a.applyBatch(std::move(ops), pool);
+        printRow(label, BATCH, "join", n, m, threads, chrono::duration<double>(Clock::now() - start).count());
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned maxThreads = max(1u, thread::hardware_concurrency());
+    size_t n = 1000000;
+    string label = "current";
+    for(int i = 1; i < argc; ++i){
+        if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc){
+            maxThreads = (unsigned)atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--n") == 0 && i + 1 < argc){
+            n = strtoul(argv[++i], NULL, 10);
+        }
+        else if(strcmp(argv[i], "--label") == 0 && i + 1 < argc){
+            label = argv[++i];
+        }
+        else{
+            cerr << "Usage: " << argv[0] << " [--threads MAX] [--n N] [--label NAME]" << endl;
+            return 1;
+        }
+    }
+
+    cout << "label,operation,method,n,m,threads,seconds,items_per_sec" << endl;
+    const Operation ops[] = { UNION, INTERSECTION, DIFFERENCE };
+    const size_t sizes[] = { max((size_t)1, n / 1000), max((size_t)1, n / 10), n };
+    for(size_t o = 0; o < 3; ++o){
+        for(size_t s = 0; s < 3; ++s){
+            size_t m = sizes[s];
+            cerr << operationName(ops[o]) << " m=" << m << endl;
+            {
+                Tree a, b;
+                fill(a, n, 2 * n, 1);
+                fill(b, m, 2 * n, 2);
+                Clock::time_point start = Clock::now();
+                itemByItem(ops[o], a, b);
+                printRow(label, ops[o], "item-by-item", n, m, 1, chrono::duration<double>(Clock::now() - start).count());
+            }
+            for(unsigned threads = 1; threads <= maxThreads; threads *= 2){
+                TaskPool pool(threads);
+                Tree a, b;
+                fill(a, n, 2 * n, 1);
+                fill(b, m, 2 * n, 2);
+                Clock::time_point start = Clock::now();
+                joinBased(ops[o], a, b, pool);
+                printRow(label, ops[o], "join", n, m, threads, chrono::duration<double>(Clock::now() - start).count());
+            }
+        }
+    }
+    cerr << "split and join" << endl;
+    runSplitJoin(label, n);
+    for(size_t s = 0; s < 3; ++s){
+        cerr << "batch m=" << sizes[s] << endl;
+        runBatch(label, n, sizes[s], maxThreads);
+    }
+    return 0;
+}
@@ -1,13 +1,996 @@
 #include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <map>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
 #include "bst.h"
 #include "avlbst.h"
+#include "rbbst.h"
+#include "bplustree.h"
+#include "compact_avl.h"
+#include "mapped_tree.h"
+#include "concurrent_avl.h"
 
 using namespace std;
 
+// Visitor for rangeScan() that prints each key it is handed
+struct PrintKey
+{
+    void operator()(const std::pair<const char, int>& item) const
+    {
+        cout << " " << item.first;
+    }
+};
+
+// A probe for every string key that starts with text
+struct Prefix
+{
+    std::string text;
+};
+
+// Orders strings as usual; a Prefix is equivalent to every string that
+// starts with it, so one probe can match many keys
+struct PrefixLess
+{
+    typedef void is_transparent;
+
+    bool operator()(const std::string& a, const std::string& b) const
+    {
+        return a < b;
+    }
+    bool operator()(const std::string& a, const Prefix& b) const
+    {
+        return a.compare(0, b.text.size(), b.text) < 0;
+    }
+    bool operator()(const Prefix& a, const std::string& b) const
+    {
+        return b.compare(0, a.text.size(), a.text) > 0;
+    }
+};
+
+// std::less<int> that counts its calls in *calls, so a test can tell which
+// tree's comparator ran
+struct CountedLess
+{
+    explicit CountedLess(long* counter = NULL) : calls(counter) {}
+
+    bool operator()(int a, int b) const
+    {
+        ++*calls;
+        return a < b;
+    }
+
+    long* calls;
+};
+
+
+// Returns 1 if tree does not hold exactly model's items in order, walking
+// forwards and backwards; 0 otherwise.
+template<class Tree>
+int contentMismatch(Tree& tree, const std::map<int,int>& model)
+{
+    typename Tree::iterator it = tree.begin();
+    for(std::map<int,int>::const_iterator m = model.begin(); m != model.end(); ++m, ++it) {
+        if(it == tree.end() || it->first != m->first || it->second != m->second) {
+            return 1;
+        }
+    }
+    if(it != tree.end()) {
+        return 1;
+    }
+    typename Tree::reverse_iterator r = tree.rbegin();
+    for(std::map<int,int>::const_reverse_iterator m = model.rbegin(); m != model.rend(); ++m, ++r) {
+        if(r == tree.rend() || r->first != m->first) {
+            return 1;
+        }
+    }
+    return r != tree.rend() ? 1 : 0;
+}
+
+// Like contentMismatch(), but a tree that lost its balance is a mismatch too.
+template<class Tree>
+int mismatch(Tree& tree, const std::map<int,int>& model)
+{
+    return (contentMismatch(tree, model) != 0 || !tree.isBalanced()) ? 1 : 0;
+}
+
+// Fills tree and model with count random items whose keys are below range.
+template<class Tree>
+void fillRandom(Tree& tree, std::map<int,int>& model, int count, int range, std::mt19937& rng)
+{
+    for(int i = 0; i < count; ++i) {
+        int k = (int)(rng() % range);
+        int v = (int)(rng() % 1000);
+        tree.insertOrAssign(k, v);
+        model[k] = v;
+    }
+}
+
+// Runs unionWith(), intersectWith() and differenceWith() on random trees of
+// many size pairs (big pairs take the split-and-join path, lopsided ones the
+// item-by-item one) and checks each result against std::map. Returns the
+// number of mismatches.
+int setOperationMismatches(TaskPool& pool)
+{
+    const int sizes[][2] = { {3000, 3000}, {4000, 1500}, {3000, 40}, {40, 3000}, {200, 150}, {0, 100}, {100, 0} };
+    std::mt19937 rng(13);
+    int mismatches = 0;
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        for(int op = 0; op < 3; ++op) {
+            AVLTree<int,int> a, b;
+            std::map<int,int> ma, mb;
+            int range = 2 * std::max(sizes[s][0], sizes[s][1]) + 1;
+            fillRandom(a, ma, sizes[s][0], range, rng);
+            fillRandom(b, mb, sizes[s][1], range, rng);
+            if(op == 0) {
+                a.unionWith(std::move(b), pool);
+                for(std::map<int,int>::iterator it = mb.begin(); it != mb.end(); ++it) {
+                    ma[it->first] = it->second;
+                }
+            }
+            else if(op == 1) {
+                a.intersectWith(std::move(b), pool);
+                for(std::map<int,int>::iterator it = ma.begin(); it != ma.end(); ) {
+                    if(mb.count(it->first) == 0) {
+                        ma.erase(it++);
+                    }
+                    else {
+                        ++it;
+                    }
+                }
+            }
+            else {
+                a.differenceWith(std::move(b), pool);
+                for(std::map<int,int>::iterator it = mb.begin(); it != mb.end(); ++it) {
+                    ma.erase(it->first);
+                }
+            }
+            mismatches += mismatch(a, ma) + (b.empty() ? 0 : 1);
+        }
+    }
+    return mismatches;
+}
+
+// Splits a random order-statistic tree at random keys, changes both halves,
+// and joins them back in either order, checking the pieces, their ranks and
+// the rejoined tree against std::map. Returns the number of mismatches.
+int splitJoinMismatches()
+{
+    const int RANGE = 2000;
+    std::mt19937 rng(14);
+    AVLTree<int,int,true> tree;
+    std::map<int,int> model;
+    fillRandom(tree, model, 1000, RANGE, rng);
+    int mismatches = 0;
+    for(int round = 0; round < 300; ++round) {
+        int key = (int)(rng() % (RANGE + 1)); //0 and RANGE move everything or nothing
+        AVLTree<int,int,true> upper = tree.split(key);
+        std::map<int,int> upperModel(model.lower_bound(key), model.end());
+        model.erase(model.lower_bound(key), model.end());
+        mismatches += mismatch(tree, model) + mismatch(upper, upperModel);
+        if(!model.empty() && tree.select(model.size() / 2)->first != std::next(model.begin(), model.size() / 2)->first) {
+            ++mismatches;
+        }
+        if(!upperModel.empty() && upper.rank(upperModel.rbegin()->first) != upperModel.size() - 1) {
+            ++mismatches;
+        }
+
+        // Both halves keep working on their own, and must still join
+        int low = (int)(rng() % (key + 1)) - 1, high = key + (int)(rng() % (RANGE - key + 1));
+        if(low >= 0) {
+            tree.insertOrAssign(low, round);
+            model[low] = round;
+        }
+        upper.insertOrAssign(high, round);
+        upperModel[high] = round;
+        if(!upperModel.empty() && rng() % 2 == 0) {
+            upper.remove(upperModel.begin()->first);
+            upperModel.erase(upperModel.begin());
+        }
+        if(!model.empty() && !upperModel.empty()) {
+            AVLTree<int,int,true> overlap;
+            overlap.insert(std::make_pair(upperModel.begin()->first, 0));
+            overlap.insert(std::make_pair(model.begin()->first, 0));
+            try {
+                tree.join(std::move(overlap));
+                ++mismatches; //interleaving keys must be refused
+            }
+            catch(std::invalid_argument&) {
+            }
+        }
+        if(round % 2 == 0) {
+            tree.join(std::move(upper));
+        }
+        else {
+            upper.join(std::move(tree));
+            tree = std::move(upper);
+        }
+        model.insert(upperModel.begin(), upperModel.end());
+        mismatches += mismatch(tree, model) + (upper.empty() ? 0 : 1);
+    }
+
+    // Joining into an empty tree takes other's nodes but keeps this tree's
+    // comparator and rememberInserts(), so appends then cost about one
+    // comparison each, all of them counted by this tree's comparator
+    const int N = 2000;
+    long ownCalls = 0, otherCalls = 0;
+    AVLTree<int,int,true,CountedLess> empty((CountedLess(&ownCalls)));
+    AVLTree<int,int,true,CountedLess> full((CountedLess(&otherCalls)));
+    empty.rememberInserts(true);
+    model.clear();
+    for(int i = 0; i < N; ++i) {
+        full.insert(std::make_pair(i, i));
+        model[i] = i;
+    }
+    empty.join(std::move(full));
+    mismatches += mismatch(empty, model) + (full.empty() ? 0 : 1);
+    ownCalls = otherCalls = 0;
+    for(int i = N; i < 2 * N; ++i) {
+        empty.insert(std::make_pair(i, i));
+        model[i] = i;
+    }
+    if(otherCalls != 0 || ownCalls > 3 * N) {
+        ++mismatches;
+    }
+    ownCalls = 0;
+    full.insert(std::make_pair(1, 1)); // the emptied tree still has its own comparator
+    full.insert(std::make_pair(2, 2));
+    mismatches += (otherCalls == 0 || ownCalls != 0) ? 1 : 0;
+    return mismatches + mismatch(empty, model);
+}
+
+// Applies random unsorted batches, with repeated keys, of sizes both below
+// and above the point where batches are split across pool, and checks the
+// tree against std::map after each. Returns the number of mismatches.
+template<bool CountSizes>
+int batchMismatches(TaskPool& pool)
+{
+    const int sizes[] = { 0, 1, 7, 300, 5000, 20000 };
+    std::mt19937 rng(21);
+    AVLTree<int,int,CountSizes> tree;
+    std::map<int,int> model;
+    int mismatches = 0;
+    for(int round = 0; round < 3; ++round) {
+        for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+            std::vector<BatchOp<int,int> > batch;
+            int range = 2 * sizes[s] + 10;
+            for(int i = 0; i < sizes[s]; ++i) {
+                int k = (int)(rng() % range);
+                if(rng() % 3 == 0) {
+                    batch.push_back(BatchOp<int,int>::erase(k));
+                    model.erase(k);
+                }
+                else {
+                    batch.push_back(BatchOp<int,int>::upsert(k, i));
+                    model[k] = i;
+                }
+            }
+            if(round == 1) { //already sorted, which skips the sort
+                std::stable_sort(batch.begin(), batch.end(), [](const BatchOp<int,int>& x, const BatchOp<int,int>& y) {
+                    return x.item.first < y.item.first;
+                });
+            }
+            tree.applyBatch(batch, pool);
+            mismatches += mismatch(tree, model);
+        }
+    }
+    return mismatches;
+}
+
+// Runs a random sequence of inserts, hinted inserts, removes and erases on a
+// RedBlackTree and on std::map side by side, checking the red-black rules and
+// the contents as it goes, and after a bulk assign and a snapshot round trip.
+// Returns the number of mismatches.
+int redBlackMismatches()
+{
+    const int RANGE = 3000;
+    std::mt19937 rng(25);
+    RedBlackTree<int,int> tree;
+    std::map<int,int> model;
+    int mismatches = 0;
+    for(int step = 1; step <= 20000; ++step) {
+        int k = (int)(rng() % RANGE);
+        switch(rng() % 6) {
+        case 0:
+            tree.insert(std::make_pair(k, step));
+            model[k] = step;
+            break;
+        case 1:
+            tree.insertOrAssign(k, step);
+            model[k] = step;
+            break;
+        case 2:
+            tree.insert(tree.lowerBound(k), std::make_pair(k, step));
+            model[k] = step;
+            break;
+        case 3:
+            tree.remove(k);
+            model.erase(k);
+            break;
+        case 4: {
+            RedBlackTree<int,int>::iterator it = tree.lowerBound(k);
+            std::map<int,int>::iterator m = model.lower_bound(k);
+            if((it == tree.end()) != (m == model.end()) || (it != tree.end() && it->first != m->first)) {
+                ++mismatches;
+            }
+            else if(it != tree.end()) {
+                tree.erase(it);
+                model.erase(m);
+            }
+            break;
+        }
+        default: {
+            int hi = k + (int)(rng() % 20);
+            tree.erase(tree.lowerBound(k), tree.lowerBound(hi));
+            model.erase(model.lower_bound(k), model.lower_bound(hi));
+        }
+        }
+        if(step % 500 == 0) {
+            mismatches += mismatch(tree, model);
+        }
+    }
+
+    // assign() and isBalanced() through a base reference still follow the red-black rules
+    RedBlackTree<int,int> assigned;
+    BinarySearchTree<int,int,RBNode<int,int> >& base = assigned;
+    base.assign(model.begin(), model.end());
+    mismatches += mismatch(base, model);
+    for(int k = RANGE; k < RANGE + 100; ++k) {
+        base.insert(std::make_pair(k, k));
+        model[k] = k;
+    }
+    mismatches += mismatch(base, model);
+    for(int k = RANGE; k < RANGE + 100; ++k) {
+        assigned.remove(k);
+        model.erase(k);
+    }
+    std::stringstream snapshot;
+    tree.save(snapshot);
+    RedBlackTree<int,int> restored;
+    restored.load(snapshot);
+    mismatches += mismatch(restored, model);
+    restored.insert(std::make_pair(RANGE, 0));
+    model[RANGE] = 0;
+    mismatches += mismatch(restored, model);
+    return mismatches;
+}
+
+// Appends increasing keys to a plain BST with rememberInserts() on, then
+// decreasing keys through hints, and checks that each append past an end
+// costs one comparison even though the tree is a single path. Then pops both
+// ends like a queue while appending, so the ends have to be kept up to date
+// by removals too. Returns the number of mismatches.
+int appendMismatches()
+{
+    const int N = 20000;
+    typedef BinarySearchTree<int,int,Node<int,int>,std::less<int>,CountingStats> CountedBST;
+    CountedBST tree;
+    std::map<int,int> model;
+    tree.rememberInserts(true);
+    for(int i = 0; i < N; ++i) {
+        tree.insert(std::make_pair(i, i));
+        model[i] = i;
+    }
+    CountedBST::iterator hint = tree.begin();
+    for(int i = 1; i <= N; ++i) {
+        hint = tree.insert(hint, std::make_pair(-i, i));
+        model[-i] = i;
+    }
+    int mismatches = tree.stats().comparisons > (uint64_t)2 * N ? 1 : 0;
+    for(int i = 0; i < 1000; ++i) {
+        tree.remove(model.begin()->first);
+        model.erase(model.begin());
+        tree.erase(tree.find(model.rbegin()->first));
+        model.erase(--model.end());
+        tree.insert(tree.end(), std::make_pair(N + i, i));
+        model[N + i] = i;
+        if(tree.begin()->first != model.begin()->first || tree.rbegin()->first != model.rbegin()->first) {
+            ++mismatches;
+        }
+    }
+    return mismatches + contentMismatch(tree, model);
+}
+
+// An AVLTree that lets the snapshot test walk its nodes.
+template<bool CountSizes>
+class InspectableAVLTree : public AVLTree<int,int,CountSizes>
+{
+public:
+    const AVLNode<int,int,CountSizes>* root() const { return this->root_; }
+};
+
+// Walks a and b in step and returns the height of a's subtree, or -1 if they
+// differ anywhere in shape, items, stored height or subtree size, or if a
+// stored height is not the real height of its subtree.
+template<bool CountSizes>
+int sameShape(const AVLNode<int,int,CountSizes>* a, const AVLNode<int,int,CountSizes>* b)
+{
+    if(a == NULL || b == NULL) {
+        return a == b ? 0 : -1;
+    }
+    int left = sameShape(a->getLeft(), b->getLeft());
+    int right = sameShape(a->getRight(), b->getRight());
+    if(left < 0 || right < 0 || a->getKey() != b->getKey() || a->getValue() != b->getValue() ||
+       a->getBalance() != b->getBalance() || a->getSize() != b->getSize() ||
+       a->getBalance() != 1 + std::max(left, right)) {
+        return -1;
+    }
+    return 1 + std::max(left, right);
+}
+
+// Returns 1 unless loading bytes into a fresh AVLTree<LKey,LValue> throws
+// std::runtime_error and leaves the tree empty and still usable.
+template<class LKey, class LValue>
+int acceptsBadSnapshot(const std::string& bytes)
+{
+    AVLTree<LKey,LValue> tree;
+    tree.insert(std::make_pair(LKey(), LValue()));
+    std::stringstream in(bytes);
+    try {
+        tree.load(in);
+    }
+    catch(std::runtime_error&) {
+        if(!tree.empty()) {
+            return 1;
+        }
+        tree.insert(std::make_pair(LKey(), LValue()));
+        return tree.find(LKey()) != tree.end() && ++tree.begin() == tree.end() ? 0 : 1;
+    }
+    return 1;
+}
+
+// Saves random AVL trees of several sizes, with and without subtree sizes,
+// and checks that load() brings back the same shape with the same stored
+// heights and sizes, node by node. Then feeds load() snapshots that are
+// corrupt, truncated, from another kind of tree or for other types, which
+// must all be refused. Returns the number of mismatches.
+template<bool CountSizes>
+int avlSnapshotMismatches()
+{
+    const int sizes[] = { 0, 1, 2, 5, 100, 3000 };
+    std::mt19937 rng(23);
+    int mismatches = 0;
+    std::string bytes;
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        InspectableAVLTree<CountSizes> tree;
+        std::map<int,int> model;
+        fillRandom(tree, model, sizes[s], 4 * sizes[s] + 1, rng);
+        for(int i = 0; i < sizes[s] / 3; ++i) { // removals leave shapes an insert-only tree never has
+            int k = (int)(rng() % (4 * sizes[s] + 1));
+            tree.remove(k);
+            model.erase(k);
+        }
+        std::stringstream out;
+        tree.save(out);
+        bytes = out.str();
+        InspectableAVLTree<CountSizes> restored;
+        restored.load(out);
+        mismatches += mismatch(restored, model);
+        mismatches += sameShape<CountSizes>(restored.root(), tree.root()) < 0 ? 1 : 0;
+        mismatches += out.peek() != std::char_traits<char>::eof() ? 1 : 0; // left just past the snapshot
+    }
+
+    // bytes holds the biggest snapshot: "BSTS", version (4 bytes), kind (1),
+    // key and value sizes (4 each), the nodes, an end byte and the count (8)
+    const size_t HEADER = 17;
+    std::string bad = bytes;
+    bad[0] = 'X';
+    mismatches += acceptsBadSnapshot<int,int>(bad);
+    bad = bytes;
+    bad[4] ^= 0x40; // version
+    mismatches += acceptsBadSnapshot<int,int>(bad);
+    bad = bytes;
+    bad[8] = 0; // a plain BinarySearchTree's shape
+    mismatches += acceptsBadSnapshot<int,int>(bad);
+    bad = bytes;
+    bad[HEADER] = (char)0x43; // a node byte with an unknown flag
+    mismatches += acceptsBadSnapshot<int,int>(bad);
+    bad = bytes;
+    bad[bytes.size() - 8] ^= 1; // the count
+    mismatches += acceptsBadSnapshot<int,int>(bad);
+    const size_t cuts[] = { 0, 3, 10, HEADER, HEADER + 5, bytes.size() / 2, bytes.size() - 9, bytes.size() - 1 };
+    for(size_t c = 0; c < sizeof(cuts) / sizeof(cuts[0]); ++c) {
+        mismatches += acceptsBadSnapshot<int,int>(bytes.substr(0, cuts[c]));
+    }
+    mismatches += acceptsBadSnapshot<long long,int>(bytes) + acceptsBadSnapshot<int,double>(bytes);
+
+    // A real snapshot of a red-black tree
+    RedBlackTree<int,int> rb;
+    for(int i = 0; i < 100; ++i) {
+        rb.insert(std::make_pair(i, i));
+    }
+    std::stringstream rbOut;
+    rb.save(rbOut);
+    mismatches += acceptsBadSnapshot<int,int>(rbOut.str());
+    return mismatches;
+}
+
+// Runs random inserts (plain, hinted, emplaced and assigning), removes and
+// erases on a CompactAVLTree big enough to span several CHUNK_NODES chunks,
+// draining and refilling it so freed slots are reused, and checks it against
+// std::map along the way, then round trips it through an AVLTree snapshot.
+// Returns the number of mismatches.
+int compactMismatches()
+{
+    const int RANGE = 30000;
+    typedef CompactAVLTree<int,int> Compact;
+    std::mt19937 rng(19);
+    Compact tree;
+    std::map<int,int> model;
+    int mismatches = 0;
+    for(int step = 1; step <= 80000; ++step) {
+        int k = (int)(rng() % RANGE);
+        bool draining = step > 40000 && step <= 60000; // removes win until the tree is nearly empty
+        switch(rng() % (draining ? 8 : 6)) {
+        case 0:
+            tree.insert(std::make_pair(k, step));
+            model[k] = step;
+            break;
+        case 1:
+            if(tree.tryEmplace(k, step).second != (model.count(k) == 0)) {
+                ++mismatches;
+            }
+            model.insert(std::make_pair(k, step));
+            break;
+        case 2:
+            tree.insert(tree.lowerBound(k), std::make_pair(k, step));
+            model[k] = step;
+            break;
+        case 3:
+            tree.insertOrAssign(k, step);
+            model[k] = step;
+            break;
+        case 4: {
+            Compact::iterator it = tree.find(k);
+            if((it == tree.end()) != (model.count(k) == 0)) {
+                ++mismatches;
+            }
+            else if(it != tree.end()) {
+                tree.erase(it);
+                model.erase(k);
+            }
+            break;
+        }
+        default: {
+            int hi = k + (int)(rng() % 16);
+            tree.erase(tree.lowerBound(k), tree.lowerBound(hi));
+            model.erase(model.lower_bound(k), model.lower_bound(hi));
+        }
+        }
+        if(step % 4000 == 0) {
+            mismatches += mismatch(tree, model);
+            mismatches += tree.size() != model.size() ? 1 : 0;
+        }
+    }
+    mismatches += mismatch(tree, model);
+
+    // Appending through end() hints, and lookups on, between and past the keys
+    for(int k = RANGE; k < RANGE + 3000; ++k) {
+        tree.insert(tree.end(), std::make_pair(k, k));
+        model[k] = k;
+    }
+    mismatches += mismatch(tree, model);
+    for(int k = -1; k <= RANGE + 3001; ++k) {
+        Compact::iterator it = tree.lowerBound(k);
+        std::map<int,int>::iterator m = model.lower_bound(k);
+        if((it == tree.end()) != (m == model.end()) || (it != tree.end() && it->first != m->first)) {
+            ++mismatches;
+        }
+        if((tree.find(k) == tree.end()) != (model.count(k) == 0)) {
+            ++mismatches;
+        }
+    }
+
+    // Snapshots move between CompactAVLTree and AVLTree either way
+    std::stringstream out;
+    tree.save(out);
+    AVLTree<int,int> avl;
+    avl.load(out);
+    mismatches += mismatch(avl, model);
+    std::stringstream back;
+    avl.save(back);
+    Compact restored;
+    restored.load(back);
+    mismatches += mismatch(restored, model);
+    return mismatches + (restored.size() != model.size() ? 1 : 0);
+}
+
+// Fills a tree with random words over "abc" and checks equalRange() against
+// std::map: for every prefix of up to four letters (the empty one included),
+// the range must hold exactly the words that start with it, and for whole
+// words at most the word itself. Returns the number of mismatches.
+int equalRangeMismatches()
+{
+    typedef AVLTree<std::string,int,false,PrefixLess> Words;
+    std::mt19937 rng(15);
+    Words tree;
+    std::map<std::string,int> model;
+    for(int i = 0; i < 300; ++i) {
+        std::string word(1 + rng() % 4, 'a');
+        for(size_t c = 0; c < word.size(); ++c) {
+            word[c] = (char)('a' + rng() % 3);
+        }
+        tree.insertOrAssign(word, i);
+        model[word] = i;
+    }
+    std::vector<std::string> probes(1, std::string());
+    for(size_t p = 0; p < probes.size() && probes[p].size() < 4; ++p) {
+        for(char c = 'a'; c <= 'd'; ++c) { // 'd' never appears, so some ranges are empty
+            probes.push_back(probes[p] + c);
+        }
+    }
+    int mismatches = 0;
+    for(size_t p = 0; p < probes.size(); ++p) {
+        Prefix prefix = { probes[p] };
+        std::pair<Words::iterator, Words::iterator> range = tree.equalRange(prefix);
+        std::map<std::string,int>::iterator m = model.lower_bound(probes[p]);
+        for(; m != model.end() && m->first.compare(0, probes[p].size(), probes[p]) == 0; ++m, ++range.first) {
+            if(range.first == range.second || range.first->first != m->first) {
+                ++mismatches;
+                break;
+            }
+        }
+        if(range.first != range.second) {
+            ++mismatches;
+        }
+        std::pair<Words::iterator, Words::iterator> exact = tree.equalRange(probes[p]);
+        size_t count = (size_t)std::distance(exact.first, exact.second);
+        if(count != model.count(probes[p]) || (count == 1 && exact.first->first != probes[p])) {
+            ++mismatches;
+        }
+    }
+    return mismatches;
+}
+
+// Returns 1 unless the arrays frozen.save() writes are in Eytzinger order:
+// walking the implicit tree over slots 1..n in order, with the children of
+// slot k in slots 2k and 2k + 1, must give model's keys and values in order.
+int eytzingerMismatch(const FrozenTree<int,int>& frozen, const std::map<int,int>& model)
+{
+    std::stringstream file;
+    frozen.save(file);
+    std::string bytes = file.str();
+    FrozenTree<int,int>::FileHeader header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    const size_t n = model.size();
+    if(header.count != n || bytes.size() != header.valuesOffset + n * sizeof(int)) {
+        return 1;
+    }
+    std::vector<int> keys(n + 1), values(n + 1); // 1-based, like the slots
+    std::memcpy(&keys[1], bytes.data() + header.keysOffset, n * sizeof(int));
+    std::memcpy(&values[1], bytes.data() + header.valuesOffset, n * sizeof(int));
+    std::vector<size_t> pending;
+    std::map<int,int>::const_iterator m = model.begin();
+    size_t slot = 1;
+    while(slot <= n || !pending.empty()) {
+        for(; slot <= n; slot *= 2) {
+            pending.push_back(slot);
+        }
+        slot = pending.back();
+        pending.pop_back();
+        if(keys[slot] != m->first || values[slot] != m->second) {
+            return 1;
+        }
+        ++m;
+        slot = 2 * slot + 1;
+    }
+    return 0;
+}
+
+// Freezes AVL trees of many sizes, perfect (2^k - 1) and not, and checks
+// each snapshot against std::map: its size, iteration, Eytzinger layout, and
+// find() and lowerBound() for probes on every key, between neighbouring keys
+// and past both ends. Returns the number of mismatches.
+int frozenMismatches()
+{
+    const int sizes[] = { 0, 1, 2, 3, 4, 6, 7, 8, 15, 16, 17, 100, 1000, 1023, 1024, 4097 };
+    std::mt19937 rng(10);
+    int mismatches = 0;
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        const int n = sizes[s];
+        AVLTree<int,int> tree;
+        std::map<int,int> model;
+        for(int i = 0; i < n; ++i) { // keys 1, 4, 7, ..., so 3i and 3i + 2 fall between them
+            int v = (int)(rng() % 1000);
+            tree.insert(std::make_pair(3 * i + 1, v));
+            model[3 * i + 1] = v;
+        }
+        FrozenTree<int,int> frozen = tree.freeze();
+        if(frozen.size() != model.size() || frozen.empty() != model.empty()) {
+            ++mismatches;
+        }
+        FrozenTree<int,int>::iterator it = frozen.begin();
+        for(std::map<int,int>::iterator m = model.begin(); m != model.end(); ++m, ++it) {
+            if(it == frozen.end() || it->first != m->first || it->second != m->second) {
+                ++mismatches;
+                break;
+            }
+        }
+        mismatches += eytzingerMismatch(frozen, model);
+        for(int k = -2; k <= 3 * n + 2; ++k) {
+            FrozenTree<int,int>::iterator found = frozen.find(k);
+            std::map<int,int>::iterator m = model.find(k);
+            if((found == frozen.end()) != (m == model.end()) || (m != model.end() && found->second != m->second)) {
+                ++mismatches;
+            }
+            FrozenTree<int,int>::iterator bound = frozen.lowerBound(k);
+            m = model.lower_bound(k);
+            if((bound == frozen.end()) != (m == model.end()) || (m != model.end() && bound->first != m->first)) {
+                ++mismatches;
+            }
+        }
+    }
+    return mismatches;
+}
+
+// Makes a new, empty directory for test files under $TMPDIR (or /tmp) and
+// returns its path.
+std::string makeTempDir()
+{
+    const char* base = std::getenv("TMPDIR");
+    std::string pattern = std::string(base != NULL && *base != '\0' ? base : "/tmp") + "/bst-test-XXXXXX";
+    std::vector<char> name(pattern.begin(), pattern.end());
+    name.push_back('\0');
+    if(mkdtemp(&name[0]) == NULL) {
+        throw std::runtime_error("Could not create a directory under " + pattern);
+    }
+    return std::string(&name[0]);
+}
+
+// Writes bytes to a new file at path.
+void writeFile(const std::string& path, const std::string& bytes)
+{
+    std::ofstream out(path.c_str(), std::ios::binary);
+    out.write(bytes.data(), bytes.size());
+}
+
+// Returns 1 unless opening path as a MappedTree<MKey,int> throws std::runtime_error.
+template<class MKey>
+int acceptsBadFile(const std::string& path)
+{
+    try {
+        MappedTree<MKey,int> mapped(path);
+    }
+    catch(std::runtime_error&) {
+        return 0;
+    }
+    return 1;
+}
+
+// Saves frozen snapshots of several sizes into files in a fresh temporary
+// directory, maps them, and checks each MappedTree against std::map: its
+// size, iteration, and find(), lowerBound() and operator[] for probes on,
+// between and past the keys. Then checks that truncated files, a file with
+// the wrong magic and one read with the wrong key size are refused with
+// std::runtime_error. Returns the number of mismatches.
+int mappedMismatches()
+{
+    const int sizes[] = { 0, 1, 7, 1000 };
+    std::mt19937 rng(24);
+    std::string dir = makeTempDir();
+    std::string path = dir + "/frozen.bin";
+    int mismatches = 0;
+    std::string saved;
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        const int n = sizes[s];
+        std::map<int,int> model;
+        for(int i = 0; i < n; ++i) {
+            model[3 * i + 1] = (int)(rng() % 1000);
+        }
+        std::stringstream file;
+        FrozenTree<int,int>(model.begin(), model.end()).save(file);
+        saved = file.str();
+        writeFile(path, saved);
+
+        MappedTree<int,int> mapped(path);
+        if(mapped.size() != model.size() || mapped.empty() != model.empty()) {
+            ++mismatches;
+        }
+        MappedTree<int,int>::iterator it = mapped.begin();
+        for(std::map<int,int>::iterator m = model.begin(); m != model.end(); ++m, ++it) {
+            if(it == mapped.end() || it->first != m->first || it->second != m->second) {
+                ++mismatches;
+                break;
+            }
+        }
+        for(int k = -2; k <= 3 * n + 2; ++k) {
+            MappedTree<int,int>::iterator found = mapped.find(k);
+            std::map<int,int>::iterator m = model.find(k);
+            if((found == mapped.end()) != (m == model.end()) ||
+               (m != model.end() && (found->second != m->second || mapped[k] != m->second))) {
+                ++mismatches;
+            }
+            MappedTree<int,int>::iterator bound = mapped.lowerBound(k);
+            m = model.lower_bound(k);
+            if((bound == mapped.end()) != (m == model.end()) || (m != model.end() && bound->first != m->first)) {
+                ++mismatches;
+            }
+        }
+    }
+
+    // saved now holds the biggest snapshot; cut it short in the header, in the keys and in the values
+    const size_t cuts[] = { 0, 10, 70, saved.size() / 2, saved.size() - 1 };
+    for(size_t c = 0; c < sizeof(cuts) / sizeof(cuts[0]); ++c) {
+        writeFile(path, saved.substr(0, cuts[c]));
+        mismatches += acceptsBadFile<int>(path);
+    }
+    std::string badMagic = saved;
+    badMagic[0] = 'X';
+    writeFile(path, badMagic);
+    mismatches += acceptsBadFile<int>(path);
+    writeFile(path, saved);
+    mismatches += acceptsBadFile<char>(path) + acceptsBadFile<double>(path);
+    mismatches += acceptsBadFile<int>(dir + "/missing.bin");
+
+    std::remove(path.c_str());
+    std::remove(dir.c_str());
+    return mismatches;
+}
+
+// Compares a BPlusTree with std::map: iteration, size(), and find() and
+// lowerBound() for probes on, between and past the keys. Returns 1 on any
+// difference.
+template<class Key>
+int bplusDiffers(const BPlusTree<Key,int>& tree, const std::map<Key,int>& model, Key probeStep, int probes)
+{
+    typename BPlusTree<Key,int>::iterator it = tree.begin();
+    for(typename std::map<Key,int>::const_iterator m = model.begin(); m != model.end(); ++m, ++it) {
+        if(it == tree.end() || it->first != m->first || it->second != m->second) {
+            return 1;
+        }
+    }
+    if(it != tree.end() || tree.size() != model.size() || tree.empty() != model.empty()) {
+        return 1;
+    }
+    for(int i = -2; i < probes + 2; ++i) {
+        Key probe = probeStep * i;
+        typename BPlusTree<Key,int>::iterator found = tree.find(probe);
+        typename std::map<Key,int>::const_iterator expected = model.find(probe);
+        if((found == tree.end()) != (expected == model.end()) || (found != tree.end() && found->second != expected->second)) {
+            return 1;
+        }
+        typename BPlusTree<Key,int>::iterator lb = tree.lowerBound(probe);
+        expected = model.lower_bound(probe);
+        if((lb == tree.end()) != (expected == model.end()) || (lb != tree.end() && lb->first != expected->first)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Grows a BPlusTree to thousands of keys with random inserts and removes, so
+// leaves and inner nodes split, borrow and merge, then empties it again so the
+// root collapses, checking it against std::map all along. keyStep spaces the
+// keys; probes land on them and halfway between. Returns the number of mismatches.
+template<class Key>
+int bplusMismatches(Key keyStep)
+{
+    const int RANGE = 8000;
+    std::mt19937 rng(11);
+    BPlusTree<Key,int> tree;
+    std::map<Key,int> model;
+    int mismatches = 0;
+    for(int step = 1; step <= 60000; ++step) {
+        Key k = keyStep * (int)(rng() % RANGE);
+        if(step > 45000 || rng() % 3 == 0) { //the last quarter only removes
+            tree.remove(k);
+            model.erase(k);
+        }
+        else if(model.count(k) != 0 && rng() % 2 == 0) { //operator[] only reaches existing keys
+            tree[k] = step;
+            model[k] = step;
+        }
+        else {
+            tree.insert(std::make_pair(k, step));
+            model[k] = step;
+        }
+        if(step % 5000 == 0) {
+            mismatches += bplusDiffers(tree, model, keyStep / 2, 2 * RANGE);
+        }
+    }
+    for(typename std::map<Key,int>::iterator m = model.begin(); m != model.end(); ++m) {
+        tree.remove(m->first);
+    }
+    model.clear();
+    mismatches += bplusDiffers(tree, model, keyStep / 2, 16);
+    for(int i = 0; i < RANGE; ++i) { //increasing keys split the rightmost nodes only
+        tree.insert(std::make_pair(keyStep * i, i));
+        model[keyStep * i] = i;
+    }
+    return mismatches + bplusDiffers(tree, model, keyStep / 2, 2 * RANGE);
+}
+
+// Hammers one ConcurrentAVLTree from four threads. Even keys are inserted up
+// front and never changed, so every read of one must find it, and every walk
+// must pass it in order; each thread inserts and removes its own share of the
+// odd keys, so the final contents are known. Returns the number of mismatches.
+int concurrentMismatches()
+{
+    const int KEYS = 4000, THREADS = 4, ROUNDS = 20000;
+    ConcurrentAVLTree<int,int> tree;
+    for(int k = 0; k < KEYS; k += 2) {
+        tree.insert(std::make_pair(k, k));
+    }
+    std::atomic<int> mismatches(0);
+    std::vector<std::map<int,int> > owned(THREADS);
+    std::vector<std::thread> threads;
+    for(int t = 0; t < THREADS; ++t) {
+        threads.push_back(std::thread([&, t]() {
+            std::mt19937 rng(t + 1);
+            std::map<int,int>& mine = owned[t];
+            for(int round = 0; round < ROUNDS; ++round) {
+                int k = (int)(rng() % (KEYS / 2 / THREADS)) * 2 * THREADS + 2 * t + 1; //an odd key of this thread
+                int stable = (int)(rng() % (KEYS / 2)) * 2;
+                switch(rng() % 4) {
+                case 0:
+                    tree.insert(std::make_pair(k, round));
+                    mine[k] = round;
+                    break;
+                case 1:
+                    tree.remove(k);
+                    mine.erase(k);
+                    break;
+                case 2: {
+                    ConcurrentAVLTree<int,int>::iterator it = tree.find(stable);
+                    ConcurrentAVLTree<int,int>::iterator own = tree.find(k);
+                    if(it == tree.end() || it->second != stable
+                       || (own != tree.end()) != (mine.count(k) != 0) || (own != tree.end() && own->second != mine[k])) {
+                        ++mismatches;
+                    }
+                    break;
+                }
+                default: {
+                    int expect = stable;
+                    for(ConcurrentAVLTree<int,int>::iterator it = tree.lowerBound(stable); it != tree.end() && expect < stable + 64; ++it) {
+                        if(it->first > expect) { //stepped past an even key that never left
+                            ++mismatches;
+                            break;
+                        }
+                        if(it->first == expect) {
+                            expect += 2;
+                        }
+                    }
+                }
+                }
+            }
+        }));
+    }
+    for(int t = 0; t < THREADS; ++t) {
+        threads[t].join();
+    }
+
+    std::map<int,int> expected;
+    for(int k = 0; k < KEYS; k += 2) {
+        expected[k] = k;
+    }
+    for(int t = 0; t < THREADS; ++t) {
+        expected.insert(owned[t].begin(), owned[t].end());
+    }
+    std::map<int,int>::iterator e = expected.begin();
+    for(ConcurrentAVLTree<int,int>::iterator it = tree.begin(); it != tree.end(); ++it, ++e) {
+        if(e == expected.end() || it->first != e->first || it->second != e->second) {
+            return mismatches + 1;
+        }
+    }
+    if(e != expected.end() || tree.size() != expected.size()) {
+        ++mismatches;
+    }
+    return mismatches;
+}
+
 
 int main(int argc, char *argv[])
 {
+    int failures = 0;
+
     // Binary Search Tree tests
     BinarySearchTree<char,int> bt;
     bt.insert(std::make_pair('a',1));
@@ -44,5 +1027,249 @@ int main(int argc, char *argv[])
     cout << "Erasing b" << endl;
     at.remove('b');
 
-    return 0;
+    // Single-descent insert variants
+    std::pair<AVLTree<char,int>::iterator, bool> res = at.tryEmplace('a', 5);
+    cout << "\ntryEmplace a: inserted=" << res.second << " value=" << res.first->second << endl;
+    res = at.insertOrAssign('a', 5);
+    cout << "insertOrAssign a: inserted=" << res.second << " value=" << res.first->second << endl;
+    res = at.tryEmplace('c', 3);
+    cout << "tryEmplace c: inserted=" << res.second << " value=" << res.first->second << endl;
+
+    // Bulk load from a sorted range
+    std::map<char,int> sorted;
+    for(char c = 'a'; c <= 'g'; ++c) {
+        sorted[c] = c - 'a';
+    }
+    AVLTree<char,int> bulk(sorted.begin(), sorted.end());
+    cout << "\nBulk-loaded AVLTree is balanced: " << bulk.isBalanced() << endl;
+    bulk.print();
+
+    // Moving trees and values
+    AVLTree<char,int> moved(std::move(bulk));
+    moved.emplace('h', 7);
+    cout << "Moved-from tree is empty: " << bulk.empty() << ", h -> " << moved['h'] << endl;
+
+    // Range queries
+    AVLTree<char,int>::iterator lb = moved.lowerBound('c');
+    cout << "\nlowerBound c: " << lb->first << ", upperBound c: " << moved.upperBound('c')->first << endl;
+    cout << "Keys in [b, e):";
+    moved.rangeScan('b', 'e', PrintKey());
+    cout << endl;
+
+    // Order statistics
+    AVLTree<char,int,true> ranked(sorted.begin(), sorted.end());
+    cout << "\nselect(2): " << ranked.select(2)->first << ", rank(e): " << ranked.rank('e')
+         << ", countInRange(b, f): " << ranked.countInRange('b', 'f') << endl;
+
+    // Bulk set operations
+    AVLTree<char,int> evens, vowels;
+    for(char c = 'a'; c <= 'z'; c += 2) {
+        evens.insert(std::make_pair(c, 0));
+    }
+    vowels.insert(std::make_pair('a', 1));
+    vowels.insert(std::make_pair('e', 1));
+    vowels.insert(std::make_pair('u', 1));
+    vowels.insert(std::make_pair('z', 1));
+    evens.unionWith(std::move(vowels));
+    cout << "\nunionWith:";
+    for(AVLTree<char,int>::iterator it = evens.begin(); it != evens.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << "\nresult is balanced: " << evens.isBalanced() << ", other is empty: " << vowels.empty() << endl;
+    TaskPool onePool(1), fourPool(4);
+    int setOps = setOperationMismatches(onePool) + setOperationMismatches(fourPool);
+    failures += setOps;
+    cout << "random set operations on 1 and 4 threads: " << (setOps == 0 ? "match std::map" : "MISMATCH") << endl;
+
+    // Splitting and joining by key
+    AVLTree<char,int> upper = evens.split('m');
+    cout << "split at m: lower has m: " << (evens.find('m') != evens.end()) << ", upper starts at " << upper.begin()->first << endl;
+    evens.join(std::move(upper));
+    cout << "joined back, balanced: " << evens.isBalanced() << ", has y: " << (evens.find('y') != evens.end()) << endl;
+    int splits = splitJoinMismatches();
+    failures += splits;
+    cout << "random splits and joins: " << (splits == 0 ? "match std::map" : "MISMATCH") << endl;
+
+    // Upserts and erases applied in one pass; the last operation on a key wins
+    std::vector<BatchOp<char,int> > batch;
+    batch.push_back(BatchOp<char,int>::upsert('b', 7));
+    batch.push_back(BatchOp<char,int>::erase('c'));
+    batch.push_back(BatchOp<char,int>::upsert('y', 3));
+    batch.push_back(BatchOp<char,int>::erase('y'));
+    batch.push_back(BatchOp<char,int>::upsert('a', 9));
+    evens.applyBatch(batch);
+    cout << "applyBatch:";
+    for(AVLTree<char,int>::iterator it = evens.begin(); it != evens.end() && it->first < 'g'; ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << "\nhas y: " << (evens.find('y') != evens.end()) << ", balanced: " << evens.isBalanced() << endl;
+    int batches = batchMismatches<false>(onePool) + batchMismatches<false>(fourPool) + batchMismatches<true>(fourPool);
+    failures += batches;
+    cout << "random batches on 1 and 4 threads: " << (batches == 0 ? "match std::map" : "MISMATCH") << endl;
+
+    // Inserts that start from a nearby node instead of the root
+    AVLTree<int,int> appended;
+    AVLTree<int,int>::iterator last = appended.end();
+    for(int i = 1; i <= 5; ++i) {
+        last = appended.insert(last, std::make_pair(i * 10, i));
+    }
+    appended.rememberInserts(true);
+    for(int i = 6; i <= 9; ++i) {
+        appended.insert(std::make_pair(i * 10, i));
+    }
+    cout << "hinted and remembered appends:";
+    for(AVLTree<int,int>::iterator it = appended.begin(); it != appended.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << ", balanced: " << appended.isBalanced() << endl;
+    int appends = appendMismatches();
+    failures += appends;
+    cout << "sorted appends to a plain BST: " << (appends == 0 ? "one comparison each, match std::map" : "MISMATCH") << endl;
+
+    // Binary snapshots, restored in the same shape without rebalancing
+    std::stringstream snapshot;
+    appended.save(snapshot);
+    AVLTree<int,int> restored;
+    restored.load(snapshot);
+    cout << "restored snapshot:";
+    for(AVLTree<int,int>::iterator it = restored.begin(); it != restored.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << endl;
+    restored.print();
+    int snapshots = avlSnapshotMismatches<false>() + avlSnapshotMismatches<true>();
+    failures += snapshots;
+    cout << "AVL snapshots: " << (snapshots == 0 ? "same shape and heights after load, bad snapshots refused" : "MISMATCH") << endl;
+
+    // Frozen snapshot
+    FrozenTree<char,int> frozen = moved.freeze();
+    cout << "\nFrozen snapshot:";
+    for(FrozenTree<char,int>::iterator it = frozen.begin(); it != frozen.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << endl;
+    int frozenRandom = frozenMismatches();
+    failures += frozenRandom;
+    cout << "frozen snapshots of many sizes: " << (frozenRandom == 0 ? "match std::map" : "MISMATCH") << endl;
+
+    // Snapshots served from memory-mapped files
+    int mappedRandom = mappedMismatches();
+    failures += mappedRandom;
+    cout << "mapped snapshots: " << (mappedRandom == 0 ? "match std::map, bad files refused" : "MISMATCH") << endl;
+
+    // B+tree with the same surface
+    BPlusTree<char,int> bp;
+    for(char c = 'a'; c <= 'z'; ++c) {
+        bp.insert(std::make_pair(c, c - 'a'));
+    }
+    bp.remove('m');
+    cout << "\nBPlusTree find q: " << bp.find('q')->second << ", m removed: " << (bp.find('m') == bp.end()) << endl;
+    bp.print();
+    int bplus = bplusMismatches<int>(2) + bplusMismatches<double>(0.5);
+    failures += bplus;
+    cout << "random BPlusTree<int> and <double> operations: " << (bplus == 0 ? "match std::map" : "MISMATCH") << endl;
+
+    // Concurrent tree
+    ConcurrentAVLTree<char,int> shared;
+    for(char c = 'a'; c <= 'e'; ++c) {
+        shared.insert(std::make_pair(c, c - 'a'));
+    }
+    shared.remove('c');
+    cout << "\nConcurrentAVLTree:";
+    for(ConcurrentAVLTree<char,int>::iterator it = shared.begin(); it != shared.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    int concurrent = concurrentMismatches();
+    failures += concurrent;
+    cout << "\nfour threads at once: " << (concurrent == 0 ? "matches" : "MISMATCH") << endl;
+
+    // Custom and transparent comparators
+    AVLTree<string,int,false,TransparentLess> words;
+    words.insert(std::make_pair(string("pear"), 1));
+    words.insert(std::make_pair(string("apple"), 2));
+    words.insert(std::make_pair(string("fig"), 3));
+    cout << "\nfind(\"fig\") without a temporary string: " << words.find("fig")->second
+         << ", lowerBound(\"b\"): " << words.lowerBound("b")->first << endl;
+    int ranges = equalRangeMismatches();
+    failures += ranges;
+    cout << "equalRange by prefix: " << (ranges == 0 ? "match std::map" : "MISMATCH") << endl;
+    AVLTree<int,int,false,std::greater<int> > descending;
+    for(int i = 1; i <= 5; ++i) {
+        descending.insert(std::make_pair(i, i * i));
+    }
+    cout << "greater<int> order:";
+    for(AVLTree<int,int,false,std::greater<int> >::iterator it = descending.begin(); it != descending.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+
+    // Erasing through iterators
+    AVLTree<int,int,false,std::greater<int> >::iterator next = descending.erase(descending.find(4));
+    cout << "erase(find(4)) returns " << next->first;
+    descending.erase(descending.begin(), descending.find(2));
+    cout << ", after erase(begin, find(2)):";
+    for(AVLTree<int,int,false,std::greater<int> >::iterator it = descending.begin(); it != descending.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+
+    // Walking backwards, and with a cursor
+    cout << "rbegin to rend:";
+    for(AVLTree<char,int>::reverse_iterator it = evens.rbegin(); it != evens.rend(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << "\ncursor from k:";
+    for(AVLTree<char,int>::cursor c = evens.ascendingFrom('k'); !c.done(); ++c) {
+        cout << " " << c->first;
+    }
+    cout << endl;
+
+    // AVL tree with 32-bit index links
+    CompactAVLTree<char,int> compact;
+    for(char c = 'a'; c <= 'o'; ++c) {
+        compact.insert(std::make_pair(c, c - 'a'));
+    }
+    compact.remove('h');
+    compact.erase(compact.lowerBound('f'));
+    cout << "\nCompactAVLTree:";
+    for(CompactAVLTree<char,int>::iterator it = compact.begin(); it != compact.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << "\ncompact size " << compact.size() << ", balanced: " << compact.isBalanced() << endl;
+    compact.print();
+    int compactRandom = compactMismatches();
+    failures += compactRandom;
+    cout << "random compact AVL operations: " << (compactRandom == 0 ? "match std::map" : "MISMATCH") << endl;
+
+    // Red-black tree with the same search and iterator API
+    RedBlackTree<int,int,std::less<int>,CountingStats> rb;
+    for(int i = 1; i <= 7; ++i) {
+        rb.insert(std::make_pair(i, i * i));
+    }
+    cout << "\nRedBlackTree inserting 1..7: " << rb.stats().rotations << " rotations";
+    rb.remove(4);
+    rb.erase(rb.find(1));
+    cout << ", after removing 4 and 1:";
+    for(RedBlackTree<int,int,std::less<int>,CountingStats>::iterator it = rb.begin(); it != rb.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << "\nred-black rules hold: " << rb.isBalanced() << ", find(6): " << rb.find(6)->second << endl;
+    int redBlack = redBlackMismatches();
+    failures += redBlack;
+    cout << "random red-black operations: " << (redBlack == 0 ? "match std::map" : "MISMATCH") << endl;
+    rb.print();
+
+    // Operation counters, kept only by trees that ask for them
+    AVLTree<int,int,false,std::less<int>,CountingStats> counted;
+    for(int i = 1; i <= 7; ++i) {
+        counted.insert(std::make_pair(i, i));
+    }
+    TreeStats st = counted.stats();
+    cout << "\nInserting 1..7: " << st.rotations << " rotations, max depth " << st.maxDepth;
+    counted.resetStats();
+    counted.find(7);
+    st = counted.stats();
+    cout << "; find(7): " << st.comparisons << " comparisons, " << st.nodesVisited << " nodes" << endl;
+
+    return failures == 0 ? 0 : 1;
 }
@@ -5,20 +5,37 @@
 #include <exception>
 #include <cstdlib>
 #include <utility>
+#include <new>
+#include <type_traits>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "node_pool.h"
+#include "frozen_tree.h"
 
 /**
- * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so
- * that they can be overridden for future kinds of
- * search trees, such as Red Black trees, Splay trees,
- * and AVL trees.
+ * A templated base class for a Node in a search tree.
+ * Derived is the concrete node type (CRTP), so the getters
+ * for parent/left/right already return the right kind of
+ * node and are resolved at compile time: search loops and
+ * rotations compile to plain pointer chasing and nodes carry
+ * no vptr. Future kinds of search trees, such as Red Black
+ * trees, Splay trees, and AVL trees, derive their own node
+ * type from it.
  */
-template <typename Key, typename Value>
-class Node
+template <typename Key, typename Value, typename Derived>
+class BasicNode
 {
 public:
-    Node(const Key& key, const Value& value, Node<Key, Value>* parent);
-    virtual ~Node();
+    BasicNode(const Key& key, const Value& value, Derived* parent);
+    template<typename... ItemArgs>
+    explicit BasicNode(Derived* parent, ItemArgs&&... itemArgs);
 
     const std::pair<const Key, Value>& getItem() const;
     std::pair<const Key, Value>& getItem();
@@ -26,33 +43,56 @@ public:
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    Derived* getParent() const;
+    Derived* getLeft() const;
+    Derived* getRight() const;
 
-    void setParent(Node<Key, Value>* parent);
-    void setLeft(Node<Key, Value>* left);
-    void setRight(Node<Key, Value>* right);
+    void setParent(Derived* parent);
+    void setLeft(Derived* left);
+    void setRight(Derived* right);
     void setValue(const Value &value);
 
+    // Recomputes any data a derived node caches about its subtree (such as
+    // an AVL height) from its children. Plain nodes cache nothing.
+    void updateFromChildren();
+    // Takes over what other caches about its subtree, when this node moves
+    // into other's place in the tree. Plain nodes cache nothing.
+    void copySubtreeData(const Derived& other);
+    // One bit of per-node state that save() and load() carry along (a
+    // red-black color). Plain nodes have none.
+    bool getSnapshotBit() const;
+    void setSnapshotBit(bool bit);
+
 protected:
     std::pair<const Key, Value> item_;
-    Node<Key, Value>* parent_;
-    Node<Key, Value>* left_;
-    Node<Key, Value>* right_;
+    Derived* parent_;
+    Derived* left_;
+    Derived* right_;
+};
+
+/**
+ * The node used by the plain BinarySearchTree.
+ */
+template <typename Key, typename Value>
+class Node : public BasicNode<Key, Value, Node<Key, Value> >
+{
+public:
+    Node(const Key& key, const Value& value, Node<Key, Value>* parent);
+    template<typename... ItemArgs>
+    explicit Node(Node<Key, Value>* parent, ItemArgs&&... itemArgs);
 };
 
 /*
   -----------------------------------------
-  Begin implementations for the Node class.
+  Begin implementations for the BasicNode class.
   -----------------------------------------
 */
 
 /**
 * Explicit constructor for a node.
 */
-template<typename Key, typename Value>
-Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* parent) :
+template<typename Key, typename Value, typename Derived>
+BasicNode<Key, Value, Derived>::BasicNode(const Key& key, const Value& value, Derived* parent) :
     item_(key, value),
     parent_(parent),
     left_(NULL),
@@ -62,12 +102,17 @@ Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* par
 }
 
 /**
-* Destructor, which does not need to do anything since the pointers inside of a node
-* are only used as references to existing nodes. The nodes pointed to by parent/left/right
-* are freed by the BinarySearchTree.
+* Constructor that builds the item in place from whatever arguments
+* std::pair<const Key, Value> accepts (including std::piecewise_construct),
+* so keys and values can be moved in instead of copied.
 */
-template<typename Key, typename Value>
-Node<Key, Value>::~Node()
+template<typename Key, typename Value, typename Derived>
+template<typename... ItemArgs>
+BasicNode<Key, Value, Derived>::BasicNode(Derived* parent, ItemArgs&&... itemArgs) :
+    item_(std::forward<ItemArgs>(itemArgs)...),
+    parent_(parent),
+    left_(NULL),
+    right_(NULL)
 {
 
 }
@@ -75,8 +120,8 @@ Node<Key, Value>::~Node()
 /**
 * A const getter for the item.
 */
-template<typename Key, typename Value>
-const std::pair<const Key, Value>& Node<Key, Value>::getItem() const
+template<typename Key, typename Value, typename Derived>
+const std::pair<const Key, Value>& BasicNode<Key, Value, Derived>::getItem() const
 {
     return item_;
 }
@@ -84,8 +129,8 @@ const std::pair<const Key, Value>& Node<Key, Value>::getItem() const
 /**
 * A non-const getter for the item.
 */
-template<typename Key, typename Value>
-std::pair<const Key, Value>& Node<Key, Value>::getItem()
+template<typename Key, typename Value, typename Derived>
+std::pair<const Key, Value>& BasicNode<Key, Value, Derived>::getItem()
 {
     return item_;
 }
@@ -93,8 +138,8 @@ std::pair<const Key, Value>& Node<Key, Value>::getItem()
 /**
 * A const getter for the key.
 */
-template<typename Key, typename Value>
-const Key& Node<Key, Value>::getKey() const
+template<typename Key, typename Value, typename Derived>
+const Key& BasicNode<Key, Value, Derived>::getKey() const
 {
     return item_.first;
 }
@@ -102,8 +147,8 @@ const Key& Node<Key, Value>::getKey() const
 /**
 * A const getter for the value.
 */
-template<typename Key, typename Value>
-const Value& Node<Key, Value>::getValue() const
+template<typename Key, typename Value, typename Derived>
+const Value& BasicNode<Key, Value, Derived>::getValue() const
 {
     return item_.second;
 }
@@ -111,35 +156,35 @@ const Value& Node<Key, Value>::getValue() const
 /**
 * A non-const getter for the value.
 */
-template<typename Key, typename Value>
-Value& Node<Key, Value>::getValue()
+template<typename Key, typename Value, typename Derived>
+Value& BasicNode<Key, Value, Derived>::getValue()
 {
     return item_.second;
 }
 
 /**
-* An implementation of the virtual function for retreiving the parent.
+* A getter for retreiving the parent.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getParent() const
+template<typename Key, typename Value, typename Derived>
+Derived* BasicNode<Key, Value, Derived>::getParent() const
 {
     return parent_;
 }
 
 /**
-* An implementation of the virtual function for retreiving the left child.
+* A getter for retreiving the left child.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getLeft() const
+template<typename Key, typename Value, typename Derived>
+Derived* BasicNode<Key, Value, Derived>::getLeft() const
 {
     return left_;
 }
 
 /**
-* An implementation of the virtual function for retreiving the right child.
+* A getter for retreiving the right child.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getRight() const
+template<typename Key, typename Value, typename Derived>
+Derived* BasicNode<Key, Value, Derived>::getRight() const
 {
     return right_;
 }
@@ -147,8 +192,8 @@ Node<Key, Value>* Node<Key, Value>::getRight() const
 /**
 * A setter for setting the parent of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setParent(Node<Key, Value>* parent)
+template<typename Key, typename Value, typename Derived>
+void BasicNode<Key, Value, Derived>::setParent(Derived* parent)
 {
     parent_ = parent;
 }
@@ -156,8 +201,8 @@ void Node<Key, Value>::setParent(Node<Key, Value>* parent)
 /**
 * A setter for setting the left child of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setLeft(Node<Key, Value>* left)
+template<typename Key, typename Value, typename Derived>
+void BasicNode<Key, Value, Derived>::setLeft(Derived* left)
 {
     left_ = left;
 }
@@ -165,8 +210,8 @@ void Node<Key, Value>::setLeft(Node<Key, Value>* left)
 /**
 * A setter for setting the right child of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setRight(Node<Key, Value>* right)
+template<typename Key, typename Value, typename Derived>
+void BasicNode<Key, Value, Derived>::setRight(Derived* right)
 {
     right_ = right;
 }
@@ -174,43 +219,339 @@ void Node<Key, Value>::setRight(Node<Key, Value>* right)
 /**
 * A setter for the value of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setValue(const Value& value)
+template<typename Key, typename Value, typename Derived>
+void BasicNode<Key, Value, Derived>::setValue(const Value& value)
 {
     item_.second = value;
 }
 
+/**
+* Does nothing for nodes that cache nothing about their subtree. Derived nodes
+* that do hide this with their own version, which the tree calls through the
+* Derived type.
+*/
+template<typename Key, typename Value, typename Derived>
+void BasicNode<Key, Value, Derived>::updateFromChildren()
+{
+
+}
+
+/**
+* Does nothing for nodes that cache nothing about their subtree; see
+* updateFromChildren().
+*/
+template<typename Key, typename Value, typename Derived>
+void BasicNode<Key, Value, Derived>::copySubtreeData(const Derived&)
+{
+
+}
+
+/**
+* Plain nodes keep nothing a snapshot needs beyond their shape and item.
+*/
+template<typename Key, typename Value, typename Derived>
+bool BasicNode<Key, Value, Derived>::getSnapshotBit() const
+{
+    return false;
+}
+
+/**
+* Does nothing for nodes without a snapshot bit.
+*/
+template<typename Key, typename Value, typename Derived>
+void BasicNode<Key, Value, Derived>::setSnapshotBit(bool)
+{
+
+}
+
 /*
   ---------------------------------------
-  End implementations for the Node class.
+  End implementations for the BasicNode class.
   ---------------------------------------
 */
 
 /**
-* A templated unbalanced binary search tree.
+* Explicit constructor for a plain BST node.
 */
-template <typename Key, typename Value>
+template<typename Key, typename Value>
+Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* parent) :
+    BasicNode<Key, Value, Node<Key, Value> >(key, value, parent)
+{
+
+}
+
+/**
+* Constructor that builds the item in place. See BasicNode.
+*/
+template<typename Key, typename Value>
+template<typename... ItemArgs>
+Node<Key, Value>::Node(Node<Key, Value>* parent, ItemArgs&&... itemArgs) :
+    BasicNode<Key, Value, Node<Key, Value> >(parent, std::forward<ItemArgs>(itemArgs)...)
+{
+
+}
+
+/**
+* A comparator that orders any two types that can be compared with <, the
+* C++11 stand-in for std::less<>. Its is_transparent tag lets a tree's find(),
+* lowerBound(), upperBound() and equalRange() take anything comparable with
+* the key, e.g. a const char* for std::string keys, without building a Key.
+*/
+struct TransparentLess
+{
+    typedef void is_transparent;
+
+    template<typename A, typename B>
+    bool operator()(const A& a, const B& b) const
+    {
+        return a < b;
+    }
+};
+
+/**
+* Three-way comparison for a Compare: negative, zero or positive as a is
+* less than, equivalent to or greater than b. The general version needs a
+* second call to Compare only when the first says "not less". std::less of
+* an arithmetic type tests == first, which compilers turn into one compare
+* and a conditional move of the child pointer, and orderings of std::string
+* use a single string::compare().
+*/
+template<typename Compare, typename = void>
+struct KeyOrder
+{
+    template<typename A, typename B>
+    static int compare(const Compare& comp, const A& a, const B& b)
+    {
+        return comp(a, b) ? -1 : (comp(b, a) ? 1 : 0);
+    }
+};
+
+template<typename T>
+struct KeyOrder<std::less<T>, typename std::enable_if<std::is_arithmetic<T>::value>::type>
+{
+    static int compare(const std::less<T>&, const T& a, const T& b)
+    {
+        return a == b ? 0 : (a < b ? -1 : 1);
+    }
+};
+
+template<>
+struct KeyOrder<std::less<std::string> >
+{
+    static int compare(const std::less<std::string>&, const std::string& a, const std::string& b)
+    {
+        return a.compare(b);
+    }
+};
+
+template<>
+struct KeyOrder<TransparentLess>
+{
+    template<typename A, typename B>
+    static int compare(const TransparentLess& comp, const A& a, const B& b)
+    {
+        return comp(a, b) ? -1 : (comp(b, a) ? 1 : 0);
+    }
+    static int compare(const TransparentLess&, const std::string& a, const std::string& b)
+    {
+        return a.compare(b);
+    }
+    static int compare(const TransparentLess&, const std::string& a, const char* b)
+    {
+        return a.compare(b);
+    }
+    static int compare(const TransparentLess&, const char* a, const std::string& b)
+    {
+        return -b.compare(a);
+    }
+};
+
+/**
+* How save() and load() write and read one key or value. The general version
+* copies the object's bytes, so it only accepts trivially copyable types, and
+* the snapshot has the machine's byte order. Specialize it for anything else;
+* read() gets a default-constructed object to fill in and reports failure
+* through the stream's state. Small objects go through the stream buffer's
+* inline sputc()/sbumpc() one byte at a time, which is several times cheaper
+* than a virtual sputn()/sgetn() call for a few bytes.
+*/
+template<typename T, typename = void>
+struct Serializer
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "specialize Serializer<T> to save or load a type that is not trivially copyable");
+
+    static void write(std::ostream& out, const T& value)
+    {
+        const char* bytes = reinterpret_cast<const char*>(&value);
+        std::streambuf* buf = out.rdbuf();
+        if(sizeof(T) > 16){
+            if(buf->sputn(bytes, sizeof(T)) != (std::streamsize)sizeof(T)){
+                out.setstate(std::ios::badbit);
+            }
+            return;
+        }
+        for(size_t i = 0; i < sizeof(T); ++i){
+            if(buf->sputc(bytes[i]) == std::char_traits<char>::eof()){
+                out.setstate(std::ios::badbit);
+                return;
+            }
+        }
+    }
+    static void read(std::istream& in, T& value)
+    {
+        char* bytes = reinterpret_cast<char*>(&value);
+        std::streambuf* buf = in.rdbuf();
+        if(sizeof(T) > 16){
+            if(buf->sgetn(bytes, sizeof(T)) != (std::streamsize)sizeof(T)){
+                in.setstate(std::ios::failbit | std::ios::eofbit);
+            }
+            return;
+        }
+        for(size_t i = 0; i < sizeof(T); ++i){
+            std::char_traits<char>::int_type c = buf->sbumpc();
+            if(c == std::char_traits<char>::eof()){
+                in.setstate(std::ios::failbit | std::ios::eofbit);
+                return;
+            }
+            bytes[i] = std::char_traits<char>::to_char_type(c);
+        }
+    }
+};
+
+/**
+* Strings are written as their length followed by their characters.
+*/
+template<>
+struct Serializer<std::string>
+{
+    static void write(std::ostream& out, const std::string& value)
+    {
+        Serializer<uint64_t>::write(out, value.size());
+        if(out.rdbuf()->sputn(value.data(), value.size()) != (std::streamsize)value.size()){
+            out.setstate(std::ios::badbit);
+        }
+    }
+    static void read(std::istream& in, std::string& value)
+    {
+        uint64_t length = 0;
+        Serializer<uint64_t>::read(in, length);
+        if(!in){
+            return;
+        }
+        value.resize(length);
+        if(length > 0 && in.rdbuf()->sgetn(&value[0], length) != (std::streamsize)length){
+            in.setstate(std::ios::failbit | std::ios::eofbit);
+        }
+    }
+};
+
+/**
+* Operation counts of a tree that keeps them (see CountingStats), from when it
+* was built or its stats were last reset. Lookups, inserts and removes count
+* their comparisons and nodes; scans and iteration are not counted.
+*/
+struct TreeStats
+{
+    TreeStats() : comparisons(0), nodesVisited(0), rotations(0), nodeSwaps(0), maxDepth(0) {}
+
+    uint64_t comparisons;  // calls to the comparator (a three-way KeyOrder comparison counts as one)
+    uint64_t nodesVisited; // nodes stepped through on the way down
+    uint64_t rotations;    // single rotations while rebalancing after an insert or remove
+    uint64_t nodeSwaps;    // removed nodes with two children, whose predecessor moved into their place
+    size_t maxDepth;       // deepest level any of those operations reached, the root being 1
+};
+
+/**
+* The statistics policy trees use by default: it keeps nothing, and since
+* every hook is an empty inline function, a tree using it compiles to the
+* same code as one without any hooks. stats() always reads all zeros.
+*/
+struct NoStats
+{
+    void compared() {}
+    void visited() {}
+    void rotated() {}
+    void swapped() {}
+    void reached(size_t) {}
+    TreeStats snapshot() const { return TreeStats(); }
+    void reset() {}
+};
+
+/**
+* The statistics policy that counts, e.g. AVLTree<int, int, false,
+* std::less<int>, CountingStats>. The counters are plain integers in the
+* tree, so with it even const lookups write to the tree: such a tree must not
+* be read from several threads at once.
+*/
+struct CountingStats
+{
+    void compared() { ++counts_.comparisons; }
+    void visited() { ++counts_.nodesVisited; }
+    void rotated() { ++counts_.rotations; }
+    void swapped() { ++counts_.nodeSwaps; }
+    void reached(size_t depth) { counts_.maxDepth = std::max(counts_.maxDepth, depth); }
+    TreeStats snapshot() const { return counts_; }
+    void reset() { counts_ = TreeStats(); }
+
+private:
+    TreeStats counts_;
+};
+
+/**
+* A templated unbalanced binary search tree. Keys are ordered by Compare,
+* a strict weak ordering like the one std::map takes; two keys are the same
+* key when neither compares less than the other. Stats is the operation
+* counting policy: NoStats (the default) or CountingStats.
+*/
+template <typename Key, typename Value, typename NodeT = Node<Key, Value>, typename Compare = std::less<Key>,
+          typename Stats = NoStats>
 class BinarySearchTree
 {
 public:
     BinarySearchTree(); //done
+    explicit BinarySearchTree(const Compare& comp);
+    template<typename ForwardIt>
+    BinarySearchTree(ForwardIt first, ForwardIt last, const Compare& comp = Compare());
+    BinarySearchTree(BinarySearchTree&& other); // trees are moved, never copied
+    BinarySearchTree& operator=(BinarySearchTree&& other);
     virtual ~BinarySearchTree(); //done
-    virtual void insert(const std::pair<const Key, Value>& keyValuePair); //done
+    template<typename ForwardIt>
+    void assign(ForwardIt first, ForwardIt last);
+    void save(std::ostream& out) const;
+    void load(std::istream& in);
+    void insert(const std::pair<const Key, Value>& keyValuePair); //done (subclasses rebalance through insertFix())
+    void insert(std::pair<const Key, Value>&& keyValuePair);
+    void rememberInserts(bool remember);
     virtual void remove(const Key& key); //done
     void clear(); //done
-    bool isBalanced() const; //done
+    virtual bool isBalanced() const; //done (subclasses with other balance rules override it)
     void print() const;
     bool empty() const;
+    FrozenTree<Key, Value, Compare> freeze() const;
+    Compare keyComp() const;
+    TreeStats stats() const;
+    void resetStats();
 
-    template<typename PPKey, typename PPValue>
-    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
+    template<typename PPKey, typename PPValue, typename PPNode, typename PPCompare, typename PPStats>
+    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue, PPNode, PPCompare, PPStats> & tree);
 public:
+    class const_iterator;
+
     /**
     * An internal iterator class for traversing the contents of the BST.
+    * It is bidirectional: stepping back from end() starts at the biggest
+    * key, which is why it also remembers the tree it came from.
     */
     class iterator  // done
     {
     public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef value_type* pointer;
+        typedef value_type& reference;
+
         iterator();
 
         std::pair<const Key,Value>& operator*() const;
@@ -218,42 +559,186 @@ public:
 
         bool operator==(const iterator& rhs) const;
         bool operator!=(const iterator& rhs) const;
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
 
         iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class BinarySearchTree<Key, Value, NodeT, Compare, Stats>;
+        iterator(NodeT* ptr, const BinarySearchTree<Key, Value, NodeT, Compare, Stats>* tree);
+        NodeT *current_;
+        const BinarySearchTree<Key, Value, NodeT, Compare, Stats>* tree_;
+    };
+
+    /**
+    * The read-only version of iterator, which any iterator converts to.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+        const_iterator();
+        const_iterator(const iterator& it);
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        friend class BinarySearchTree<Key, Value, NodeT, Compare, Stats>;
+        NodeT *current_;
+        const BinarySearchTree<Key, Value, NodeT, Compare, Stats>* tree_;
+    };
+
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    /**
+    * A one-way scan that keeps the nodes still to be visited on an explicit
+    * stack instead of climbing parent pointers, so each step only reads the
+    * nodes it moves to. Unlike an iterator it cannot go back or be compared;
+    * it is walked with ++ until done(). The tree must not change meanwhile.
+    */
+    class cursor
+    {
+    public:
+        bool done() const;
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+        cursor& operator++();
 
     protected:
-        friend class BinarySearchTree<Key, Value>;
-        iterator(Node<Key,Value>* ptr);
-        Node<Key, Value> *current_;
+        friend class BinarySearchTree<Key, Value, NodeT, Compare, Stats>;
+        explicit cursor(bool descending);
+        void pushSpine(const NodeT* node);
+        std::vector<const NodeT*> pending_; // the current node on top, then the ones still to come after it
+        bool descending_;
     };
 
 public:
     iterator begin() const;
     iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    const_reverse_iterator crbegin() const;
+    const_reverse_iterator crend() const;
+    cursor ascending() const;
+    cursor ascendingFrom(const Key& lo) const;
+    cursor descending() const;
+    cursor descendingFrom(const Key& hi) const;
     iterator find(const Key& key) const;
+    iterator lowerBound(const Key& key) const;
+    iterator upperBound(const Key& key) const;
+    std::pair<iterator, iterator> equalRange(const Key& key) const;
+    // Lookups by anything comparable with Key; only for transparent comparators (see TransparentLess)
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator lowerBound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator upperBound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    std::pair<iterator, iterator> equalRange(const K& key) const;
+    template<typename Visitor>
+    void rangeScan(const Key& lo, const Key& hi, Visitor visit) const;
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... ValueArgs>
+    std::pair<iterator, bool> tryEmplace(const Key& key, ValueArgs&&... valueArgs);
+    template<typename... ValueArgs>
+    std::pair<iterator, bool> tryEmplace(Key&& key, ValueArgs&&... valueArgs);
+    template<typename ValueArg>
+    std::pair<iterator, bool> insertOrAssign(const Key& key, ValueArg&& value);
+    template<typename ValueArg>
+    std::pair<iterator, bool> insertOrAssign(Key&& key, ValueArg&& value);
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
+    iterator insert(iterator hint, const std::pair<const Key, Value>& keyValuePair);
+    iterator insert(iterator hint, std::pair<const Key, Value>&& keyValuePair);
+    iterator erase(iterator pos);
+    iterator erase(iterator first, iterator last);
 
 protected:
     // Mandatory helper functions
-    Node<Key, Value>* internalFind(const Key& k) const; // done
-    Node<Key, Value> *getSmallestNode() const;  // done
-    static Node<Key, Value>* predecessor(Node<Key, Value>* current); // done
+    template<typename K>
+    NodeT* internalFind(const K& k) const; // done
+    NodeT *getSmallestNode() const;  // done
+    NodeT *getLargestNode() const;
+    static NodeT* predecessor(NodeT* current); // done
+    static NodeT* successor(NodeT* current);
     // Note:  static means these functions don't have a "this" pointer
     //        and instead just use the input argument.
 
     // Provided helper functions
-    virtual void printRoot (Node<Key, Value> *r) const;
-    virtual void nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2) ;
+    void printRoot (NodeT *r) const; // non-virtual, so Values without operator<< still compile
 
     // Add helper functions here
-		void clearHelper(Node<Key, Value>* root);
-		int isBalancedHelper(Node<Key, Value>* root) const; 
+		void clearHelper(NodeT* root);
+		int isBalancedHelper(NodeT* root) const; 
+		void destroyNode(NodeT* node); //runs the node's destructor and gives its slot back to pool_
+		NodeT* findInsertPosition(const Key& key, NodeT*& parent, bool& goLeft) const; //single search for inserts, from finger_ when there is one
+		NodeT* findInsertPositionBelow(NodeT* top, const Key& key, NodeT*& parent, bool& goLeft) const; //single descent of top's subtree
+		NodeT* findInsertPositionNear(NodeT* finger, const Key& key, NodeT*& parent, bool& goLeft) const; //finger search starting at a node of the tree
+		void linkNode(NodeT* node, NodeT* parent, bool goLeft); //hangs a new node at the spot findInsertPosition() picked
+		void setRoot(NodeT* root); //installs a tree built or rearranged wholesale, finding its ends again
+		template<typename KeyArg, typename... ValueArgs>
+		std::pair<iterator, bool> tryEmplaceImpl(KeyArg&& key, ValueArgs&&... valueArgs);
+		template<typename KeyArg, typename ValueArg>
+		std::pair<iterator, bool> insertOrAssignImpl(NodeT* near, KeyArg&& key, ValueArg&& value); //near is where the search starts, NULL for the usual one
+		template<typename... ItemArgs>
+		NodeT* createNode(NodeT* parent, ItemArgs&&... itemArgs); //allocates a node from pool_ and builds its item in place
+		iterator makeIterator(NodeT* node) const; //lets subclasses hand out iterators to their nodes
+		static NodeT* iteratorNode(const iterator& it); //and look inside the ones they are handed
+		virtual void insertFix(NodeT* node); //rebalancing hook run after a new node is linked in
+		virtual void removeStart(NodeT* node); //hook run as unlinkNode() starts on node, before any link changes
+		NodeT* unlinkNode(NodeT* node); //takes node out of the tree without destroying it, returns the lowest node whose subtree changed
+		virtual void removeFix(NodeT* node); //rebalancing hook run after a node is unlinked, given what unlinkNode() returned
+		virtual void assignFix(); //hook run after assign() has built a new tree, before it is used
+		template<typename ForwardIt>
+		NodeT* buildBalanced(ForwardIt& first, ForwardIt last, size_t count); //links count sorted items into a perfectly balanced subtree
+		template<typename K>
+		NodeT* lowerBoundNode(const K& key) const; //first node whose key is not less than key, or NULL
+		template<typename K>
+		NodeT* upperBoundNode(const K& key) const; //first node whose key is greater than key, or NULL
+		template<typename K>
+		std::pair<iterator, iterator> equalRangeImpl(const K& key) const; //[lowerBoundNode, upperBoundNode) of key
+		virtual uint8_t snapshotKind() const; //which shapes load() accepts; written into every snapshot
+		static NodeT* postorderFirst(NodeT* top); //the deepest node save() starts with
+		static NodeT* postorderNext(NodeT* node); //the node save() writes after node, or NULL
+
+		// Snapshot format (see save())
+		enum { SNAPSHOT_VERSION = 1 };
+		enum { SNAPSHOT_HAS_LEFT = 1, SNAPSHOT_HAS_RIGHT = 2, SNAPSHOT_END = 4, SNAPSHOT_NODE_BIT = 8 };
+		enum { PLAIN_SHAPE = 0, HEIGHT_BALANCED_SHAPE = 1, RED_BLACK_SHAPE = 2 };
 
 
 protected:
-    Node<Key, Value>* root_;
-    // You should not need other data members
+    NodeT* root_;
+    NodePool pool_; // every node of this tree lives in one of pool_'s slabs
+    Compare comp_;
+    NodeT* finger_; // last inserted node while rememberInserts() is on, else NULL
+    bool rememberInserts_;
+    NodeT* smallest_; // the ends of the tree, kept exact so begin(), rbegin() and
+    NodeT* largest_;  // appends past either end need no walk; NULL when empty
+    mutable Stats stats_; // counted from const lookups too; not handed over when the tree is moved
 };
 
 /*
@@ -263,10 +748,12 @@ Begin implementations for the BinarySearchTree::iterator class.
 */
 
 /**
-* Explicit constructor that initializes an iterator with a given node pointer.
+* Explicit constructor that initializes an iterator with a given node pointer
+* (NULL for the end) of the given tree.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr) : current_(ptr)
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator::iterator(NodeT *ptr, const BinarySearchTree<Key, Value, NodeT, Compare, Stats>* tree) :
+    current_(ptr), tree_(tree)
 {
     // done
 }
@@ -274,8 +761,8 @@ BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr) : current
 /**
 * A default constructor that initializes the iterator to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator() : current_(NULL)
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator::iterator() : current_(NULL), tree_(NULL)
 {
     // done
 
@@ -284,9 +771,9 @@ BinarySearchTree<Key, Value>::iterator::iterator() : current_(NULL)
 /**
 * Provides access to the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class NodeT, class Compare, class Stats>
 std::pair<const Key,Value> &
-BinarySearchTree<Key, Value>::iterator::operator*() const
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator::operator*() const
 {
     return current_->getItem();
 }
@@ -294,9 +781,9 @@ BinarySearchTree<Key, Value>::iterator::operator*() const
 /**
 * Provides access to the address of the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class NodeT, class Compare, class Stats>
 std::pair<const Key,Value> *
-BinarySearchTree<Key, Value>::iterator::operator->() const
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator::operator->() const
 {
     return &(current_->getItem());
 }
@@ -305,10 +792,10 @@ BinarySearchTree<Key, Value>::iterator::operator->() const
 * Checks if 'this' iterator's internals have the same value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class NodeT, class Compare, class Stats>
 bool
-BinarySearchTree<Key, Value>::iterator::operator==(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator::operator==(
+    const BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator& rhs) const
 {
     // done
     return this->current_ == rhs.current_;
@@ -318,322 +805,1316 @@ BinarySearchTree<Key, Value>::iterator::operator==(
 * Checks if 'this' iterator's internals have a different value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class NodeT, class Compare, class Stats>
 bool
-BinarySearchTree<Key, Value>::iterator::operator!=(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator::operator!=(
+    const BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator& rhs) const
 {
     // done
     return this->current_ != rhs.current_;
 }
 
+/**
+* Checks if 'this' iterator points at the same item as a const_iterator.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+bool
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator::operator==(
+    const BinarySearchTree<Key, Value, NodeT, Compare, Stats>::const_iterator& rhs) const
+{
+    return this->current_ == rhs.current_;
+}
+
+/**
+* Checks if 'this' iterator points at a different item than a const_iterator.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+bool
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator::operator!=(
+    const BinarySearchTree<Key, Value, NodeT, Compare, Stats>::const_iterator& rhs) const
+{
+    return this->current_ != rhs.current_;
+}
 
 /**
 * Advances the iterator's location using an in-order sequencing
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++()
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator&
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator::operator++()
 {
 	// done
-	Node<Key, Value>* successor = current_;
-	bool exist = false;
-
-	if(successor == NULL){ //if node is empty then return null
-		return *this;
-	}
-
-	else if(successor->getRight() != NULL){ //if there is a right tree, we need to go all the way to the left
-		successor = successor->getRight(); //go right
-		while(successor->getLeft()!=NULL){ //keep going left until there are not more lefts to go
-				successor = successor->getLeft(); //the successor is this node
-		}
-		//current_ = successor; //update the current_ node to be this node, and then return the updated iterator
-		exist = true;
-		//return *this;
-	}
-
-	else{ //if there is no right tree, then the in-order successor will have to be someones parent
-		while(successor->getParent() != NULL){ 
-			if(successor->getParent()->getLeft() == successor){ //the first node in which the node is part of the left subtree
-				successor = successor->getParent();
-				exist = true;
-				break;
-			}
-			successor = successor->getParent();
-		}
-	}
-
-	if(exist==true){
-		current_ = successor;
-	}
-	else{
-		current_ = NULL;
-	}
+	current_ = successor(current_); //NULL (the end) after the biggest key
 	return *this;
+}
 
+/**
+* Advances the iterator and returns where it was.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator::operator++(int)
+{
+    iterator old = *this;
+    current_ = successor(current_);
+    return old;
 }
 
+/**
+* Moves the iterator back one item; from the end, to the biggest key.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator&
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator::operator--()
+{
+    current_ = current_ == NULL ? tree_->getLargestNode() : predecessor(current_);
+    return *this;
+}
 
-/*
--------------------------------------------------------------
-End implementations for the BinarySearchTree::iterator class.
--------------------------------------------------------------
+/**
+* Moves the iterator back and returns where it was.
 */
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator::operator--(int)
+{
+    iterator old = *this;
+    --(*this);
+    return old;
+}
 
 /*
------------------------------------------------------
-Begin implementations for the BinarySearchTree class.
------------------------------------------------------
+-------------------------------------------------------------------
+Begin implementations for the BinarySearchTree::const_iterator class.
+-------------------------------------------------------------------
 */
 
 /**
-* Default constructor for a BinarySearchTree, which sets the root to NULL.
+* A default constructor that initializes the iterator to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() : root_(NULL)
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::const_iterator::const_iterator() : current_(NULL), tree_(NULL)
 {
-    // done
+
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree()
+/**
+* Converts an iterator into a read-only one pointing at the same item.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::const_iterator::const_iterator(const iterator& it) :
+    current_(it.current_), tree_(it.tree_)
 {
-    // done
-		clear();
 
 }
 
 /**
- * Returns true if tree is empty
+* Provides read-only access to the item.
 */
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+const std::pair<const Key,Value> &
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::const_iterator::operator*() const
 {
-    return root_ == NULL;
+    return current_->getItem();
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+/**
+* Provides the address of the item, read-only.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+const std::pair<const Key,Value> *
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::const_iterator::operator->() const
 {
-    printRoot(root_);
-    std::cout << "\n";
+    return &(current_->getItem());
 }
 
 /**
-* Returns an iterator to the "smallest" item in the tree
+* Checks if both iterators point at the same item.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+bool
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::const_iterator::operator==(
+    const BinarySearchTree<Key, Value, NodeT, Compare, Stats>::const_iterator& rhs) const
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
-    return begin;
+    return this->current_ == rhs.current_;
 }
 
 /**
-* Returns an iterator whose value means INVALID
+* Checks if the iterators point at different items.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+bool
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::const_iterator::operator!=(
+    const BinarySearchTree<Key, Value, NodeT, Compare, Stats>::const_iterator& rhs) const
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
-    return end;
+    return this->current_ != rhs.current_;
 }
 
 /**
-* Returns an iterator to the item with the given key, k
-* or the end iterator if k does not exist in the tree
+* Advances to the next key, or the end after the biggest.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::const_iterator&
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::const_iterator::operator++()
 {
-    Node<Key, Value> *curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
-    return it;
+    current_ = successor(current_);
+    return *this;
 }
 
 /**
- * @precondition The key exists in the map
- * Returns the value associated with the key
- */
-template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+* Advances the iterator and returns where it was.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::const_iterator
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::const_iterator::operator++(int)
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+    const_iterator old = *this;
+    current_ = successor(current_);
+    return old;
 }
-template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+
+/**
+* Moves the iterator back one item; from the end, to the biggest key.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::const_iterator&
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::const_iterator::operator--()
 {
-    Node<Key, Value> *curr = internalFind(key);
+    current_ = current_ == NULL ? tree_->getLargestNode() : predecessor(current_);
+    return *this;
+}
+
+/**
+* Moves the iterator back and returns where it was.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::const_iterator
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::const_iterator::operator--(int)
+{
+    const_iterator old = *this;
+    --(*this);
+    return old;
+}
+
+/*
+-----------------------------------------------------------
+Begin implementations for the BinarySearchTree::cursor class.
+-----------------------------------------------------------
+*/
+
+/**
+* An empty cursor going the given way; the tree's ascending() and
+* descending() functions fill in the path to the starting node.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::cursor::cursor(bool descending) : descending_(descending)
+{
+
+}
+
+/**
+* Returns true once every item has been visited.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+bool BinarySearchTree<Key, Value, NodeT, Compare, Stats>::cursor::done() const
+{
+    return pending_.empty();
+}
+
+/**
+* Provides read-only access to the current item.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+const std::pair<const Key,Value>& BinarySearchTree<Key, Value, NodeT, Compare, Stats>::cursor::operator*() const
+{
+    return pending_.back()->getItem();
+}
+
+/**
+* Provides the address of the current item, read-only.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+const std::pair<const Key,Value>* BinarySearchTree<Key, Value, NodeT, Compare, Stats>::cursor::operator->() const
+{
+    return &(pending_.back()->getItem());
+}
+
+/**
+* Moves to the next item in the cursor's direction: the first one in the
+* subtree on that side of the current node if there is one, else the node
+* below it on the stack. No parent pointer is read.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::cursor&
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::cursor::operator++()
+{
+    const NodeT* node = pending_.back();
+    pending_.pop_back();
+    pushSpine(descending_ ? node->getLeft() : node->getRight());
+    return *this;
+}
+
+/**
+* Pushes node and the spine below it that leads to the first item of its
+* subtree in the cursor's direction (its left spine when ascending).
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+void BinarySearchTree<Key, Value, NodeT, Compare, Stats>::cursor::pushSpine(const NodeT* node)
+{
+    while(node != NULL){
+        pending_.push_back(node);
+        node = descending_ ? node->getRight() : node->getLeft();
+    }
+}
+
+/*
+-------------------------------------------------------------
+End implementations for the BinarySearchTree iterator classes.
+-------------------------------------------------------------
+*/
+
+/*
+-----------------------------------------------------
+Begin implementations for the BinarySearchTree class.
+-----------------------------------------------------
+*/
+
+/**
+* Default constructor for a BinarySearchTree, which sets the root to NULL.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::BinarySearchTree() : root_(NULL), pool_(sizeof(NodeT)), comp_(), finger_(NULL), rememberInserts_(false), smallest_(NULL), largest_(NULL)
+{
+    // done
+}
+
+/**
+* Constructor for an empty tree that orders its keys with comp.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::BinarySearchTree(const Compare& comp) : root_(NULL), pool_(sizeof(NodeT)), comp_(comp), finger_(NULL), rememberInserts_(false), smallest_(NULL), largest_(NULL)
+{
+
+}
+
+/**
+* Builds a tree from a range of key/value pairs sorted by key in O(n).
+* See assign() for the requirements on the range.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+template<typename ForwardIt>
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::BinarySearchTree(ForwardIt first, ForwardIt last, const Compare& comp) :
+    root_(NULL), pool_(sizeof(NodeT)), comp_(comp), finger_(NULL), rememberInserts_(false), smallest_(NULL), largest_(NULL)
+{
+    assign(first, last);
+}
+
+/**
+* Move constructor, which takes over other's nodes (and the slabs they live in)
+* in O(1) and leaves other empty.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::BinarySearchTree(BinarySearchTree&& other) :
+    root_(other.root_), pool_(sizeof(NodeT)), comp_(other.comp_),
+    finger_(other.finger_), rememberInserts_(other.rememberInserts_), smallest_(other.smallest_), largest_(other.largest_)
+{
+    other.setRoot(NULL);
+    pool_.swap(other.pool_);
+}
+
+/**
+* Move assignment, which frees this tree's nodes and then takes over other's.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>&
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::operator=(BinarySearchTree&& other)
+{
+    if(this != &other){
+        clear();
+        root_ = other.root_;
+        finger_ = other.finger_;
+        smallest_ = other.smallest_;
+        largest_ = other.largest_;
+        other.setRoot(NULL);
+        rememberInserts_ = other.rememberInserts_;
+        pool_.swap(other.pool_);
+        comp_ = other.comp_;
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename NodeT, typename Compare, typename Stats>
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::~BinarySearchTree()
+{
+    // done
+		clear();
+
+}
+
+/**
+ * Returns true if tree is empty
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+bool BinarySearchTree<Key, Value, NodeT, Compare, Stats>::empty() const
+{
+    return root_ == NULL;
+}
+
+template<typename Key, typename Value, typename NodeT, typename Compare, typename Stats>
+void BinarySearchTree<Key, Value, NodeT, Compare, Stats>::print() const
+{
+    printRoot(root_);
+    std::cout << "\n";
+}
+
+/**
+* Returns an iterator to the "smallest" item in the tree
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::begin() const
+{
+    BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator begin(getSmallestNode(), this);
+    return begin;
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::end() const
+{
+    BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator end(NULL, this);
+    return end;
+}
+
+/**
+* Returns a read-only iterator to the smallest item.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::const_iterator
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::cbegin() const
+{
+    return begin();
+}
+
+/**
+* Returns the read-only end iterator.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::const_iterator
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::cend() const
+{
+    return end();
+}
+
+/**
+* Returns a reverse iterator to the biggest item, for walking the keys
+* from the top down.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::reverse_iterator
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+/**
+* Returns the reverse iterator past the smallest item.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::reverse_iterator
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
+/**
+* Returns a read-only reverse iterator to the biggest item.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::const_reverse_iterator
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::crbegin() const
+{
+    return const_reverse_iterator(cend());
+}
+
+/**
+* Returns the read-only reverse iterator past the smallest item.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::const_reverse_iterator
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::crend() const
+{
+    return const_reverse_iterator(cbegin());
+}
+
+/**
+* Returns a cursor over every item in increasing key order.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::cursor
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::ascending() const
+{
+    cursor c(false);
+    c.pushSpine(root_);
+    return c;
+}
+
+/**
+* Returns a cursor over the items whose key is not less than lo, in
+* increasing key order. The descent to lo leaves every node passed on its
+* left on the stack, which are exactly the bigger keys still to come.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::cursor
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::ascendingFrom(const Key& lo) const
+{
+    cursor c(false);
+    NodeT* curr = root_;
+    while(curr != NULL){
+        if(comp_(curr->getKey(), lo)){
+            curr = curr->getRight();
+        }
+        else{
+            c.pending_.push_back(curr);
+            curr = curr->getLeft();
+        }
+    }
+    return c;
+}
+
+/**
+* Returns a cursor over every item in decreasing key order.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::cursor
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::descending() const
+{
+    cursor c(true);
+    c.pushSpine(root_);
+    return c;
+}
+
+/**
+* Returns a cursor over the items whose key is not greater than hi, in
+* decreasing key order (the mirror image of ascendingFrom()).
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::cursor
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::descendingFrom(const Key& hi) const
+{
+    cursor c(true);
+    NodeT* curr = root_;
+    while(curr != NULL){
+        if(comp_(hi, curr->getKey())){
+            curr = curr->getLeft();
+        }
+        else{
+            c.pending_.push_back(curr);
+            curr = curr->getRight();
+        }
+    }
+    return c;
+}
+
+/**
+* Returns an iterator to the item with the given key, k
+* or the end iterator if k does not exist in the tree
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::find(const Key & k) const
+{
+    NodeT *curr = internalFind(k);
+    BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator it(curr, this);
+    return it;
+}
+
+/**
+* Returns an iterator to the item whose key is equivalent to key (a value of
+* any type the transparent comparator can compare with Key), or the end iterator.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::find(const K& key) const
+{
+    return iterator(internalFind(key), this);
+}
+
+/**
+* Returns an immutable snapshot of the tree's current items laid out for fast
+* lookups (see FrozenTree). Later changes to the tree do not affect it. O(n).
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+FrozenTree<Key, Value, Compare> BinarySearchTree<Key, Value, NodeT, Compare, Stats>::freeze() const
+{
+    return FrozenTree<Key, Value, Compare>(begin(), end(), comp_);
+}
+
+/**
+* Returns a copy of the comparator that orders the keys.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+Compare BinarySearchTree<Key, Value, NodeT, Compare, Stats>::keyComp() const
+{
+    return comp_;
+}
+
+/**
+* Returns a copy of the operation counts so far; all zeros unless the tree
+* counts them (see CountingStats).
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+TreeStats BinarySearchTree<Key, Value, NodeT, Compare, Stats>::stats() const
+{
+    return stats_.snapshot();
+}
+
+/**
+* Sets every operation count back to zero.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+void BinarySearchTree<Key, Value, NodeT, Compare, Stats>::resetStats()
+{
+    stats_.reset();
+}
+
+/**
+* Wraps a node of this tree (or NULL for the end) in an iterator. The iterator's
+* constructor is only open to BinarySearchTree itself, so subclasses go through here.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::makeIterator(NodeT* node) const
+{
+    return iterator(node, this);
+}
+
+/**
+* Returns the node an iterator of this tree points at (NULL for the end).
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+NodeT* BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iteratorNode(const iterator& it)
+{
+    return it.current_;
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key,
+* or the end iterator if there is none. Takes a single descent from the root.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::lowerBound(const Key& key) const
+{
+    return iterator(lowerBoundNode(key), this);
+}
+
+/**
+* lowerBound() for any key type the transparent comparator accepts.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::lowerBound(const K& key) const
+{
+    return iterator(lowerBoundNode(key), this);
+}
+
+/**
+* Returns an iterator to the first item whose key is greater than key,
+* or the end iterator if there is none. Takes a single descent from the root.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::upperBound(const Key& key) const
+{
+    return iterator(upperBoundNode(key), this);
+}
+
+/**
+* upperBound() for any key type the transparent comparator accepts.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::upperBound(const K& key) const
+{
+    return iterator(upperBoundNode(key), this);
+}
+
+/**
+* Returns the range of items whose key equals key, as [lowerBound, upperBound).
+* Keys are unique, so the range holds at most one item.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+std::pair<typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator, typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator>
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::equalRange(const Key& key) const
+{
+    return equalRangeImpl(key);
+}
+
+/**
+* equalRange() for any key type the transparent comparator accepts. Such a
+* key can be equivalent to several keys of the tree (a prefix of string keys,
+* say), and the range holds all of them.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+template<typename K, typename C, typename>
+std::pair<typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator, typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator>
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::equalRange(const K& key) const
+{
+    return equalRangeImpl(key);
+}
+
+/**
+* Shared body of both equalRange() overloads. Like std::map::equal_range, the
+* end of the range is the upper bound, found with a second descent; it is
+* skipped when the lower bound is not equivalent to key, as the range is
+* empty then.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+template<typename K>
+std::pair<typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator, typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator>
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::equalRangeImpl(const K& key) const
+{
+    NodeT* first = lowerBoundNode(key);
+    NodeT* last = first;
+    if(first != NULL){
+        stats_.compared();
+        if(!comp_(key, first->getKey())){ //the lower bound is equivalent to key
+            last = upperBoundNode(key);
+        }
+    }
+    return std::make_pair(iterator(first, this), iterator(last, this));
+}
+
+/**
+* Returns the first node whose key is not less than key, or NULL. Costs one
+* comparison per level: a node whose key is not less than key is remembered
+* as the best so far and the search goes on to its left.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+template<typename K>
+NodeT* BinarySearchTree<Key, Value, NodeT, Compare, Stats>::lowerBoundNode(const K& key) const
+{
+    NodeT* curr = root_;
+    NodeT* bound = NULL;
+    size_t depth = 0; // only kept for stats_
+    while(curr != NULL){
+        stats_.visited();
+        stats_.compared();
+        ++depth;
+        bool less = comp_(curr->getKey(), key);
+        NodeT* left = curr->getLeft();
+        NodeT* right = curr->getRight();
+        bound = less ? bound : curr;
+        curr = less ? right : left;
+    }
+    stats_.reached(depth);
+    return bound;
+}
+
+/**
+* Returns the first node whose key is greater than key, or NULL, with one
+* comparison per level.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+template<typename K>
+NodeT* BinarySearchTree<Key, Value, NodeT, Compare, Stats>::upperBoundNode(const K& key) const
+{
+    NodeT* curr = root_;
+    NodeT* bound = NULL;
+    size_t depth = 0; // only kept for stats_
+    while(curr != NULL){
+        stats_.visited();
+        stats_.compared();
+        ++depth;
+        if(comp_(key, curr->getKey())){ //candidate; a smaller one may still be to the left
+            bound = curr;
+            curr = curr->getLeft();
+        }
+        else{ //everything here and to the left is too small
+            curr = curr->getRight();
+        }
+    }
+    stats_.reached(depth);
+    return bound;
+}
+
+/**
+* Calls visit(item) on every item with lo <= key < hi, in increasing key order.
+* Only the path down to lo and the visited region are touched, using an explicit
+* stack of pending nodes instead of the iterator's parent walks, so a scan costs
+* O(height + k) for k visited items.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+template<typename Visitor>
+void BinarySearchTree<Key, Value, NodeT, Compare, Stats>::rangeScan(const Key& lo, const Key& hi, Visitor visit) const
+{
+    std::vector<NodeT*> pending; //nodes >= lo whose own item and right subtree are still to come
+
+    NodeT* curr = root_;
+    while(curr != NULL){ //walk down to lo, remembering every node we pass on its left
+        if(comp_(curr->getKey(), lo)){
+            curr = curr->getRight();
+        }
+        else{
+            pending.push_back(curr);
+            curr = curr->getLeft();
+        }
+    }
+
+    while(!pending.empty()){
+        NodeT* n = pending.back();
+        pending.pop_back();
+        if(!comp_(n->getKey(), hi)){ //everything left is at least hi
+            break;
+        }
+        visit(n->getItem());
+        for(curr = n->getRight(); curr != NULL; curr = curr->getLeft()){ //the successors of n in its right subtree
+            pending.push_back(curr);
+        }
+    }
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+Value& BinarySearchTree<Key, Value, NodeT, Compare, Stats>::operator[](const Key& key)
+{
+    NodeT *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
     return curr->getValue();
 }
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+Value const & BinarySearchTree<Key, Value, NodeT, Compare, Stats>::operator[](const Key& key) const
+{
+    NodeT *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+
+/**
+* An insert method to insert into a Binary Search Tree.
+* The tree will not remain balanced when inserting.
+* Recall: If key is already in the tree, you should 
+* overwrite the current value with the updated value.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+void BinarySearchTree<Key, Value, NodeT, Compare, Stats>::insert(const std::pair<const Key, Value> &keyValuePair)
+{
+    // done
+		insertOrAssign(keyValuePair.first, keyValuePair.second);
+}
+
+/**
+* Same as above, but moves the value into the tree instead of copying it.
+* (The key is const inside the pair, so it is still copied.)
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+void BinarySearchTree<Key, Value, NodeT, Compare, Stats>::insert(std::pair<const Key, Value>&& keyValuePair)
+{
+		insertOrAssign(keyValuePair.first, std::move(keyValuePair.second));
+}
+
+/**
+* Inserts (or overwrites, like insert()) the pair, starting the search at hint
+* instead of the root. The cost depends on how far the key lands from hint: a
+* key that goes past the biggest (or smallest) key when hint is that end takes
+* a single comparison, so feeding back the iterator of the previous insert, or
+* end(), makes increasing or decreasing key streams O(1) each even on a plain
+* BST. Other keys next to hint take one comparison plus the walk up to the
+* nearest ancestor that bounds them. An end() hint means "after the biggest
+* key". A wrong hint is never worse than a search from the root plus that
+* walk. Returns an iterator to the item with the key.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::insert(iterator hint, const std::pair<const Key, Value>& keyValuePair)
+{
+		NodeT* near = hint.current_ != NULL ? hint.current_ : getLargestNode();
+		return insertOrAssignImpl(near, keyValuePair.first, keyValuePair.second).first;
+}
+
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::insert(iterator hint, std::pair<const Key, Value>&& keyValuePair)
+{
+		NodeT* near = hint.current_ != NULL ? hint.current_ : getLargestNode();
+		return insertOrAssignImpl(near, keyValuePair.first, std::move(keyValuePair.second)).first;
+}
+
+/**
+* Turns remembering the last inserted node on or off. While it is on, every
+* insert without a hint (insert(), emplace(), tryEmplace(), insertOrAssign()
+* and operator[]) is a finger search from the previous insert's node, as if
+* that node had been passed as the hint. Keys appended after the current
+* maximum (or before the minimum), such as timestamps or sequence ids, then
+* cost one comparison and no walk each, instead of one comparison per level.
+* Other nearby keys pay the walk up from the previous node to the nearest
+* ancestor that bounds them, and random keys pay that walk up to the root on
+* top of the usual descent, so it is off by default.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+void BinarySearchTree<Key, Value, NodeT, Compare, Stats>::rememberInserts(bool remember)
+{
+		rememberInserts_ = remember;
+		finger_ = NULL;
+}
+
+/**
+* Builds a key/value pair in place from args (anything std::pair<const Key, Value>
+* can be constructed from) and inserts it if its key is not already in the tree.
+* Returns an iterator to the item with that key and whether an insertion happened.
+* Like std::map::emplace, the node is built before the search, so prefer tryEmplace()
+* when the key is available on its own.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator, bool>
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::emplace(Args&&... args)
+{
+		NodeT* n = createNode(NULL, std::forward<Args>(args)...);
+		NodeT* parent = NULL;
+		bool goLeft = false;
+		NodeT* existing = findInsertPosition(n->getKey(), parent, goLeft);
+		if(existing != NULL){ //key already present, so throw the new node away
+			destroyNode(n);
+			return std::make_pair(iterator(existing, this), false);
+		}
+		n->setParent(parent);
+		linkNode(n, parent, goLeft);
+		return std::make_pair(iterator(n, this), true);
+}
+
+/**
+* Inserts the key with a value built in place from valueArgs, only if the key is
+* not already in the tree (in which case nothing is moved from the arguments).
+* Returns an iterator to the item with that key and whether an insertion happened.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+template<typename... ValueArgs>
+std::pair<typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator, bool>
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::tryEmplace(const Key& key, ValueArgs&&... valueArgs)
+{
+		return tryEmplaceImpl(key, std::forward<ValueArgs>(valueArgs)...);
+}
+
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+template<typename... ValueArgs>
+std::pair<typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator, bool>
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::tryEmplace(Key&& key, ValueArgs&&... valueArgs)
+{
+		return tryEmplaceImpl(std::move(key), std::forward<ValueArgs>(valueArgs)...);
+}
+
+/**
+* Inserts the key with the given value, or overwrites the value if the key
+* is already in the tree. Returns an iterator to the item with that key and
+* whether an insertion (rather than an assignment) happened.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+template<typename ValueArg>
+std::pair<typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator, bool>
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::insertOrAssign(const Key& key, ValueArg&& value)
+{
+		return insertOrAssignImpl(NULL, key, std::forward<ValueArg>(value));
+}
+
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+template<typename ValueArg>
+std::pair<typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator, bool>
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::insertOrAssign(Key&& key, ValueArg&& value)
+{
+		return insertOrAssignImpl(NULL, std::move(key), std::forward<ValueArg>(value));
+}
+
+/**
+* Shared body of both tryEmplace() overloads.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+template<typename KeyArg, typename... ValueArgs>
+std::pair<typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator, bool>
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::tryEmplaceImpl(KeyArg&& key, ValueArgs&&... valueArgs)
+{
+		NodeT* parent = NULL;
+		bool goLeft = false;
+		NodeT* existing = findInsertPosition(key, parent, goLeft);
+		if(existing != NULL){
+			return std::make_pair(iterator(existing, this), false);
+		}
+		NodeT* n = createNode(parent, std::piecewise_construct,
+			std::forward_as_tuple(std::forward<KeyArg>(key)),
+			std::forward_as_tuple(std::forward<ValueArgs>(valueArgs)...));
+		linkNode(n, parent, goLeft);
+		return std::make_pair(iterator(n, this), true);
+}
+
+/**
+* Shared body of both insertOrAssign() overloads and the hinted inserts. The
+* search is a finger search from near when it is given (see
+* findInsertPositionNear()), otherwise the usual findInsertPosition().
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+template<typename KeyArg, typename ValueArg>
+std::pair<typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator, bool>
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::insertOrAssignImpl(NodeT* near, KeyArg&& key, ValueArg&& value)
+{
+		NodeT* parent = NULL;
+		bool goLeft = false;
+		NodeT* existing = near != NULL ? findInsertPositionNear(near, key, parent, goLeft)
+		                               : findInsertPosition(key, parent, goLeft);
+		if(existing != NULL){ //the key already exists, so only update the value
+			existing->getValue() = std::forward<ValueArg>(value);
+			return std::make_pair(iterator(existing, this), false);
+		}
+		NodeT* n = createNode(parent, std::forward<KeyArg>(key), std::forward<ValueArg>(value));
+		linkNode(n, parent, goLeft);
+		return std::make_pair(iterator(n, this), true);
+}
+
+/**
+* Walks down from the root once, returning the node that already holds key, or
+* NULL along with the parent (NULL for an empty tree) and side the key belongs on.
+* Each level costs a single comparison: the search goes left whenever key is not
+* bigger than the node's, remembering the last such node, and only at the bottom
+* checks whether that node holds key itself (see internalFind()).
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+NodeT* BinarySearchTree<Key, Value, NodeT, Compare, Stats>::findInsertPosition(const Key& key, NodeT*& parent, bool& goLeft) const
+{
+		if(finger_ != NULL){ //rememberInserts() is on
+			return findInsertPositionNear(finger_, key, parent, goLeft);
+		}
+		return findInsertPositionBelow(root_, key, parent, goLeft);
+}
+
+/**
+* The descent behind findInsertPosition(), restricted to top's subtree, which
+* must be where key belongs. parent comes back NULL only when top is NULL.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+NodeT* BinarySearchTree<Key, Value, NodeT, Compare, Stats>::findInsertPositionBelow(NodeT* top, const Key& key, NodeT*& parent, bool& goLeft) const
+{
+		NodeT* curr = top;
+		NodeT* candidate = NULL; //last node we went left at, the only one that can hold key
+		size_t depth = 0; //only kept for stats_
+		parent = NULL;
+		goLeft = false;
+
+		while(curr != NULL){ //traverse to the bottom
+			stats_.visited();
+			stats_.compared();
+			++depth;
+			parent = curr;
+			goLeft = !comp_(curr->getKey(), key);
+			if(goLeft){
+				candidate = curr;
+				curr = curr->getLeft();
+			}
+			else{
+				curr = curr->getRight();
+			}
+		}
+
+		if(top == root_){ //depths below a finger are not depths in the tree
+			stats_.reached(depth + 1); //where a new node would go
+		}
+		if(candidate != NULL){
+			stats_.compared();
+			if(!comp_(key, candidate->getKey())){ //the key already exists
+				return candidate;
+			}
+		}
+		return NULL;
+}
+
+/**
+* Finger search: finds the same position as findInsertPosition(), starting at
+* finger (any node of the tree) instead of the root. Every node between finger
+* and the key is on one side of finger, so the search walks up until an
+* ancestor on the far side of the key bounds the subtree, and only those
+* ancestors are compared with key. Ancestors passed on the way that are still
+* on finger's side of key narrow the search to their other child, which is
+* where the descent starts. For a key d positions away from finger this
+* compares O(log d) keys on a balanced tree. When finger is the smallest or
+* biggest node and the key lies beyond it, the new node hangs straight off
+* finger after the one comparison, without walking up at all.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+NodeT* BinarySearchTree<Key, Value, NodeT, Compare, Stats>::findInsertPositionNear(NodeT* finger, const Key& key, NodeT*& parent, bool& goLeft) const
+{
+		stats_.visited();
+		stats_.compared();
+		int order = KeyOrder<Compare>::compare(comp_, key, finger->getKey());
+		if(order == 0){
+			return finger;
+		}
+		bool right = order > 0; //which side of finger the key is on
+		if(finger == (right ? largest_ : smallest_)){ //past the end of the tree, where finger has no child
+			parent = finger;
+			goLeft = !right;
+			return NULL;
+		}
+		NodeT* owner = finger; //the key belongs on this node's right (or left) side
+
+		for(NodeT* curr = finger; curr->getParent() != NULL; curr = curr->getParent()){
+			NodeT* up = curr->getParent();
+			if((up->getLeft() == curr) != right){ //up is on finger's side of key already
+				continue;
+			}
+			stats_.visited();
+			stats_.compared();
+			int upOrder = KeyOrder<Compare>::compare(comp_, key, up->getKey());
+			if(upOrder == 0){
+				return up;
+			}
+			if((upOrder > 0) != right){ //up bounds the key, so it is under curr
+				break;
+			}
+			owner = up;
+		}
+
+		NodeT* below = right ? owner->getRight() : owner->getLeft();
+		if(below == NULL){
+			parent = owner;
+			goLeft = !right;
+			return NULL;
+		}
+		return findInsertPositionBelow(below, key, parent, goLeft);
+}
+
+/**
+* Hangs a freshly created node (whose parent is already set) at the spot
+* findInsertPosition() returned and hands it to insertFix() for rebalancing.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+void BinarySearchTree<Key, Value, NodeT, Compare, Stats>::linkNode(NodeT* node, NodeT* parent, bool goLeft)
+{
+		if(parent == NULL){ //if this is the first node, it becomes the root
+			root_ = node;
+			smallest_ = node;
+			largest_ = node;
+		}
+		else if(goLeft){
+			parent->setLeft(node);
+			if(parent == smallest_){
+				smallest_ = node;
+			}
+		}
+		else{
+			parent->setRight(node);
+			if(parent == largest_){
+				largest_ = node;
+			}
+		}
+		if(rememberInserts_){
+			finger_ = node;
+		}
+		insertFix(node);
+}
 
 /**
-* An insert method to insert into a Binary Search Tree.
-* The tree will not remain balanced when inserting.
-* Recall: If key is already in the tree, you should 
-* overwrite the current value with the updated value.
+* Makes root (whose parent must be NULL) the whole tree, for operations that
+* rebuild or rearrange the tree without going through linkNode() and
+* unlinkNode(). Finds the smallest and biggest nodes again, in O(log n) on a
+* balanced tree, and forgets the finger, which may have left the tree.
 */
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+void BinarySearchTree<Key, Value, NodeT, Compare, Stats>::setRoot(NodeT* root)
 {
-    // done
-		bool done = false;
-
-		if(!done && root_==NULL){ //if this is the first node, simply make root_ a new node and finish
-			root_ = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, NULL);
-			done = true;
+		root_ = root;
+		finger_ = NULL;
+		smallest_ = root;
+		largest_ = root;
+		while(smallest_ != NULL && smallest_->getLeft() != NULL){
+			smallest_ = smallest_->getLeft();
 		}
+		while(largest_ != NULL && largest_->getRight() != NULL){
+			largest_ = largest_->getRight();
+		}
+}
 
-		if(!done && internalFind(keyValuePair.first)!=NULL){ //if this key already exists, update the value, and finish
-			Node<Key, Value>* update = internalFind(keyValuePair.first);
-			update->setValue(keyValuePair.second);
-			done = true;
+/**
+* Allocates a new node of this tree's node type from the pool, building its
+* item in place from itemArgs.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+template<typename... ItemArgs>
+NodeT* BinarySearchTree<Key, Value, NodeT, Compare, Stats>::createNode(NodeT* parent, ItemArgs&&... itemArgs)
+{
+		void* slot = pool_.allocate();
+		try{
+			return new (slot) NodeT(parent, std::forward<ItemArgs>(itemArgs)...);
+		}
+		catch(...){ //building the key or value threw, so give the slot back
+			pool_.deallocate(slot);
+			throw;
 		}
+}
 
-		Node<Key, Value>* toUpdate = root_;
-		while(!done){ //traverse to find the correct spot
+/**
+* Called after linkNode() hangs a new node in the tree. A plain
+* BST does not rebalance, so there is nothing to do.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+void BinarySearchTree<Key, Value, NodeT, Compare, Stats>::insertFix(NodeT* node)
+{
 
-			if(keyValuePair.first>toUpdate->getKey()){ //go right
-				if(toUpdate->getRight()==NULL){ //if there's an empty spot, put it there and finish
-					toUpdate->setRight(new Node<Key, Value>(keyValuePair.first, keyValuePair.second, toUpdate));
-					done = true;
-				}
-				else{ //no empty spot, continuing going down this tree
-					toUpdate = toUpdate->getRight();
-				}
-			}
+}
 
-			else if(keyValuePair.first<toUpdate->getKey()){ //go left
-				if(toUpdate->getLeft()==NULL){ //if there's an empty spot, put it there and finish
-					toUpdate->setLeft(new Node<Key, Value>(keyValuePair.first, keyValuePair.second, toUpdate));
-					done = true;
-				}
-				else{ //no empty spot, continue going down this tree
-					toUpdate = toUpdate->getLeft();
-				}
-			}
+/**
+* Called by unlinkNode() before it takes node out. Trees whose removeFix()
+* needs to know what the removal costs (the color a red-black tree loses)
+* record it here; the others have nothing to do.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+void BinarySearchTree<Key, Value, NodeT, Compare, Stats>::removeStart(NodeT* node)
+{
 
-		}
+}
 
 
+/**
+* Does nothing: a plain BST has no balance to restore after a removal.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+void BinarySearchTree<Key, Value, NodeT, Compare, Stats>::removeFix(NodeT* node)
+{
+
 }
 
+/**
+* Does nothing: the perfectly balanced tree assign() builds already has its
+* cached heights and sizes set. Trees that keep other per-node state set it here.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+void BinarySearchTree<Key, Value, NodeT, Compare, Stats>::assignFix()
+{
+
+}
 
 /**
 * A remove method to remove a specific key from a Binary Search Tree.
 * Recall: The writeup specifies that if a node has 2 children you
 * should swap with the predecessor and then remove.
+* The key is searched for once; the rest is erase().
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key)
+template<typename Key, typename Value, typename NodeT, typename Compare, typename Stats>
+void BinarySearchTree<Key, Value, NodeT, Compare, Stats>::remove(const Key& key)
 {
     // done
-		Node<Key, Value>* toRemove = internalFind(key);
+		NodeT* toRemove = internalFind(key);
 		if(toRemove==NULL){ //if the node doesn't exist
 			return;
 		}
+		NodeT* changed = unlinkNode(toRemove);
+		destroyNode(toRemove);
+		removeFix(changed);
+}
 
-		else if(toRemove->getLeft() == NULL && toRemove->getRight() == NULL){ //no children
-			if(toRemove == root_){ //if this is the root
-				root_ = NULL;
-			}
-			else if(toRemove->getParent()->getLeft() == toRemove){ //if this node is the left child of its parent
-				toRemove->getParent()->setLeft(NULL);
-			}
-			else if(toRemove->getParent()->getRight() == toRemove){ //if this node is the right child of its parent
-				toRemove->getParent()->setRight(NULL);
-			}
-		}
-
-		else if((toRemove->getLeft() != NULL && toRemove->getRight() == NULL) || (toRemove->getLeft() == NULL && toRemove->getRight() != NULL)){ //if only one child
-			if(toRemove->getLeft() != NULL && toRemove->getRight() == NULL){ //left child, no right child
-				Node<Key, Value>* n = toRemove->getLeft();
-				if(toRemove->getParent()==NULL){ //if this is the root 
-					root_ = n;
-					n->setParent(NULL);
-				}
-				else{ 
-					if(toRemove->getParent()->getRight()==toRemove){ //if the node is the right child of its parent
-						toRemove->getParent()->setRight(n); //make the child be the new right child
-					}
-					else if(toRemove->getParent()->getLeft()==toRemove){ //if the node is the left child of its parent
-						toRemove->getParent()->setLeft(n); //make the child be the new left child
-					}
-					n->setParent(toRemove->getParent()); //make the parent of the new child the parent
-				}
-			}
-
-			else if(toRemove->getLeft() == NULL && toRemove->getRight() != NULL){ //right child, no left child
-				Node<Key, Value>* n = toRemove->getRight();
-				if(toRemove->getParent()==NULL){ //if this is the root
-					root_ = n;
-					n->setParent(NULL);
-				}
-				else{ 
-					if(toRemove->getParent()->getRight()==toRemove){ //if the node is the right child of its parent
-						toRemove->getParent()->setRight(n); //make the child be the new right child
-					}
-					else if(toRemove->getParent()->getLeft()==toRemove){ //if the node is the left child of its parent
-						toRemove->getParent()->setLeft(n); //make the child be the new left child
-					}
-					n->setParent(toRemove->getParent()); //make the parent of the new child the parent
-				}
-			}
-		}
-
-		else{ //both children exist
-			/*Node<Key, Value>* parent = toRemove->getParent();
-			Node<Key, Value>* left = toRemove->getLeft();
-			Node<Key, Value>* right = toRemove->getRight();*/
-			Node<Key, Value>* pred = predecessor(toRemove);
-			nodeSwap(toRemove, pred);
-			if(toRemove->getLeft() == NULL && toRemove->getRight() == NULL){ //leaf (0 children case)
-				if(toRemove->getParent()==NULL){ //if we're at the root
-					root_ = NULL;
-				}
-				else if(toRemove->getParent()->getLeft() == toRemove){ //if this node is the left child of its parent
-					toRemove->getParent()->setLeft(NULL);
-				}
-				else if(toRemove->getParent()->getRight() == toRemove){ //if this node is the right child of its parent
-					toRemove->getParent()->setRight(NULL);
-				}
-			}
-			else if(toRemove->getLeft() != NULL && toRemove->getRight() == NULL){ //left child, no right child (1 child case)
-				Node<Key, Value>* n = toRemove->getLeft();
-				if(toRemove->getParent()==NULL){ //if this is the root
-					root_ = n;
-					n->setParent(NULL);
-				}
-				else{ 
-					if(toRemove->getParent()->getRight()==toRemove){ //if the node is the right child of its parent
-						toRemove->getParent()->setRight(n); //make the child be the new right child
-					}
-					else if(toRemove->getParent()->getLeft()==toRemove){ //if the node is the left child of its parent
-						toRemove->getParent()->setLeft(n); //make the child be the new left child
-					}
-					n->setParent(toRemove->getParent()); //make the parent of the new child the parent
-				}
-			}
-		}
+/**
+* Removes the item pos points at (which must not be the end) without
+* searching for its key, and returns an iterator to the item after it.
+* Iterators to other items stay valid.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::erase(iterator pos)
+{
+    iterator next = pos;
+    ++next;
+    NodeT* changed = unlinkNode(pos.current_);
+    destroyNode(pos.current_);
+    removeFix(changed);
+    return next;
+}
 
-		delete toRemove;
+/**
+* Removes the items in [first, last) and returns last. This version erases
+* them one at a time; AVLTree cuts the whole range out at once.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+typename BinarySearchTree<Key, Value, NodeT, Compare, Stats>::iterator
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::erase(iterator first, iterator last)
+{
+    while(first != last){
+        first = erase(first);
+    }
+    return last;
 }
 
+/**
+* Takes node out of the tree, leaving it to the caller to destroy. A node with
+* two children is replaced by its predecessor, which is moved into its place
+* (taking over its cached subtree data, see BasicNode::copySubtreeData())
+* rather than swapped with it, so only the links around the two nodes change.
+* Returns the lowest node whose subtree lost a node, where rebalancing has to
+* start, or NULL if that was the whole tree.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+NodeT* BinarySearchTree<Key, Value, NodeT, Compare, Stats>::unlinkNode(NodeT* node)
+{
+    removeStart(node);
+    if(node == smallest_){ //an end has at most one child, so it is never the node moved into a gap
+        smallest_ = successor(node);
+    }
+    if(node == largest_){
+        largest_ = predecessor(node);
+    }
+    NodeT* parent = node->getParent();
+    NodeT* replacement;
+    NodeT* changed = parent;
+    if(node->getLeft() != NULL && node->getRight() != NULL){
+        stats_.swapped();
+        replacement = predecessor(node);
+        if(replacement == node->getLeft()){ //it has no right child, so it just moves up
+            changed = replacement;
+        }
+        else{ //its left child takes its place first
+            changed = replacement->getParent();
+            changed->setRight(replacement->getLeft());
+            if(replacement->getLeft() != NULL){
+                replacement->getLeft()->setParent(changed);
+            }
+            replacement->setLeft(node->getLeft());
+            node->getLeft()->setParent(replacement);
+        }
+        replacement->setRight(node->getRight());
+        node->getRight()->setParent(replacement);
+        replacement->copySubtreeData(*node);
+    }
+    else{
+        replacement = node->getLeft() != NULL ? node->getLeft() : node->getRight();
+    }
 
+    if(replacement != NULL){
+        replacement->setParent(parent);
+    }
+    if(parent == NULL){
+        root_ = replacement;
+    }
+    else if(parent->getLeft() == node){
+        parent->setLeft(replacement);
+    }
+    else{
+        parent->setRight(replacement);
+    }
+    return changed;
+}
 
-template<class Key, class Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+NodeT*
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::predecessor(NodeT* current)
 {
     // done
-		bool exist;
+		bool exist = false;
 
 		if(current == NULL){ //if node is empty, then return null
 			return current;
@@ -651,7 +2132,7 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
 		else{ //if there's no left subtree, first ancestor whose right subtree contains this node
 			while(current->getParent() != NULL){ //keep looking at all parents
 				if(current->getParent()->getRight() == current){ //if the last checked node is in the right subtree of the parent
-					//current = current->getParent; //found
+					current = current->getParent(); //found
 					exist = true;
 					break;
 				}
@@ -666,96 +2147,438 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
 
 }
 
+/**
+* Returns the node that comes after current in key order, or NULL if it is
+* the biggest. Used by the iterators' operator++.
+*/
+template<class Key, class Value, class NodeT, class Compare, class Stats>
+NodeT*
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::successor(NodeT* current)
+{
+	NodeT* successor = current;
+	bool exist = false;
+
+	if(successor == NULL){ //if node is empty then return null
+		return NULL;
+	}
+
+	else if(successor->getRight() != NULL){ //if there is a right tree, we need to go all the way to the left
+		successor = successor->getRight(); //go right
+		while(successor->getLeft()!=NULL){ //keep going left until there are not more lefts to go
+				successor = successor->getLeft(); //the successor is this node
+		}
+		exist = true;
+	}
+
+	else{ //if there is no right tree, then the in-order successor will have to be someones parent
+		while(successor->getParent() != NULL){ 
+			if(successor->getParent()->getLeft() == successor){ //the first node in which the node is part of the left subtree
+				successor = successor->getParent();
+				exist = true;
+				break;
+			}
+			successor = successor->getParent();
+		}
+	}
+
+	if(!exist){
+		return NULL;
+	}
+	return successor;
+}
+
 
 /**
 * A method to remove all contents of the tree and
-* reset the values in the tree for use again.
+* reset the values in the tree for use again. The slabs are handed back even
+* when the tree is already empty, since one emptied by remove() or erase()
+* still holds every slab it ever allocated.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear()
+template<typename Key, typename Value, typename NodeT, typename Compare, typename Stats>
+void BinarySearchTree<Key, Value, NodeT, Compare, Stats>::clear()
 {
     // done
-		if(root_==NULL){
-			return;
+		if(root_ != NULL && !std::is_trivially_destructible<std::pair<const Key, Value> >::value){ //keys/values own resources, so their destructors still have to run
+			clearHelper(root_);
 		}
-		clearHelper(root_);
-		root_ = NULL;
+		setRoot(NULL);
+		pool_.release(); //hand back every slab at once instead of freeing node by node
 }
 
 /**
-*	Helper to do the recursion for clear()
+*	Helper for clear() that destroys every node of a subtree. Only runs the
+*	destructors; the memory itself is released with the whole pool afterwards.
+*	Instead of recursing (which overflows the stack on a degenerate tree), it
+*	rotates left children up until the current node has none, then destroys it
+*	and moves right, so it runs in O(n) time with O(1) extra space.
 *
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clearHelper(Node<Key, Value>* root)
+template<typename Key, typename Value, typename NodeT, typename Compare, typename Stats>
+void BinarySearchTree<Key, Value, NodeT, Compare, Stats>::clearHelper(NodeT* root)
 {
-		if(root!=NULL){
-			if(root->getLeft()!=NULL){
-				clearHelper(root->getLeft());
+		NodeT* curr = root;
+		while(curr != NULL){
+			NodeT* left = curr->getLeft();
+			if(left != NULL){ //right rotation: left's right subtree moves under curr, and left takes curr's place
+				curr->setLeft(left->getRight());
+				left->setRight(curr);
+				curr = left;
 			}
-			if(root->getRight()!=NULL){
-				clearHelper(root->getRight());
+			else{ //nothing smaller is left, so this node can go
+				NodeT* right = curr->getRight();
+				curr->~NodeT();
+				curr = right;
 			}
-			delete root;
 		}
 }
 
+/**
+*	Destroys a single node that has already been unlinked from the tree
+*	and returns its slot to the pool for the next insert to reuse.
+*
+*/
+template<typename Key, typename Value, typename NodeT, typename Compare, typename Stats>
+void BinarySearchTree<Key, Value, NodeT, Compare, Stats>::destroyNode(NodeT* node)
+{
+		if(node == finger_){
+			finger_ = NULL;
+		}
+		node->~NodeT();
+		pool_.deallocate(node);
+}
+
 
 /**
-* A helper function to find the smallest node in the tree.
+* Replaces the contents of the tree with the key/value pairs in [first, last),
+* which must be sorted by increasing key. Repeated keys are allowed and, like
+* repeated inserts, the last value for a key wins. The result is perfectly
+* balanced (so it is also a valid AVL tree) and is built in O(n) without any
+* searching or rotating. Throws std::invalid_argument if the range is not sorted;
+* if copying an item throws, the tree is left empty.
 */
-template<typename Key, typename Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode() const
+template<typename Key, typename Value, typename NodeT, typename Compare, typename Stats>
+template<typename ForwardIt>
+void BinarySearchTree<Key, Value, NodeT, Compare, Stats>::assign(ForwardIt first, ForwardIt last)
+{
+		//count the distinct keys first, so the shape of the tree is known up front
+		size_t count = 0;
+		ForwardIt prev = first;
+		for(ForwardIt it = first; it != last; ++it){
+			if(count > 0 && !comp_(prev->first, it->first)){
+				if(comp_(it->first, prev->first)){ //out of order
+					throw std::invalid_argument("Range is not sorted");
+				}
+				continue; //repeated key
+			}
+			prev = it;
+			++count;
+		}
+
+		clear();
+		setRoot(buildBalanced(first, last, count));
+		assignFix();
+}
+
+/**
+*	Helper for assign(), which consumes count distinct keys from first in order
+*	and returns the root of a perfectly balanced subtree holding them. The
+*	middle item becomes the root, so recursion depth is only O(log n).
+*
+*/
+template<typename Key, typename Value, typename NodeT, typename Compare, typename Stats>
+template<typename ForwardIt>
+NodeT* BinarySearchTree<Key, Value, NodeT, Compare, Stats>::buildBalanced(ForwardIt& first, ForwardIt last, size_t count)
 {
-    Node<Key, Value>* small = root_;
-		if(small == NULL){
-			return small;
+		if(count == 0){
+			return NULL;
+		}
+
+		size_t leftCount = (count - 1) / 2;
+		NodeT* left = buildBalanced(first, last, leftCount);
+
+		ForwardIt item = first; //the middle key; for repeated keys keep the last one
+		++first;
+		while(first != last && !comp_(item->first, first->first)){
+			item = first;
+			++first;
+		}
+
+		NodeT* n = NULL;
+		try{
+			n = createNode(NULL, item->first, item->second);
 		}
-		if(small->getLeft() != NULL){
-			while(small->getLeft()!=NULL){
-				small = small->getLeft();
+		catch(...){ //undo the left subtree so its destructors still run
+			if(left != NULL){
+				clearHelper(left);
 			}
+			throw;
+		}
+		n->setLeft(left);
+		if(left != NULL){
+			left->setParent(n);
+		}
+
+		NodeT* right = NULL;
+		try{
+			right = buildBalanced(first, last, count - 1 - leftCount);
+		}
+		catch(...){
+			clearHelper(n);
+			throw;
+		}
+		n->setRight(right);
+		if(right != NULL){
+			right->setParent(n);
 		}
-		return small;
+
+		n->updateFromChildren(); //children are final, so cached heights/sizes can be set
+		return n;
 }
 
 /**
-* Helper function to find a node with given key, k and
-* return a pointer to it or NULL if no item with that key
-* exists
+* Writes the tree to out as a binary snapshot that load() restores without any
+* searching or rebalancing. After a header (the magic "BSTS", the format
+* version, the snapshotKind() of this tree and the sizes of Key and Value)
+* every node follows in postorder, as a byte saying which children it has and
+* then its key and value as Serializer writes them; the same byte carries the
+* node's snapshot bit (a red-black color). An end byte and the node count close
+* the snapshot. Throws std::runtime_error if writing fails.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
+template<typename Key, typename Value, typename NodeT, typename Compare, typename Stats>
+void BinarySearchTree<Key, Value, NodeT, Compare, Stats>::save(std::ostream& out) const
 {
-    // done
-		bool found = false;
-		Node<Key, Value>* search = root_;
+		const uint32_t version = SNAPSHOT_VERSION;
+		const uint32_t keySize = sizeof(Key);
+		const uint32_t valueSize = sizeof(Value);
+		if(out.rdbuf()->sputn("BSTS", 4) != 4){
+			out.setstate(std::ios::badbit);
+		}
+		Serializer<uint32_t>::write(out, version);
+		Serializer<uint8_t>::write(out, snapshotKind());
+		Serializer<uint32_t>::write(out, keySize);
+		Serializer<uint32_t>::write(out, valueSize);
+
+		uint64_t count = 0;
+		for(NodeT* curr = postorderFirst(root_); curr != NULL; curr = postorderNext(curr)){
+			uint8_t children = (curr->getLeft() != NULL ? SNAPSHOT_HAS_LEFT : 0) |
+			                   (curr->getRight() != NULL ? SNAPSHOT_HAS_RIGHT : 0) |
+			                   (curr->getSnapshotBit() ? SNAPSHOT_NODE_BIT : 0);
+			Serializer<uint8_t>::write(out, children);
+			Serializer<Key>::write(out, curr->getKey());
+			Serializer<Value>::write(out, curr->getValue());
+			++count;
+		}
+		const uint8_t end = SNAPSHOT_END;
+		Serializer<uint8_t>::write(out, end);
+		Serializer<uint64_t>::write(out, count);
+		if(!out){
+			throw std::runtime_error("Could not write snapshot");
+		}
+}
 
-		while(!found && search!=NULL){ //while it hasn't been found and we haven't gone out of bounds
+/**
+* Replaces the contents of the tree with a snapshot written by save(), in a
+* single pass over the stream. Postorder means a node's subtrees are finished
+* by the time it is read, so each new node takes the last one or two finished
+* subtrees as its children and sets its height (and subtree size) from them.
+* Nothing is compared or rotated, and the tree comes back in exactly the shape
+* it was saved in. The keys are trusted to be in order under this tree's
+* Compare. Throws std::runtime_error, leaving the tree empty, if the snapshot
+* is malformed or truncated, was written for other Key or Value sizes, or comes
+* from a tree without this one's balance rules (an unbalanced BinarySearchTree
+* cannot be loaded into an AVLTree). On success the stream is left just past
+* the snapshot.
+*/
+template<typename Key, typename Value, typename NodeT, typename Compare, typename Stats>
+void BinarySearchTree<Key, Value, NodeT, Compare, Stats>::load(std::istream& in)
+{
+		clear();
 
-			if(search->getKey()==key){ //check the current node (first time will act as base case for the root)
-				found = true;
-				break;
+		char magic[4] = { 0, 0, 0, 0 };
+		uint32_t version = 0, keySize = 0, valueSize = 0;
+		uint8_t kind = PLAIN_SHAPE;
+		if(in.rdbuf()->sgetn(magic, 4) != 4 || std::string(magic, 4) != "BSTS"){
+			throw std::runtime_error("Not a tree snapshot");
+		}
+		Serializer<uint32_t>::read(in, version);
+		Serializer<uint8_t>::read(in, kind);
+		Serializer<uint32_t>::read(in, keySize);
+		Serializer<uint32_t>::read(in, valueSize);
+		if(!in || version != SNAPSHOT_VERSION){
+			throw std::runtime_error("Unsupported snapshot version");
+		}
+		if(keySize != sizeof(Key) || valueSize != sizeof(Value)){
+			throw std::runtime_error("Snapshot was saved with other key or value types");
+		}
+		if(kind != snapshotKind() && snapshotKind() != PLAIN_SHAPE){
+			throw std::runtime_error("Snapshot was saved from a tree with other balance rules");
+		}
+
+		std::vector<NodeT*> finished; //subtrees still waiting for their parent, in key order
+		NodeT* pending = NULL; //built but not in finished yet
+		try{
+			uint64_t count = 0;
+			while(true){
+				uint8_t children = SNAPSHOT_END;
+				Serializer<uint8_t>::read(in, children);
+				if(!in){
+					throw std::runtime_error("Snapshot is truncated");
+				}
+				if(children == SNAPSHOT_END){
+					break;
+				}
+				size_t needed = ((children & SNAPSHOT_HAS_LEFT) ? 1 : 0) + ((children & SNAPSHOT_HAS_RIGHT) ? 1 : 0);
+				if((children & ~(SNAPSHOT_HAS_LEFT | SNAPSHOT_HAS_RIGHT | SNAPSHOT_NODE_BIT)) != 0 || finished.size() < needed){
+					throw std::runtime_error("Snapshot is corrupt");
+				}
+				Key key = Key();
+				Value value = Value();
+				Serializer<Key>::read(in, key);
+				Serializer<Value>::read(in, value);
+				if(!in){
+					throw std::runtime_error("Snapshot is truncated");
+				}
+
+				pending = createNode(NULL, std::move(key), std::move(value));
+				if(children & SNAPSHOT_HAS_RIGHT){ //the right subtree was finished last
+					pending->setRight(finished.back());
+					finished.back()->setParent(pending);
+					finished.pop_back();
+				}
+				if(children & SNAPSHOT_HAS_LEFT){
+					pending->setLeft(finished.back());
+					finished.back()->setParent(pending);
+					finished.pop_back();
+				}
+				pending->setSnapshotBit((children & SNAPSHOT_NODE_BIT) != 0);
+				pending->updateFromChildren();
+				finished.push_back(pending);
+				pending = NULL;
+				++count;
 			}
 
-			if(search->getKey()<key){ //go right
-				search = search->getRight();
+			uint64_t saved = 0;
+			Serializer<uint64_t>::read(in, saved);
+			if(!in || saved != count || finished.size() > 1){
+				throw std::runtime_error("Snapshot is corrupt");
+			}
+		}
+		catch(...){ //destroy whatever was built, like clear() does
+			if(pending != NULL){
+				clearHelper(pending);
 			}
-			else if (search->getKey()>key){ //go left
-				search = search->getLeft();
+			for(size_t i = 0; i < finished.size(); ++i){
+				clearHelper(finished[i]);
 			}
+			pool_.release();
+			throw;
+		}
+		setRoot(finished.empty() ? NULL : finished.back());
+}
+
+/**
+* Plain binary search trees accept any shape, so they can load snapshots of
+* every kind of tree.
+*/
+template<typename Key, typename Value, typename NodeT, typename Compare, typename Stats>
+uint8_t BinarySearchTree<Key, Value, NodeT, Compare, Stats>::snapshotKind() const
+{
+		return PLAIN_SHAPE;
+}
+
+/**
+* Returns the first node of top's subtree in postorder (children before their
+* parent, left before right): the end of the path that goes left whenever it
+* can and right otherwise. NULL for an empty subtree.
+*/
+template<typename Key, typename Value, typename NodeT, typename Compare, typename Stats>
+NodeT* BinarySearchTree<Key, Value, NodeT, Compare, Stats>::postorderFirst(NodeT* top)
+{
+		if(top == NULL){
+			return NULL;
+		}
+		while(top->getLeft() != NULL || top->getRight() != NULL){
+			top = top->getLeft() != NULL ? top->getLeft() : top->getRight();
+		}
+		return top;
+}
+
+/**
+* Returns the node after node in postorder, or NULL after the root. A left
+* child is followed by its right sibling's subtree, if there is one; otherwise
+* a node is followed by its parent. Walking the whole tree this way is O(n)
+* and needs no stack.
+*/
+template<typename Key, typename Value, typename NodeT, typename Compare, typename Stats>
+NodeT* BinarySearchTree<Key, Value, NodeT, Compare, Stats>::postorderNext(NodeT* node)
+{
+		NodeT* parent = node->getParent();
+		if(parent != NULL && parent->getLeft() == node && parent->getRight() != NULL){
+			return postorderFirst(parent->getRight());
+		}
+		return parent;
+}
+
+
+/**
+* A helper function to find the smallest node in the tree, or NULL if the
+* tree is empty. It is kept up to date as the tree changes, so this is O(1).
+*/
+template<typename Key, typename Value, typename NodeT, typename Compare, typename Stats>
+NodeT*
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::getSmallestNode() const
+{
+		return smallest_;
+}
 
+/**
+* Returns the node with the biggest key, or NULL if the tree is empty, in O(1)
+* like getSmallestNode().
+*/
+template<typename Key, typename Value, typename NodeT, typename Compare, typename Stats>
+NodeT*
+BinarySearchTree<Key, Value, NodeT, Compare, Stats>::getLargestNode() const
+{
+		return largest_;
+}
+
+/**
+* Helper function to find a node with given key, k and
+* return a pointer to it or NULL if no item with that key
+* exists. Each level costs one three-way comparison (see KeyOrder),
+* and the next child is picked from its sign rather than branched to.
+*/
+template<typename Key, typename Value, typename NodeT, typename Compare, typename Stats>
+template<typename K>
+NodeT* BinarySearchTree<Key, Value, NodeT, Compare, Stats>::internalFind(const K& key) const
+{
+    // done
+		NodeT* search = root_;
+		size_t depth = 0; //only kept for stats_
+
+		while(search != NULL){
+			stats_.visited();
+			stats_.compared();
+			++depth;
+			int order = KeyOrder<Compare>::compare(comp_, key, search->getKey());
+			if(order == 0){ //found it
+				stats_.reached(depth);
+				return search;
+			}
+			search = order > 0 ? search->getRight() : search->getLeft(); //go right if it is bigger
 		}
 
-		return search;
+		stats_.reached(depth);
+		return NULL;
 }
 
 /**
- * Return true iff the BST is balanced.
+ * Return true iff the BST is balanced: the heights of the two subtrees of
+ * every node differ by at most one. Virtual, so a tree reached through a
+ * base reference is checked against its own rules.
  */
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const
+template<typename Key, typename Value, typename NodeT, typename Compare, typename Stats>
+bool BinarySearchTree<Key, Value, NodeT, Compare, Stats>::isBalanced() const
 {
     // done
 		if(isBalancedHelper(root_)>-1){
@@ -768,126 +2591,61 @@ bool BinarySearchTree<Key, Value>::isBalanced() const
 }
 
 /**
-*	Helper (taken from Lab 9)
+*	Helper (taken from Lab 9), rewritten as an iterative post-order walk so that
+*	checking a degenerate tree of any depth cannot overflow the stack. Returns the
+*	height of the subtree, or -1 as soon as an unbalanced node is found. Pending
+*	nodes and finished subtree heights are kept on heap-allocated stacks.
 *
 */
-template<typename Key, typename Value>
-int BinarySearchTree<Key, Value>::isBalancedHelper(Node<Key, Value>* root) const
+template<typename Key, typename Value, typename NodeT, typename Compare, typename Stats>
+int BinarySearchTree<Key, Value, NodeT, Compare, Stats>::isBalancedHelper(NodeT* root) const
 {
 	// Base case: an empty tree is always balanced and has a height of 0
 	if (root == nullptr) return 0;
 
-	// Think about cases to handle:
-	// - What if at least one subtree is NOT balanced?
-	// - What if BOTH are balanced?
+	std::vector<NodeT*> pending; //the path of nodes whose subtrees are not finished yet
+	std::vector<int> heights; //heights of finished subtrees, in post-order
+	NodeT* curr = root;
+	NodeT* lastFinished = NULL;
 
-	// done: handle the cases here
-  int Lheight = isBalancedHelper(root->getLeft());
-	int Rheight = isBalancedHelper(root->getRight());
+	while(curr != NULL || !pending.empty()){
+		if(curr != NULL){ //go as far left as possible first
+			pending.push_back(curr);
+			curr = curr->getLeft();
+			continue;
+		}
 
-	if(Lheight == -1 || Rheight == -1){
-		return -1;
-	}
-	else if(abs(Lheight-Rheight)>1){
-		return -1;
-	}
-	else{
-		if(Lheight>Rheight){
-			return Lheight + 1;
+		NodeT* top = pending.back();
+		if(top->getRight() != NULL && top->getRight() != lastFinished){ //right subtree still to do
+			curr = top->getRight();
+			continue;
 		}
-		else{
-			return Rheight + 1;
+
+		// both subtrees are finished, and their heights are on top of the stack (right above left)
+		int Rheight = 0;
+		if(top->getRight() != NULL){
+			Rheight = heights.back();
+			heights.pop_back();
+		}
+		int Lheight = 0;
+		if(top->getLeft() != NULL){
+			Lheight = heights.back();
+			heights.pop_back();
 		}
+
+		if(abs(Lheight-Rheight)>1){
+			return -1;
+		}
+		heights.push_back(1 + std::max(Lheight, Rheight));
+		lastFinished = top;
+		pending.pop_back();
 	}
 
+	return heights.back();
 }
 
 
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
-{
-    if((n1 == n2) || (n1 == NULL) || (n2 == NULL) ) {
-        return;
-    }
-    Node<Key, Value>* n1p = n1->getParent();
-    Node<Key, Value>* n1r = n1->getRight();
-    Node<Key, Value>* n1lt = n1->getLeft();
-    bool n1isLeft = false;
-    if(n1p != NULL && (n1 == n1p->getLeft())) n1isLeft = true;
-    Node<Key, Value>* n2p = n2->getParent();
-    Node<Key, Value>* n2r = n2->getRight();
-    Node<Key, Value>* n2lt = n2->getLeft();
-    bool n2isLeft = false;
-    if(n2p != NULL && (n2 == n2p->getLeft())) n2isLeft = true;
-
-
-    Node<Key, Value>* temp;
-    temp = n1->getParent();
-    n1->setParent(n2->getParent());
-    n2->setParent(temp);
-
-    temp = n1->getLeft();
-    n1->setLeft(n2->getLeft());
-    n2->setLeft(temp);
-
-    temp = n1->getRight();
-    n1->setRight(n2->getRight());
-    n2->setRight(temp);
-
-    if( (n1r != NULL && n1r == n2) ) {
-        n2->setRight(n1);
-        n1->setParent(n2);
-    }
-    else if( n2r != NULL && n2r == n1) {
-        n1->setRight(n2);
-        n2->setParent(n1);
-
-    }
-    else if( n1lt != NULL && n1lt == n2) {
-        n2->setLeft(n1);
-        n1->setParent(n2);
-
-    }
-    else if( n2lt != NULL && n2lt == n1) {
-        n1->setLeft(n2);
-        n2->setParent(n1);
-
-    }
-
-
-    if(n1p != NULL && n1p != n2) {
-        if(n1isLeft) n1p->setLeft(n2);
-        else n1p->setRight(n2);
-    }
-    if(n1r != NULL && n1r != n2) {
-        n1r->setParent(n2);
-    }
-    if(n1lt != NULL && n1lt != n2) {
-        n1lt->setParent(n2);
-    }
-
-    if(n2p != NULL && n2p != n1) {
-        if(n2isLeft) n2p->setLeft(n1);
-        else n2p->setRight(n1);
-    }
-    if(n2r != NULL && n2r != n1) {
-        n2r->setParent(n1);
-    }
-    if(n2lt != NULL && n2lt != n1) {
-        n2lt->setParent(n1);
-    }
-
-
-    if(this->root_ == n1) {
-        this->root_ = n2;
-    }
-    else if(this->root_ == n2) {
-        this->root_ = n1;
-    }
-
-}
-
 /**
  * Lastly, we are providing you with a print function,
    BinarySearchTree::printRoot().
@@ -0,0 +1,1193 @@
+#ifndef CONCURRENT_AVL_H
+#define CONCURRENT_AVL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "epoch.h"
+
+/**
+* A tiny test-and-test-and-set lock, small enough to live in every node.
+* Waiters yield rather than spin, since the holder may be descheduled.
+*/
+class SpinLock
+{
+public:
+    SpinLock() : locked_(false) {}
+
+    void lock()
+    {
+        while(locked_.exchange(true, std::memory_order_acquire)){
+            while(locked_.load(std::memory_order_relaxed)){
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    void unlock()
+    {
+        locked_.store(false, std::memory_order_release);
+    }
+
+private:
+    std::atomic<bool> locked_;
+};
+
+/**
+* An AVL tree that many threads can read and write at once, following the
+* optimistic design of Bronson, Casper, Chafi and Olukotun ("A Practical
+* Concurrent Binary Search Tree", PPoPP 2010).
+*
+* Readers (find, lowerBound and iteration) never lock. Every node carries a
+* version counter that a rotation marks while it moves the node down, and
+* bumps when it is done. A search reads a child, then checks that the parent's
+* version did not change in the meantime: if it did, the child may no longer
+* cover the key, and the search backs up one level and tries again.
+*
+* Writers lock only the nodes they change: an insert locks the parent it
+* attaches to, a rotation locks the parent, the node and the child(ren) it
+* moves, always top-down so locks cannot deadlock. Balance is restored after
+* the fact, one node at a time, so heights may briefly be off by more than one.
+* Removing a node with two children only clears its value and leaves it in
+* place as a routing node; it is unlinked once it is down to one child.
+*
+* Unlinked nodes and replaced values are retired through an EpochManager and
+* freed only when no operation that might still see them is running.
+*
+* Iterators hold a copy of the current item and advance by searching for the
+* next larger key, so they stay valid while the tree changes: keys come out in
+* increasing order, and a key present for the whole iteration is not skipped.
+*/
+template <typename Key, typename Value>
+class ConcurrentAVLTree
+{
+public:
+    ConcurrentAVLTree();
+    ~ConcurrentAVLTree();
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    bool empty() const;
+    size_t size() const;
+
+protected:
+    /**
+    * A node. The key and the fields a search reads come first, so that a search
+    * usually touches a single cache line per level. The root holder, a sentinel
+    * whose right child is the root, is a node whose key is never looked at.
+    */
+    struct CNode
+    {
+        CNode(const Key& k, CNode* p, int h)
+            : key(k), version(0), left(NULL), right(NULL), value(NULL), parent(p), height(h) {}
+        CNode* child(int dir) const { return (dir < 0 ? left : right).load(); }
+        void setChild(int dir, CNode* node) { (dir < 0 ? left : right).store(node); }
+
+        const Key key;
+        std::atomic<uint64_t> version; // UNLINKED, or a change count with the SHRINKING flag
+        std::atomic<CNode*> left;
+        std::atomic<CNode*> right;
+        std::atomic<Value*> value;     // NULL for routing nodes
+        std::atomic<CNode*> parent;
+        std::atomic<int> height;
+        SpinLock lock;
+    };
+
+public:
+    /**
+    * An iterator over the tree in increasing key order. It holds a copy of the
+    * item it is on, so dereferencing never touches the shared tree.
+    */
+    class iterator
+    {
+    public:
+        iterator();
+
+        const std::pair<Key, Value>& operator*() const;
+        const std::pair<Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class ConcurrentAVLTree<Key, Value>;
+        explicit iterator(const ConcurrentAVLTree<Key, Value>* tree);
+        const ConcurrentAVLTree<Key, Value>* tree_; // NULL for the end
+        std::pair<Key, Value> item_;
+    };
+
+public:
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lowerBound(const Key& key) const;
+
+protected:
+    ConcurrentAVLTree(const ConcurrentAVLTree& other);
+    ConcurrentAVLTree& operator=(const ConcurrentAVLTree& other);
+
+    static const uint64_t UNLINKED = 1;  // version of a node that has left the tree
+    static const uint64_t SHRINKING = 2; // set while a rotation moves the node down
+    static const uint64_t CHANGE = 4;    // added to the version once a rotation is done
+
+    // Results of nodeCondition() that are not a new height
+    static const int UNLINK_REQUIRED = -1;
+    static const int REBALANCE_REQUIRED = -2;
+    static const int NOTHING_REQUIRED = -3;
+
+    enum Attempt { FOUND, NOT_FOUND, DONE, RETRY };
+
+    static int compare(const Key& key, const Key& other);
+    static int height(const CNode* node);
+    static void waitUntilNotChanging(CNode* node);
+    static void deleteNode(void* node);
+    static void deleteValue(void* value);
+
+    // Readers
+    Attempt attemptGet(const Key& key, CNode* node, int dir, uint64_t nodeV, CNode*& found) const;
+    Attempt attemptCeiling(const Key* key, bool strict, CNode* node, int dir, uint64_t nodeV, CNode*& found) const;
+    bool nextItem(const Key* key, bool strict, std::pair<Key, Value>& item) const;
+
+    // Writers
+    Attempt attemptPut(const Key& key, Value*& fresh, CNode* node, int dir, uint64_t nodeV, EpochManager::Guard& guard);
+    Attempt attemptInsert(const Key& key, Value*& fresh, CNode* node, int dir, uint64_t nodeV, EpochManager::Guard& guard);
+    Attempt attemptUpdate(CNode* node, Value*& fresh, EpochManager::Guard& guard);
+    Attempt attemptRemove(const Key& key, CNode* node, int dir, uint64_t nodeV, EpochManager::Guard& guard);
+    Attempt attemptRemoveNode(CNode* parent, CNode* node, EpochManager::Guard& guard);
+    bool attemptUnlink(CNode* parent, CNode* node, EpochManager::Guard& guard);
+
+    // Relaxed rebalancing; the _nl helpers expect their nodes to be locked already
+    void fixHeightAndRebalance(CNode* node, EpochManager::Guard& guard);
+    int nodeCondition(CNode* node) const;
+    CNode* fixHeight_nl(CNode* node);
+    CNode* rebalance_nl(CNode* nParent, CNode* n, EpochManager::Guard& guard);
+    CNode* rebalanceToRight_nl(CNode* nParent, CNode* n, CNode* nL, int hR0);
+    CNode* rebalanceToLeft_nl(CNode* nParent, CNode* n, CNode* nR, int hL0);
+    CNode* rotateRight_nl(CNode* nParent, CNode* n, CNode* nL, int hR, int hLL, CNode* nLR, int hLR);
+    CNode* rotateLeft_nl(CNode* nParent, CNode* n, int hL, CNode* nR, CNode* nRL, int hRL, int hRR);
+    CNode* rotateRightOverLeft_nl(CNode* nParent, CNode* n, CNode* nL, int hR, int hLL, CNode* nLR, int hLRL);
+    CNode* rotateLeftOverRight_nl(CNode* nParent, CNode* n, int hL, CNode* nR, CNode* nRL, int hRR, int hRLR);
+
+    void destroySubtree(CNode* node);
+
+protected:
+    mutable CNode rootHolder_;
+    mutable EpochManager epochs_;
+    std::atomic<size_t> size_;
+};
+
+/*
+--------------------------------------------------------------
+Begin implementations for the ConcurrentAVLTree::iterator class.
+---------------------------------------------------------------
+*/
+
+/**
+* Default constructor for the end iterator.
+*/
+template<class Key, class Value>
+ConcurrentAVLTree<Key, Value>::iterator::iterator() : tree_(NULL), item_()
+{
+
+}
+
+/**
+* Constructor for an iterator whose item is about to be filled in by tree.
+*/
+template<class Key, class Value>
+ConcurrentAVLTree<Key, Value>::iterator::iterator(const ConcurrentAVLTree<Key, Value>* tree)
+    : tree_(tree), item_()
+{
+
+}
+
+/**
+* Provides access to the copy of the item.
+*/
+template<class Key, class Value>
+const std::pair<Key, Value>& ConcurrentAVLTree<Key, Value>::iterator::operator*() const
+{
+    return item_;
+}
+
+/**
+* Provides member access to the copy of the item.
+*/
+template<class Key, class Value>
+const std::pair<Key, Value>* ConcurrentAVLTree<Key, Value>::iterator::operator->() const
+{
+    return &item_;
+}
+
+/**
+* Checks if 'this' iterator is at the same key of the same tree as 'rhs'
+* (or both are end iterators).
+*/
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::iterator::operator==(const iterator& rhs) const
+{
+    if(tree_ == NULL || rhs.tree_ == NULL){
+        return tree_ == rhs.tree_;
+    }
+    return tree_ == rhs.tree_ && compare(item_.first, rhs.item_.first) == 0;
+}
+
+/**
+* Checks if 'this' iterator's internals have a different value as 'rhs'.
+*/
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Moves to the item with the next larger key that is in the tree now.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::iterator&
+ConcurrentAVLTree<Key, Value>::iterator::operator++()
+{
+    if(!tree_->nextItem(&item_.first, true, item_)){
+        tree_ = NULL;
+    }
+    return *this;
+}
+
+/*
+-------------------------------------------------------------
+End implementations for the ConcurrentAVLTree::iterator class.
+-------------------------------------------------------------
+*/
+
+/*
+-----------------------------------------------------
+Begin implementations for the ConcurrentAVLTree class.
+-----------------------------------------------------
+*/
+
+/**
+* Default constructor for an empty tree.
+*/
+template<class Key, class Value>
+ConcurrentAVLTree<Key, Value>::ConcurrentAVLTree() : rootHolder_(Key(), NULL, 0), size_(0)
+{
+
+}
+
+/**
+* Destructor, which frees every node. No other thread may be using the tree.
+* Retired nodes are freed by epochs_ afterwards.
+*/
+template<class Key, class Value>
+ConcurrentAVLTree<Key, Value>::~ConcurrentAVLTree()
+{
+    destroySubtree(rootHolder_.right.load());
+}
+
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::destroySubtree(CNode* node)
+{
+    if(node == NULL){
+        return;
+    }
+    destroySubtree(node->left.load());
+    destroySubtree(node->right.load());
+    delete node->value.load();
+    delete node;
+}
+
+/**
+* Returns true if the tree held no items when checked.
+*/
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::empty() const
+{
+    return size_.load() == 0;
+}
+
+/**
+* Returns the number of items in the tree when checked.
+*/
+template<class Key, class Value>
+size_t ConcurrentAVLTree<Key, Value>::size() const
+{
+    return size_.load();
+}
+
+/**
+* Three-way comparison built from operator<.
+*/
+template<class Key, class Value>
+int ConcurrentAVLTree<Key, Value>::compare(const Key& key, const Key& other)
+{
+    return key < other ? -1 : (other < key ? 1 : 0);
+}
+
+template<class Key, class Value>
+int ConcurrentAVLTree<Key, Value>::height(const CNode* node)
+{
+    return node == NULL ? 0 : node->height.load();
+}
+
+/**
+* Waits for a rotation that is moving node down to finish.
+*/
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::waitUntilNotChanging(CNode* node)
+{
+    while(node->version.load() & SHRINKING){
+        std::this_thread::yield();
+    }
+}
+
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::deleteNode(void* node)
+{
+    delete static_cast<CNode*>(node);
+}
+
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::deleteValue(void* value)
+{
+    delete static_cast<Value*>(value);
+}
+
+/**
+* Returns an iterator to the item with the smallest key.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::iterator
+ConcurrentAVLTree<Key, Value>::begin() const
+{
+    iterator it(this);
+    if(!nextItem(NULL, false, it.item_)){
+        it.tree_ = NULL;
+    }
+    return it;
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::iterator
+ConcurrentAVLTree<Key, Value>::end() const
+{
+    return iterator();
+}
+
+/**
+* Returns an iterator holding the item with the given key,
+* or the end iterator if the key is not in the tree. Takes no locks.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::iterator
+ConcurrentAVLTree<Key, Value>::find(const Key& key) const
+{
+    EpochManager::Guard guard(epochs_);
+    CNode* found = NULL;
+    Attempt result;
+    do{
+        result = attemptGet(key, &rootHolder_, 1, 0, found);
+    } while(result == RETRY);
+
+    iterator it;
+    Value* value = result == FOUND ? found->value.load() : NULL;
+    if(value != NULL){ //NULL means a routing node, whose key is not in the map
+        it.tree_ = this;
+        it.item_ = std::pair<Key, Value>(found->key, *value);
+    }
+    return it;
+}
+
+/**
+* Returns an iterator holding the first item whose key is not less than key,
+* or the end iterator if there is none. Takes no locks.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::iterator
+ConcurrentAVLTree<Key, Value>::lowerBound(const Key& key) const
+{
+    iterator it(this);
+    if(!nextItem(&key, false, it.item_)){
+        it.tree_ = NULL;
+    }
+    return it;
+}
+
+/**
+* Searches for key below node's dir child. nodeV is the version node had when
+* the search reached it; if node has changed since then, RETRY tells the
+* caller (one level up) to reread its child and go down again.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Attempt
+ConcurrentAVLTree<Key, Value>::attemptGet(const Key& key, CNode* node, int dir, uint64_t nodeV, CNode*& found) const
+{
+    while(true){
+        CNode* c = node->child(dir);
+        if(node->version.load() != nodeV){
+            return RETRY;
+        }
+        if(c == NULL){
+            return NOT_FOUND;
+        }
+        int nextDir = compare(key, c->key);
+        if(nextDir == 0){
+            found = c;
+            return FOUND;
+        }
+        uint64_t childV = c->version.load();
+        if(childV & SHRINKING){
+            waitUntilNotChanging(c);
+        }
+        else if(childV != UNLINKED && c == node->child(dir)){
+            if(node->version.load() != nodeV){
+                return RETRY;
+            }
+            Attempt result = attemptGet(key, c, nextDir, childV, found);
+            if(result != RETRY){
+                return result;
+            }
+        }
+        //otherwise the child changed under us; reread it
+    }
+}
+
+/**
+* Like attemptGet(), but finds the node with the smallest key after *key
+* (not less than it unless strict; the smallest of all if key is NULL).
+* NOT_FOUND means no key below node's dir child qualifies.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Attempt
+ConcurrentAVLTree<Key, Value>::attemptCeiling(const Key* key, bool strict, CNode* node, int dir,
+                                              uint64_t nodeV, CNode*& found) const
+{
+    while(true){
+        CNode* c = node->child(dir);
+        if(node->version.load() != nodeV){
+            return RETRY;
+        }
+        if(c == NULL){
+            return NOT_FOUND;
+        }
+        int cmp = key == NULL ? -1 : compare(*key, c->key);
+        if(cmp == 0 && !strict){
+            found = c;
+            return FOUND;
+        }
+        int nextDir = cmp < 0 ? -1 : 1; //c qualifies exactly when we go left
+        uint64_t childV = c->version.load();
+        if(childV & SHRINKING){
+            waitUntilNotChanging(c);
+        }
+        else if(childV != UNLINKED && c == node->child(dir)){
+            if(node->version.load() != nodeV){
+                return RETRY;
+            }
+            Attempt result = attemptCeiling(key, strict, c, nextDir, childV, found);
+            if(result == FOUND || (result == NOT_FOUND && nextDir > 0)){
+                return result;
+            }
+            if(result == NOT_FOUND && c->version.load() == childV){ //nothing smaller qualifies, so c is it
+                found = c;
+                return FOUND;
+            }
+        }
+    }
+}
+
+/**
+* Copies the first item after *key (see attemptCeiling()) into item.
+* Routing nodes have no item, so the search moves on past them.
+* Returns false if there is no such item.
+*/
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::nextItem(const Key* key, bool strict, std::pair<Key, Value>& item) const
+{
+    EpochManager::Guard guard(epochs_);
+    while(true){
+        CNode* found = NULL;
+        Attempt result = attemptCeiling(key, strict, &rootHolder_, 1, 0, found);
+        if(result == RETRY){
+            continue;
+        }
+        if(result == NOT_FOUND){
+            return false;
+        }
+        Value* value = found->value.load();
+        if(value != NULL){
+            item = std::pair<Key, Value>(found->key, *value);
+            return true;
+        }
+        key = &found->key; //found stays allocated while the guard is open
+        strict = true;
+    }
+}
+
+/**
+* Inserts a key/value pair, overwriting the value if the key is already in the tree.
+* Only the node the new leaf hangs from (or the node being updated) is locked.
+*/
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    Value* fresh = new Value(keyValuePair.second);
+    EpochManager::Guard guard(epochs_);
+    while(attemptPut(keyValuePair.first, fresh, &rootHolder_, 1, 0, guard) == RETRY){
+
+    }
+}
+
+/**
+* Puts fresh in as key's value below node's dir child, with the same retry
+* protocol as attemptGet().
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Attempt
+ConcurrentAVLTree<Key, Value>::attemptPut(const Key& key, Value*& fresh, CNode* node, int dir, uint64_t nodeV,
+                                          EpochManager::Guard& guard)
+{
+    while(true){
+        CNode* c = node->child(dir);
+        if(node->version.load() != nodeV){
+            return RETRY;
+        }
+        if(c == NULL){
+            if(attemptInsert(key, fresh, node, dir, nodeV, guard) == DONE){
+                return DONE;
+            }
+            continue;
+        }
+        int nextDir = compare(key, c->key);
+        if(nextDir == 0){
+            if(attemptUpdate(c, fresh, guard) == DONE){
+                return DONE;
+            }
+            continue;
+        }
+        uint64_t childV = c->version.load();
+        if(childV & SHRINKING){
+            waitUntilNotChanging(c);
+        }
+        else if(childV != UNLINKED && c == node->child(dir)){
+            if(node->version.load() != nodeV){
+                return RETRY;
+            }
+            if(attemptPut(key, fresh, c, nextDir, childV, guard) == DONE){
+                return DONE;
+            }
+        }
+    }
+}
+
+/**
+* Hangs a new leaf holding fresh off node's empty dir side, then repairs heights.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Attempt
+ConcurrentAVLTree<Key, Value>::attemptInsert(const Key& key, Value*& fresh, CNode* node, int dir, uint64_t nodeV,
+                                             EpochManager::Guard& guard)
+{
+    {
+        std::lock_guard<SpinLock> hold(node->lock);
+        if(node->version.load() != nodeV || node->child(dir) != NULL){
+            return RETRY;
+        }
+        CNode* leaf = new CNode(key, node, 1);
+        leaf->value.store(fresh);
+        fresh = NULL;
+        size_.fetch_add(1); //counted before it is visible, so a racing remove cannot drive size_ below 0
+        node->setChild(dir, leaf);
+    }
+    fixHeightAndRebalance(node, guard);
+    return DONE;
+}
+
+/**
+* Swaps fresh in as node's value. A routing node gets its key back this way.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Attempt
+ConcurrentAVLTree<Key, Value>::attemptUpdate(CNode* node, Value*& fresh, EpochManager::Guard& guard)
+{
+    std::lock_guard<SpinLock> hold(node->lock);
+    if(node->version.load() == UNLINKED){
+        return RETRY;
+    }
+    if(node->value.load() == NULL){
+        size_.fetch_add(1);
+    }
+    Value* old = node->value.exchange(fresh);
+    fresh = NULL;
+    if(old != NULL){ //readers may still be copying it
+        guard.retire(old, deleteValue);
+    }
+    return DONE;
+}
+
+/**
+* Removes the item with the given key, if there is one.
+*/
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::remove(const Key& key)
+{
+    EpochManager::Guard guard(epochs_);
+    while(attemptRemove(key, &rootHolder_, 1, 0, guard) == RETRY){
+
+    }
+}
+
+/**
+* Finds key below node's dir child and removes it, with the same retry
+* protocol as attemptGet().
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Attempt
+ConcurrentAVLTree<Key, Value>::attemptRemove(const Key& key, CNode* node, int dir, uint64_t nodeV,
+                                             EpochManager::Guard& guard)
+{
+    while(true){
+        CNode* c = node->child(dir);
+        if(node->version.load() != nodeV){
+            return RETRY;
+        }
+        if(c == NULL){
+            return DONE;
+        }
+        int nextDir = compare(key, c->key);
+        if(nextDir == 0){
+            if(attemptRemoveNode(node, c, guard) == DONE){
+                return DONE;
+            }
+            continue;
+        }
+        uint64_t childV = c->version.load();
+        if(childV & SHRINKING){
+            waitUntilNotChanging(c);
+        }
+        else if(childV != UNLINKED && c == node->child(dir)){
+            if(node->version.load() != nodeV){
+                return RETRY;
+            }
+            if(attemptRemove(key, c, nextDir, childV, guard) == DONE){
+                return DONE;
+            }
+        }
+    }
+}
+
+/**
+* Removes node's item. A node with two children becomes a routing node
+* (locking only the node); otherwise it is spliced out of the tree (locking
+* its parent too) and heights are repaired from the parent up.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Attempt
+ConcurrentAVLTree<Key, Value>::attemptRemoveNode(CNode* parent, CNode* node, EpochManager::Guard& guard)
+{
+    if(node->value.load() == NULL){ //already a routing node
+        return DONE;
+    }
+    Value* old = NULL;
+    if(node->left.load() != NULL && node->right.load() != NULL){
+        std::lock_guard<SpinLock> hold(node->lock);
+        if(node->version.load() == UNLINKED || node->left.load() == NULL || node->right.load() == NULL){
+            return RETRY;
+        }
+        old = node->value.exchange(NULL);
+    }
+    else{
+        {
+            std::lock_guard<SpinLock> holdParent(parent->lock);
+            if(parent->version.load() == UNLINKED || node->parent.load() != parent ||
+               node->version.load() == UNLINKED){
+                return RETRY;
+            }
+            std::lock_guard<SpinLock> hold(node->lock);
+            old = node->value.load();
+            if(old == NULL){
+                return DONE;
+            }
+            if(!attemptUnlink(parent, node, guard)){
+                return RETRY;
+            }
+        }
+        fixHeightAndRebalance(parent, guard);
+    }
+    if(old != NULL){
+        size_.fetch_sub(1);
+        guard.retire(old, deleteValue);
+    }
+    return DONE;
+}
+
+/**
+* Splices node, which has at most one child, out from under parent and
+* retires it. Both must be locked. Returns false if the shape has changed.
+*/
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::attemptUnlink(CNode* parent, CNode* node, EpochManager::Guard& guard)
+{
+    CNode* parentL = parent->left.load();
+    CNode* parentR = parent->right.load();
+    if(parentL != node && parentR != node){ //node is no longer a child of parent
+        return false;
+    }
+    CNode* left = node->left.load();
+    CNode* right = node->right.load();
+    if(left != NULL && right != NULL){ //splicing is no longer possible
+        return false;
+    }
+    CNode* splice = left != NULL ? left : right;
+    if(parentL == node){
+        parent->left.store(splice);
+    }
+    else{
+        parent->right.store(splice);
+    }
+    if(splice != NULL){
+        splice->parent.store(parent);
+    }
+    node->version.store(UNLINKED);
+    node->value.store(NULL);
+    guard.retire(node, deleteNode);
+    return true;
+}
+
+/**
+* Walks up from node fixing heights and rotating where needed, until a node
+* needs nothing. Every step locks just the node (and its parent, for rotations).
+* A rotation that leaves damage further down also changed the height under
+* its parent, so each such parent is looked at again once the walk from the
+* deeper damage has stopped.
+*/
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::fixHeightAndRebalance(CNode* node, EpochManager::Guard& guard)
+{
+    std::vector<CNode*> revisit;
+    while(true){
+        int condition = NOTHING_REQUIRED;
+        if(node != NULL && node->parent.load() != NULL && node->version.load() != UNLINKED){ //the root holder has no parent
+            condition = nodeCondition(node);
+        }
+        if(condition == NOTHING_REQUIRED){
+            if(revisit.empty()){
+                return;
+            }
+            node = revisit.back();
+            revisit.pop_back();
+            continue;
+        }
+        if(condition != UNLINK_REQUIRED && condition != REBALANCE_REQUIRED){
+            std::lock_guard<SpinLock> hold(node->lock);
+            node = fixHeight_nl(node);
+        }
+        else{
+            CNode* nParent = node->parent.load();
+            std::lock_guard<SpinLock> holdParent(nParent->lock);
+            if(nParent->version.load() != UNLINKED && node->parent.load() == nParent){
+                std::lock_guard<SpinLock> hold(node->lock);
+                node = rebalance_nl(nParent, node, guard);
+                if(node != NULL && node != nParent){
+                    revisit.push_back(nParent);
+                }
+            }
+            //otherwise node moved; look at it again
+        }
+    }
+}
+
+/**
+* Returns what node needs: UNLINK_REQUIRED for a routing node with at most one
+* child, REBALANCE_REQUIRED if its children's heights differ by more than one,
+* the height it should have if that is wrong, or NOTHING_REQUIRED.
+*/
+template<class Key, class Value>
+int ConcurrentAVLTree<Key, Value>::nodeCondition(CNode* node) const
+{
+    CNode* nL = node->left.load();
+    CNode* nR = node->right.load();
+    if((nL == NULL || nR == NULL) && node->value.load() == NULL){
+        return UNLINK_REQUIRED;
+    }
+    int hN = node->height.load();
+    int hL0 = height(nL);
+    int hR0 = height(nR);
+    // Anyone who changes a node goes on to fix it, so either these reads were
+    // consistent or someone else is now responsible for node or a child.
+    int hNRepl = 1 + std::max(hL0, hR0);
+    int bal = hL0 - hR0;
+    if(bal < -1 || bal > 1){
+        return REBALANCE_REQUIRED;
+    }
+    return hN != hNRepl ? hNRepl : NOTHING_REQUIRED;
+}
+
+/**
+* Fixes the height of a locked node. Returns the next node that needs
+* attention (its parent if the height changed), or NULL.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::CNode*
+ConcurrentAVLTree<Key, Value>::fixHeight_nl(CNode* node)
+{
+    int c = nodeCondition(node);
+    switch(c){
+    case REBALANCE_REQUIRED:
+    case UNLINK_REQUIRED:
+        return node; //needs more locks than we hold
+    case NOTHING_REQUIRED:
+        return NULL;
+    default:
+        node->height.store(c);
+        return node->parent.load();
+    }
+}
+
+/**
+* Unlinks, rotates or fixes the height of n, with n and its parent locked.
+* Returns the next node that needs attention, or NULL.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::CNode*
+ConcurrentAVLTree<Key, Value>::rebalance_nl(CNode* nParent, CNode* n, EpochManager::Guard& guard)
+{
+    CNode* nL = n->left.load();
+    CNode* nR = n->right.load();
+    if((nL == NULL || nR == NULL) && n->value.load() == NULL){
+        if(attemptUnlink(nParent, n, guard)){
+            return fixHeight_nl(nParent);
+        }
+        return n;
+    }
+    int hN = n->height.load();
+    int hL0 = height(nL);
+    int hR0 = height(nR);
+    int hNRepl = 1 + std::max(hL0, hR0);
+    int bal = hL0 - hR0;
+    if(bal > 1){
+        return rebalanceToRight_nl(nParent, n, nL, hR0);
+    }
+    else if(bal < -1){
+        return rebalanceToLeft_nl(nParent, n, nR, hL0);
+    }
+    else if(hNRepl != hN){
+        n->height.store(hNRepl);
+        return fixHeight_nl(nParent);
+    }
+    return NULL;
+}
+
+/**
+* n is left heavy: rotate it right, first rotating its left child left if
+* that child is right heavy.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::CNode*
+ConcurrentAVLTree<Key, Value>::rebalanceToRight_nl(CNode* nParent, CNode* n, CNode* nL, int hR0)
+{
+    {
+        std::lock_guard<SpinLock> holdL(nL->lock);
+        int hL = nL->height.load();
+        if(hL - hR0 <= 1){
+            return n; //changed since we looked; retry
+        }
+        CNode* nLR = nL->right.load();
+        int hLL0 = height(nL->left.load());
+        int hLR0 = height(nLR);
+        if(hLL0 >= hLR0){
+            return rotateRight_nl(nParent, n, nL, hR0, hLL0, nLR, hLR0);
+        }
+        {
+            std::lock_guard<SpinLock> holdLR(nLR->lock);
+            int hLR = nLR->height.load();
+            if(hLL0 >= hLR){
+                return rotateRight_nl(nParent, n, nL, hR0, hLL0, nLR, hLR);
+            }
+            // Only do the double rotation if it leaves nL balanced; otherwise fix nL on its own first
+            int hLRL = height(nLR->left.load());
+            int b = hLL0 - hLRL;
+            if(b >= -1 && b <= 1){
+                if(!((hLL0 == 0 || hLRL == 0) && nL->value.load() == NULL)){
+                    return rotateRightOverLeft_nl(nParent, n, nL, hR0, hLL0, nLR, hLRL);
+                }
+                // nL is a routing node that would be left with one child. Do just the
+                // first half: nL comes back as unlinkable, and once it is gone the walk
+                // back up reaches n again.
+                return rotateLeft_nl(n, nL, hLL0, nLR, nLR->left.load(), hLRL, height(nLR->right.load()));
+            }
+        }
+        return rebalanceToLeft_nl(n, nL, nLR, hLL0);
+    }
+}
+
+/**
+* Mirror image of rebalanceToRight_nl().
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::CNode*
+ConcurrentAVLTree<Key, Value>::rebalanceToLeft_nl(CNode* nParent, CNode* n, CNode* nR, int hL0)
+{
+    {
+        std::lock_guard<SpinLock> holdR(nR->lock);
+        int hR = nR->height.load();
+        if(hL0 - hR >= -1){
+            return n;
+        }
+        CNode* nRL = nR->left.load();
+        int hRL0 = height(nRL);
+        int hRR0 = height(nR->right.load());
+        if(hRR0 >= hRL0){
+            return rotateLeft_nl(nParent, n, hL0, nR, nRL, hRL0, hRR0);
+        }
+        {
+            std::lock_guard<SpinLock> holdRL(nRL->lock);
+            int hRL = nRL->height.load();
+            if(hRR0 >= hRL){
+                return rotateLeft_nl(nParent, n, hL0, nR, nRL, hRL, hRR0);
+            }
+            int hRLR = height(nRL->right.load());
+            int b = hRR0 - hRLR;
+            if(b >= -1 && b <= 1){
+                if(!((hRR0 == 0 || hRLR == 0) && nR->value.load() == NULL)){
+                    return rotateLeftOverRight_nl(nParent, n, hL0, nR, nRL, hRR0, hRLR);
+                }
+                return rotateRight_nl(n, nR, nRL, hRR0, height(nRL->left.load()), nRL->right.load(), hRLR);
+            }
+        }
+        return rebalanceToRight_nl(n, nR, nRL, hRR0);
+    }
+}
+
+/**
+* Rotates n right under nParent, bringing nL up. Only n moves down, so only
+* n is marked SHRINKING while the links change. Returns the deepest node
+* still damaged, or the result of fixing nParent's height.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::CNode*
+ConcurrentAVLTree<Key, Value>::rotateRight_nl(CNode* nParent, CNode* n, CNode* nL, int hR, int hLL,
+                                              CNode* nLR, int hLR)
+{
+    uint64_t nodeV = n->version.load();
+    CNode* nPL = nParent->left.load();
+    n->version.store(nodeV | SHRINKING);
+
+    n->left.store(nLR);
+    if(nLR != NULL){
+        nLR->parent.store(n);
+    }
+    nL->right.store(n);
+    n->parent.store(nL);
+    if(nPL == n){
+        nParent->left.store(nL);
+    }
+    else{
+        nParent->right.store(nL);
+    }
+    nL->parent.store(nParent);
+
+    int hNRepl = 1 + std::max(hLR, hR);
+    n->height.store(hNRepl);
+    nL->height.store(1 + std::max(hLL, hNRepl));
+    n->version.store(nodeV + CHANGE);
+
+    int balN = hLR - hR;
+    if(balN < -1 || balN > 1){ //n needs another rotation
+        return n;
+    }
+    if((nLR == NULL || hR == 0) && n->value.load() == NULL){ //n became an unlinkable routing node
+        return n;
+    }
+    int balL = hLL - hNRepl;
+    if(balL < -1 || balL > 1){
+        return nL;
+    }
+    if(hLL == 0 && nL->value.load() == NULL){
+        return nL;
+    }
+    return fixHeight_nl(nParent);
+}
+
+/**
+* Mirror image of rotateRight_nl().
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::CNode*
+ConcurrentAVLTree<Key, Value>::rotateLeft_nl(CNode* nParent, CNode* n, int hL, CNode* nR, CNode* nRL,
+                                             int hRL, int hRR)
+{
+    uint64_t nodeV = n->version.load();
+    CNode* nPL = nParent->left.load();
+    n->version.store(nodeV | SHRINKING);
+
+    n->right.store(nRL);
+    if(nRL != NULL){
+        nRL->parent.store(n);
+    }
+    nR->left.store(n);
+    n->parent.store(nR);
+    if(nPL == n){
+        nParent->left.store(nR);
+    }
+    else{
+        nParent->right.store(nR);
+    }
+    nR->parent.store(nParent);
+
+    int hNRepl = 1 + std::max(hL, hRL);
+    n->height.store(hNRepl);
+    nR->height.store(1 + std::max(hNRepl, hRR));
+    n->version.store(nodeV + CHANGE);
+
+    int balN = hRL - hL;
+    if(balN < -1 || balN > 1){
+        return n;
+    }
+    if((nRL == NULL || hL == 0) && n->value.load() == NULL){
+        return n;
+    }
+    int balR = hRR - hNRepl;
+    if(balR < -1 || balR > 1){
+        return nR;
+    }
+    if(hRR == 0 && nR->value.load() == NULL){
+        return nR;
+    }
+    return fixHeight_nl(nParent);
+}
+
+/**
+* Double rotation: nLR comes up over both nL and n, which both move down.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::CNode*
+ConcurrentAVLTree<Key, Value>::rotateRightOverLeft_nl(CNode* nParent, CNode* n, CNode* nL, int hR, int hLL,
+                                                      CNode* nLR, int hLRL)
+{
+    uint64_t nodeV = n->version.load();
+    uint64_t leftV = nL->version.load();
+    CNode* nPL = nParent->left.load();
+    CNode* nLRL = nLR->left.load();
+    CNode* nLRR = nLR->right.load();
+    int hLRR = height(nLRR);
+    n->version.store(nodeV | SHRINKING);
+    nL->version.store(leftV | SHRINKING);
+
+    n->left.store(nLRR);
+    if(nLRR != NULL){
+        nLRR->parent.store(n);
+    }
+    nL->right.store(nLRL);
+    if(nLRL != NULL){
+        nLRL->parent.store(nL);
+    }
+    nLR->left.store(nL);
+    nL->parent.store(nLR);
+    nLR->right.store(n);
+    n->parent.store(nLR);
+    if(nPL == n){
+        nParent->left.store(nLR);
+    }
+    else{
+        nParent->right.store(nLR);
+    }
+    nLR->parent.store(nParent);
+
+    int hNRepl = 1 + std::max(hLRR, hR);
+    n->height.store(hNRepl);
+    int hLRepl = 1 + std::max(hLL, hLRL);
+    nL->height.store(hLRepl);
+    nLR->height.store(1 + std::max(hLRepl, hNRepl));
+    n->version.store(nodeV + CHANGE);
+    nL->version.store(leftV + CHANGE);
+
+    int balN = hLRR - hR;
+    if(balN < -1 || balN > 1){
+        return n;
+    }
+    if((nLRR == NULL || hR == 0) && n->value.load() == NULL){
+        return n;
+    }
+    int balLR = hLRepl - hNRepl;
+    if(balLR < -1 || balLR > 1){
+        return nLR;
+    }
+    return fixHeight_nl(nParent);
+}
+
+/**
+* Mirror image of rotateRightOverLeft_nl().
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::CNode*
+ConcurrentAVLTree<Key, Value>::rotateLeftOverRight_nl(CNode* nParent, CNode* n, int hL, CNode* nR, CNode* nRL,
+                                                      int hRR, int hRLR)
+{
+    uint64_t nodeV = n->version.load();
+    uint64_t rightV = nR->version.load();
+    CNode* nPL = nParent->left.load();
+    CNode* nRLL = nRL->left.load();
+    CNode* nRLR = nRL->right.load();
+    int hRLL = height(nRLL);
+    n->version.store(nodeV | SHRINKING);
+    nR->version.store(rightV | SHRINKING);
+
+    n->right.store(nRLL);
+    if(nRLL != NULL){
+        nRLL->parent.store(n);
+    }
+    nR->left.store(nRLR);
+    if(nRLR != NULL){
+        nRLR->parent.store(nR);
+    }
+    nRL->right.store(nR);
+    nR->parent.store(nRL);
+    nRL->left.store(n);
+    n->parent.store(nRL);
+    if(nPL == n){
+        nParent->left.store(nRL);
+    }
+    else{
+        nParent->right.store(nRL);
+    }
+    nRL->parent.store(nParent);
+
+    int hNRepl = 1 + std::max(hL, hRLL);
+    n->height.store(hNRepl);
+    int hRRepl = 1 + std::max(hRLR, hRR);
+    nR->height.store(hRRepl);
+    nRL->height.store(1 + std::max(hNRepl, hRRepl));
+    n->version.store(nodeV + CHANGE);
+    nR->version.store(rightV + CHANGE);
+
+    int balN = hRLL - hL;
+    if(balN < -1 || balN > 1){
+        return n;
+    }
+    if((nRLL == NULL || hL == 0) && n->value.load() == NULL){
+        return n;
+    }
+    int balRL = hRRepl - hNRepl;
+    if(balRL < -1 || balRL > 1){
+        return nRL;
+    }
+    return fixHeight_nl(nParent);
+}
+
+/*
+---------------------------------------------------
+End implementations for the ConcurrentAVLTree class.
+---------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,324 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <set>
+#include <vector>
+
+/**
+* Epoch-based memory reclamation for lock-free readers.
+*
+* Every operation on a concurrent structure runs inside a Guard, which
+* announces the global epoch it started in. Memory unlinked from the
+* structure is retire()d rather than freed: it is tagged with the epoch at
+* the time, and only freed once the global epoch has moved two steps past
+* that tag. The global epoch only moves when every active guard has
+* announced the current one, so by then no guard that could still hold a
+* pointer to the memory is running.
+*
+* Each thread announces in a slot of its own, claimed the first time it opens
+* a guard on this manager and given back when the thread exits, so opening a
+* guard costs a store and a fence rather than a compare-and-swap on shared
+* memory. Guards may nest; only the outermost one announces.
+*/
+class EpochManager
+{
+    struct Slot;
+
+public:
+    EpochManager();
+    ~EpochManager();
+
+    class Guard
+    {
+    public:
+        explicit Guard(EpochManager& manager);
+        ~Guard();
+
+        void retire(void* p, void (*deleter)(void*));
+
+    private:
+        Guard(const Guard& other);
+        Guard& operator=(const Guard& other);
+
+        EpochManager& manager_;
+        Slot& slot_;
+    };
+
+private:
+    EpochManager(const EpochManager& other);
+    EpochManager& operator=(const EpochManager& other);
+
+    // Memory waiting for every reader that might see it to finish
+    struct Retired
+    {
+        void* p;
+        void (*deleter)(void*);
+        uint64_t epoch;
+    };
+
+    // One thread's announcement; its epoch is FREE while the thread has no guard open.
+    // The owning thread alone touches depth and the limbo list. Each slot gets
+    // its own cache line so announcing never contends with another thread.
+    struct alignas(64) Slot
+    {
+        Slot(void* memory) : owned(true), epoch(FREE), depth(0), next(NULL), memory(memory) {}
+        std::atomic<bool> owned;
+        std::atomic<uint64_t> epoch;
+        size_t depth; // guards open on this slot
+        std::vector<Retired> limbo;
+        Slot* next; // fixed once the slot is in the list
+        void* memory; // the allocation the slot was aligned within
+    };
+
+    // The slots a thread holds, one per manager it has used, given back when it exits
+    struct ThreadSlots
+    {
+        struct Entry
+        {
+            EpochManager* manager;
+            uint64_t id;
+            Slot* slot;
+        };
+        ~ThreadSlots();
+        std::vector<Entry> entries;
+    };
+
+    // Managers still alive, so an exiting thread only gives back slots that still exist
+    struct Registry
+    {
+        Registry() : lastId(0) {}
+        std::mutex lock;
+        std::set<uint64_t> live;
+        uint64_t lastId;
+    };
+
+    static const uint64_t FREE = 0;
+    static const size_t COLLECT_THRESHOLD = 64; // retired items per slot before trying to free some
+
+    static Registry& registry();
+    Slot& threadSlot();
+    Slot& claimSlot(ThreadSlots& mine);
+    bool tryAdvance();
+    void collect(Slot& slot);
+
+    std::atomic<uint64_t> global_; // starts at 1, so FREE never names an epoch
+    std::atomic<Slot*> slots_; // every slot ever claimed; slots are reused, never removed
+    uint64_t id_; // never reused, unlike the manager's address
+};
+
+/*
+  -----------------------------------------
+  Begin implementations for the EpochManager class.
+  -----------------------------------------
+*/
+
+inline EpochManager::EpochManager() : global_(1), slots_(NULL)
+{
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.lock);
+    id_ = ++reg.lastId;
+    reg.live.insert(id_);
+}
+
+/**
+* Destructor, which frees everything still retired. No guard may be open.
+*/
+inline EpochManager::~EpochManager()
+{
+    {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.lock);
+        reg.live.erase(id_);
+    }
+    Slot* slot = slots_.load();
+    while(slot != NULL){
+        for(size_t j = 0; j < slot->limbo.size(); ++j){
+            slot->limbo[j].deleter(slot->limbo[j].p);
+        }
+        Slot* next = slot->next;
+        void* memory = slot->memory;
+        slot->~Slot();
+        ::operator delete(memory);
+        slot = next;
+    }
+}
+
+/**
+* Returns the registry shared by every manager.
+*/
+inline EpochManager::Registry& EpochManager::registry()
+{
+    static Registry reg;
+    return reg;
+}
+
+/**
+* Destructor, run as the thread exits, which gives its slots back to the
+* managers that are still alive.
+*/
+inline EpochManager::ThreadSlots::~ThreadSlots()
+{
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.lock);
+    for(size_t i = 0; i < entries.size(); ++i){
+        if(reg.live.count(entries[i].id) != 0){
+            entries[i].slot->owned.store(false);
+        }
+    }
+}
+
+/**
+* Returns the calling thread's slot, claiming one on its first guard. The
+* manager used last is remembered, so the usual case is one comparison.
+*/
+inline EpochManager::Slot& EpochManager::threadSlot()
+{
+    static thread_local const EpochManager* lastManager = NULL; //plain thread-locals, which need no wrapper call
+    static thread_local uint64_t lastId = 0;
+    static thread_local Slot* lastSlot = NULL;
+    if(lastManager == this && lastId == id_){
+        return *lastSlot;
+    }
+    static thread_local ThreadSlots mine;
+    lastManager = this;
+    lastId = id_;
+    for(size_t i = 0; i < mine.entries.size(); ++i){
+        if(mine.entries[i].manager == this && mine.entries[i].id == id_){
+            lastSlot = mine.entries[i].slot;
+            return *lastSlot;
+        }
+    }
+    lastSlot = &claimSlot(mine);
+    return *lastSlot;
+}
+
+/**
+* Claims a slot for the calling thread: one given back by a thread that has
+* exited if there is one, otherwise a new one. Entries for managers that no
+* longer exist are dropped on the way, so a thread that uses many short-lived
+* trees does not collect entries.
+*/
+inline EpochManager::Slot& EpochManager::claimSlot(ThreadSlots& mine)
+{
+    {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.lock);
+        size_t kept = 0;
+        for(size_t i = 0; i < mine.entries.size(); ++i){
+            if(reg.live.count(mine.entries[i].id) != 0){
+                mine.entries[kept++] = mine.entries[i];
+            }
+        }
+        mine.entries.resize(kept);
+    }
+
+    Slot* slot = NULL;
+    for(Slot* s = slots_.load(); s != NULL && slot == NULL; s = s->next){
+        bool expected = false;
+        if(!s->owned.load() && s->owned.compare_exchange_strong(expected, true)){
+            slot = s;
+        }
+    }
+    if(slot == NULL){ //operator new only aligns to max_align_t before C++17, so align by hand
+        void* memory = ::operator new(sizeof(Slot) + alignof(Slot) - 1);
+        size_t misalignment = reinterpret_cast<uintptr_t>(memory) % alignof(Slot);
+        char* aligned = static_cast<char*>(memory) + (misalignment == 0 ? 0 : alignof(Slot) - misalignment);
+        slot = new(aligned) Slot(memory);
+        Slot* head = slots_.load();
+        do{
+            slot->next = head;
+        } while(!slots_.compare_exchange_weak(head, slot));
+    }
+    ThreadSlots::Entry entry = { this, id_, slot };
+    mine.entries.push_back(entry);
+    return *slot;
+}
+
+/**
+* Moves the global epoch forward if every open guard has announced it.
+* Returns true if the epoch moved (by this thread or another).
+*/
+inline bool EpochManager::tryAdvance()
+{
+    uint64_t epoch = global_.load();
+    for(Slot* slot = slots_.load(); slot != NULL; slot = slot->next){
+        uint64_t announced = slot->epoch.load();
+        if(announced != FREE && announced != epoch){
+            return false;
+        }
+    }
+    return global_.compare_exchange_strong(epoch, epoch + 1) || global_.load() != epoch;
+}
+
+/**
+* Frees the items of a slot's limbo list that no open guard can reach anymore.
+*/
+inline void EpochManager::collect(Slot& slot)
+{
+    const uint64_t epoch = global_.load();
+    size_t kept = 0;
+    for(size_t j = 0; j < slot.limbo.size(); ++j){
+        if(slot.limbo[j].epoch + 2 <= epoch){
+            slot.limbo[j].deleter(slot.limbo[j].p);
+        }
+        else{
+            slot.limbo[kept++] = slot.limbo[j];
+        }
+    }
+    slot.limbo.resize(kept);
+}
+
+/*
+  -----------------------------------------
+  Begin implementations for the EpochManager::Guard class.
+  -----------------------------------------
+*/
+
+/**
+* Enters a critical section: pointers read from the structure stay valid until the guard closes.
+* The fence keeps the structure's reads from moving ahead of the announcement.
+*/
+inline EpochManager::Guard::Guard(EpochManager& manager) : manager_(manager), slot_(manager.threadSlot())
+{
+    if(slot_.depth++ == 0){
+        slot_.epoch.store(manager.global_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+/**
+* Leaves the critical section. The thread keeps its slot for its next guard.
+*/
+inline EpochManager::Guard::~Guard()
+{
+    if(--slot_.depth == 0){
+        slot_.epoch.store(FREE, std::memory_order_release);
+    }
+}
+
+/**
+* Hands p to the manager, which calls deleter(p) once no guard can still see it.
+* p must already be unreachable for guards opened from now on.
+*/
+inline void EpochManager::Guard::retire(void* p, void (*deleter)(void*))
+{
+    Retired retired = { p, deleter, manager_.global_.load() };
+    slot_.limbo.push_back(retired);
+    if(slot_.limbo.size() >= COLLECT_THRESHOLD){
+        manager_.tryAdvance();
+        manager_.collect(slot_);
+    }
+}
+
+/*
+  ---------------------------------------
+  End implementations for the EpochManager class.
+  ---------------------------------------
+*/
+
+#endif
@@ -0,0 +1,445 @@
+#ifndef FROZEN_TREE_H
+#define FROZEN_TREE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+template <typename Key, typename Value, typename Compare>
+class MappedTree;
+
+/**
+* An immutable, read-only snapshot of a search tree, made by freeze().
+*
+* The keys are stored in one array in Eytzinger (breadth first) order:
+* slot k holds the root of an implicit perfectly balanced tree whose
+* children live in slots 2k and 2k+1 (slots are numbered from 1). The
+* values live in a parallel array at the same positions, so a search
+* only ever touches the keys. The first levels of the implicit tree
+* share a handful of cache lines, every search walks exactly the same
+* number of levels, and the next levels are prefetched while the
+* current one is compared, so a lookup avoids the cache miss per level
+* that chasing heap nodes costs.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class FrozenTree
+{
+public:
+    FrozenTree();
+    template<typename ForwardIt>
+    FrozenTree(ForwardIt first, ForwardIt last, const Compare& comp = Compare());
+
+    size_t size() const;
+    bool empty() const;
+
+    /**
+    * An iterator over the snapshot in increasing key order. Keys and values
+    * are kept apart, so dereferencing yields a pair of references rather
+    * than a reference to a stored pair.
+    */
+    class iterator
+    {
+    public:
+        typedef std::pair<const Key&, const Value&> reference;
+
+        // Lets it->first and it->second work on the pair made by operator*
+        struct ArrowProxy
+        {
+            reference item;
+            const reference* operator->() const { return &item; }
+        };
+
+        iterator();
+
+        reference operator*() const;
+        ArrowProxy operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class FrozenTree<Key, Value, Compare>;
+        iterator(const FrozenTree<Key, Value, Compare>* tree, size_t slot);
+        const FrozenTree<Key, Value, Compare>* tree_;
+        size_t slot_; // 1-based Eytzinger slot, or 0 for the end
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lowerBound(const Key& key) const;
+    Value const & operator[](const Key& key) const;
+    void save(std::ostream& out) const;
+
+    // Layout of the file save() writes, which MappedTree maps as it is
+    struct FileHeader
+    {
+        char magic[4];        // "BSTF"
+        uint32_t version;
+        uint32_t keySize;     // sizeof(Key) and sizeof(Value) of the writer
+        uint32_t valueSize;
+        uint64_t count;
+        uint64_t keysOffset;  // from the start of the file; both arrays start on a cache line
+        uint64_t valuesOffset;
+    };
+    enum { FILE_VERSION = 1, FILE_ALIGNMENT = 64 };
+
+protected:
+    // MappedTree runs the same searches over the arrays in its mapping
+    template <typename, typename, typename> friend class MappedTree;
+
+    size_t lowerBoundSlot(const Key& key) const;
+    static size_t lowerBoundSlot(const Key* keys, size_t n, const Key& key, const Compare& comp);
+    static size_t firstSlot(size_t n);
+    static size_t nextSlot(size_t slot, size_t n);
+    static uint64_t alignOffset(uint64_t offset);
+
+protected:
+    std::vector<Key> keys_;     // keys_[k - 1] holds slot k
+    std::vector<Value> values_; // values_[k - 1] belongs to keys_[k - 1]
+    Compare comp_;
+};
+
+/*
+--------------------------------------------------------
+Begin implementations for the FrozenTree::iterator class.
+--------------------------------------------------------
+*/
+
+/**
+* Default constructor for an iterator that points at nothing (the end).
+*/
+template<class Key, class Value, class Compare>
+FrozenTree<Key, Value, Compare>::iterator::iterator() : tree_(NULL), slot_(0)
+{
+
+}
+
+/**
+* Explicit constructor that initializes an iterator with a slot of the given snapshot.
+*/
+template<class Key, class Value, class Compare>
+FrozenTree<Key, Value, Compare>::iterator::iterator(const FrozenTree<Key, Value, Compare>* tree, size_t slot)
+    : tree_(tree), slot_(slot)
+{
+
+}
+
+/**
+* Provides access to the key and value of the item.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator::reference
+FrozenTree<Key, Value, Compare>::iterator::operator*() const
+{
+    return reference(tree_->keys_[slot_ - 1], tree_->values_[slot_ - 1]);
+}
+
+/**
+* Provides member access to the key and value of the item.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator::ArrowProxy
+FrozenTree<Key, Value, Compare>::iterator::operator->() const
+{
+    ArrowProxy proxy = { **this };
+    return proxy;
+}
+
+/**
+* Checks if 'this' iterator's internals have the same value as 'rhs'.
+* End iterators compare equal no matter which snapshot they came from.
+*/
+template<class Key, class Value, class Compare>
+bool FrozenTree<Key, Value, Compare>::iterator::operator==(const iterator& rhs) const
+{
+    return slot_ == rhs.slot_ && (slot_ == 0 || tree_ == rhs.tree_);
+}
+
+/**
+* Checks if 'this' iterator's internals have a different value as 'rhs'.
+*/
+template<class Key, class Value, class Compare>
+bool FrozenTree<Key, Value, Compare>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances the iterator's location to the next key in order.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator&
+FrozenTree<Key, Value, Compare>::iterator::operator++()
+{
+    slot_ = nextSlot(slot_, tree_->keys_.size());
+    return *this;
+}
+
+/*
+------------------------------------------------------
+End implementations for the FrozenTree::iterator class.
+------------------------------------------------------
+*/
+
+/*
+-----------------------------------------------
+Begin implementations for the FrozenTree class.
+-----------------------------------------------
+*/
+
+/**
+* Default constructor for an empty snapshot.
+*/
+template<class Key, class Value, class Compare>
+FrozenTree<Key, Value, Compare>::FrozenTree()
+{
+
+}
+
+/**
+* Builds a snapshot of the items in [first, last), which must be sorted by
+* strictly increasing key under comp (as a tree's own iteration is). The items are
+* copied into their Eytzinger slots by walking the implicit tree in order,
+* so the build is O(n).
+*/
+template<class Key, class Value, class Compare>
+template<typename ForwardIt>
+FrozenTree<Key, Value, Compare>::FrozenTree(ForwardIt first, ForwardIt last, const Compare& comp) : comp_(comp)
+{
+    std::vector<std::pair<const Key, Value> const *> sorted;
+    for(; first != last; ++first){
+        sorted.push_back(&*first);
+    }
+    const size_t n = sorted.size();
+
+    // rankOf[k - 1] is the position in sorted order of the item in slot k
+    std::vector<size_t> rankOf(n);
+    size_t rank = 0;
+    for(size_t slot = firstSlot(n); slot != 0; slot = nextSlot(slot, n)){
+        rankOf[slot - 1] = rank++;
+    }
+
+    keys_.reserve(n);
+    values_.reserve(n);
+    for(size_t k = 0; k < n; ++k){
+        keys_.push_back(sorted[rankOf[k]]->first);
+        values_.push_back(sorted[rankOf[k]]->second);
+    }
+}
+
+/**
+* Returns the number of items in the snapshot.
+*/
+template<class Key, class Value, class Compare>
+size_t FrozenTree<Key, Value, Compare>::size() const
+{
+    return keys_.size();
+}
+
+/**
+* Returns true if the snapshot holds no items.
+*/
+template<class Key, class Value, class Compare>
+bool FrozenTree<Key, Value, Compare>::empty() const
+{
+    return keys_.empty();
+}
+
+/**
+* Returns an iterator to the item with the smallest key.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator
+FrozenTree<Key, Value, Compare>::begin() const
+{
+    return iterator(this, firstSlot(keys_.size()));
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator
+FrozenTree<Key, Value, Compare>::end() const
+{
+    return iterator(this, 0);
+}
+
+/**
+* Returns an iterator to the item with the given key,
+* or the end iterator if the key is not in the snapshot.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator
+FrozenTree<Key, Value, Compare>::find(const Key& key) const
+{
+    size_t slot = lowerBoundSlot(key);
+    if(slot != 0 && comp_(key, keys_[slot - 1])){ //the lower bound is a bigger key
+        slot = 0;
+    }
+    return iterator(this, slot);
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key,
+* or the end iterator if there is none.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator
+FrozenTree<Key, Value, Compare>::lowerBound(const Key& key) const
+{
+    return iterator(this, lowerBoundSlot(key));
+}
+
+/**
+ * @precondition The key exists in the snapshot
+ * Returns the value associated with the key
+ */
+template<class Key, class Value, class Compare>
+Value const & FrozenTree<Key, Value, Compare>::operator[](const Key& key) const
+{
+    size_t slot = lowerBoundSlot(key);
+    if(slot == 0 || comp_(key, keys_[slot - 1])) throw std::out_of_range("Invalid key");
+    return values_[slot - 1];
+}
+
+/**
+* Writes the snapshot to out in a form MappedTree can serve lookups from
+* without reading it in: a FileHeader, then the keys and then the values, each
+* array exactly as it is laid out in memory and starting on a 64-byte boundary.
+* The Eytzinger layout has no pointers, only slot numbers, so the arrays mean
+* the same thing at any address. Key and Value must be trivially copyable, and
+* the file has the machine's byte order. Throws std::runtime_error if writing
+* fails.
+*/
+template<class Key, class Value, class Compare>
+void FrozenTree<Key, Value, Compare>::save(std::ostream& out) const
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "only snapshots of trivially copyable keys and values can be mapped");
+
+    FileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "BSTF", 4);
+    header.version = FILE_VERSION;
+    header.keySize = sizeof(Key);
+    header.valueSize = sizeof(Value);
+    header.count = keys_.size();
+    header.keysOffset = alignOffset(sizeof(FileHeader));
+    header.valuesOffset = alignOffset(header.keysOffset + keys_.size() * sizeof(Key));
+
+    const char padding[FILE_ALIGNMENT] = { 0 };
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(padding, header.keysOffset - sizeof(header));
+    out.write(reinterpret_cast<const char*>(keys_.data()), keys_.size() * sizeof(Key));
+    out.write(padding, header.valuesOffset - header.keysOffset - keys_.size() * sizeof(Key));
+    out.write(reinterpret_cast<const char*>(values_.data()), values_.size() * sizeof(Value));
+    if(!out){
+        throw std::runtime_error("Could not write snapshot");
+    }
+}
+
+/**
+* Returns the slot of the first key not less than key, or 0 if there is none.
+*/
+template<class Key, class Value, class Compare>
+size_t FrozenTree<Key, Value, Compare>::lowerBoundSlot(const Key& key) const
+{
+    return lowerBoundSlot(keys_.data(), keys_.size(), key, comp_);
+}
+
+/**
+* Returns the slot of the first of the n keys in Eytzinger order that is not
+* less than key, or 0 if there is none.
+*
+* The descent always runs to the bottom of the implicit tree: each level
+* appends one bit (1 for "went right") to k, which compiles to a compare and
+* an add rather than a branch. Going right means the key at that slot was too
+* small, so the answer is the last slot where we went left: strip the trailing
+* 1 bits (the final run of right turns) and the 0 bit before them.
+* Sixteen slots below k, i.e. four levels down, are the descendants of k that
+* share a 64-byte line for 4-byte keys; they are fetched ahead of time.
+*/
+template<class Key, class Value, class Compare>
+size_t FrozenTree<Key, Value, Compare>::lowerBoundSlot(const Key* keys, size_t n, const Key& key, const Compare& comp)
+{
+    size_t k = 1;
+    while(k <= n){
+#if defined(__GNUC__)
+        __builtin_prefetch(keys + (16 * k <= n ? 16 * k - 1 : 0));
+#endif
+        k = 2 * k + comp(keys[k - 1], key);
+    }
+#if defined(__GNUC__)
+    k >>= __builtin_ctzll(~(unsigned long long)k) + 1;
+#else
+    while(k & 1){
+        k >>= 1;
+    }
+    k >>= 1;
+#endif
+    return k;
+}
+
+/**
+* Returns the slot of the smallest key (the leftmost slot) of an implicit
+* tree with n slots, or 0 if it is empty.
+*/
+template<class Key, class Value, class Compare>
+size_t FrozenTree<Key, Value, Compare>::firstSlot(size_t n)
+{
+    if(n == 0){
+        return 0;
+    }
+    size_t k = 1;
+    while(2 * k <= n){
+        k *= 2;
+    }
+    return k;
+}
+
+/**
+* Returns the slot that comes after slot in order in an implicit tree
+* with n slots, or 0 after the last one.
+*/
+template<class Key, class Value, class Compare>
+size_t FrozenTree<Key, Value, Compare>::nextSlot(size_t slot, size_t n)
+{
+    if(2 * slot + 1 <= n){ //leftmost slot of the right subtree
+        slot = 2 * slot + 1;
+        while(2 * slot <= n){
+            slot *= 2;
+        }
+        return slot;
+    }
+    while(slot & 1){ //climb out of right subtrees
+        slot >>= 1;
+    }
+    return slot >> 1; //the first ancestor we are left of (0 past the root)
+}
+
+/**
+* Rounds a file offset up to the next FILE_ALIGNMENT boundary.
+*/
+template<class Key, class Value, class Compare>
+uint64_t FrozenTree<Key, Value, Compare>::alignOffset(uint64_t offset)
+{
+    return (offset + FILE_ALIGNMENT - 1) / FILE_ALIGNMENT * FILE_ALIGNMENT;
+}
+
+/*
+---------------------------------------------
+End implementations for the FrozenTree class.
+---------------------------------------------
+*/
+
+#endif
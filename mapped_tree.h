@@ -0,0 +1,364 @@
+#ifndef MAPPED_TREE_H
+#define MAPPED_TREE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "frozen_tree.h"
+
+/**
+* A read-only view of a FrozenTree file (see FrozenTree::save()) that answers
+* lookups straight from a memory mapping of the file.
+*
+* Opening the file maps it and checks its header. Nothing is read in or
+* built, so a view of any size opens in about the time of one mmap() call,
+* and the pages a lookup touches are faulted in on demand. The mapping is
+* shared and read-only, so every process that maps the same file uses the
+* same page cache pages instead of each holding its own copy of the tree.
+* Searches and iteration are FrozenTree's, run over the mapped arrays.
+* Needs POSIX mmap().
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class MappedTree
+{
+public:
+    explicit MappedTree(const std::string& path, const Compare& comp = Compare());
+    MappedTree(MappedTree&& other); // views are moved, never copied
+    MappedTree& operator=(MappedTree&& other);
+    ~MappedTree();
+
+    size_t size() const;
+    bool empty() const;
+
+    /**
+    * An iterator over the view in increasing key order. Like FrozenTree's, it
+    * yields a pair of references into the mapping.
+    */
+    class iterator
+    {
+    public:
+        typedef std::pair<const Key&, const Value&> reference;
+
+        // Lets it->first and it->second work on the pair made by operator*
+        struct ArrowProxy
+        {
+            reference item;
+            const reference* operator->() const { return &item; }
+        };
+
+        iterator();
+
+        reference operator*() const;
+        ArrowProxy operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class MappedTree<Key, Value, Compare>;
+        iterator(const MappedTree<Key, Value, Compare>* tree, size_t slot);
+        const MappedTree<Key, Value, Compare>* tree_;
+        size_t slot_; // 1-based Eytzinger slot, or 0 for the end
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lowerBound(const Key& key) const;
+    Value const & operator[](const Key& key) const;
+
+protected:
+    typedef FrozenTree<Key, Value, Compare> Layout;
+
+    void unmap();
+
+protected:
+    void* mapping_;       // the whole file, or NULL once moved from
+    size_t mappingSize_;
+    const Key* keys_;     // keys_[k - 1] holds slot k, inside the mapping
+    const Value* values_;
+    size_t size_;
+    Compare comp_;
+};
+
+/*
+--------------------------------------------------------
+Begin implementations for the MappedTree::iterator class.
+--------------------------------------------------------
+*/
+
+/**
+* Default constructor for an iterator that points at nothing (the end).
+*/
+template<class Key, class Value, class Compare>
+MappedTree<Key, Value, Compare>::iterator::iterator() : tree_(NULL), slot_(0)
+{
+
+}
+
+/**
+* Explicit constructor that initializes an iterator with a slot of the given view.
+*/
+template<class Key, class Value, class Compare>
+MappedTree<Key, Value, Compare>::iterator::iterator(const MappedTree<Key, Value, Compare>* tree, size_t slot)
+    : tree_(tree), slot_(slot)
+{
+
+}
+
+/**
+* Provides access to the key and value of the item.
+*/
+template<class Key, class Value, class Compare>
+typename MappedTree<Key, Value, Compare>::iterator::reference
+MappedTree<Key, Value, Compare>::iterator::operator*() const
+{
+    return reference(tree_->keys_[slot_ - 1], tree_->values_[slot_ - 1]);
+}
+
+/**
+* Provides member access to the key and value of the item.
+*/
+template<class Key, class Value, class Compare>
+typename MappedTree<Key, Value, Compare>::iterator::ArrowProxy
+MappedTree<Key, Value, Compare>::iterator::operator->() const
+{
+    ArrowProxy proxy = { **this };
+    return proxy;
+}
+
+/**
+* Checks if 'this' iterator's internals have the same value as 'rhs'.
+* End iterators compare equal no matter which view they came from.
+*/
+template<class Key, class Value, class Compare>
+bool MappedTree<Key, Value, Compare>::iterator::operator==(const iterator& rhs) const
+{
+    return slot_ == rhs.slot_ && (slot_ == 0 || tree_ == rhs.tree_);
+}
+
+/**
+* Checks if 'this' iterator's internals have a different value as 'rhs'.
+*/
+template<class Key, class Value, class Compare>
+bool MappedTree<Key, Value, Compare>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances the iterator's location to the next key in order.
+*/
+template<class Key, class Value, class Compare>
+typename MappedTree<Key, Value, Compare>::iterator&
+MappedTree<Key, Value, Compare>::iterator::operator++()
+{
+    slot_ = Layout::nextSlot(slot_, tree_->size_);
+    return *this;
+}
+
+/*
+------------------------------------------------------
+End implementations for the MappedTree::iterator class.
+------------------------------------------------------
+*/
+
+/*
+-----------------------------------------------
+Begin implementations for the MappedTree class.
+-----------------------------------------------
+*/
+
+/**
+* Maps the file at path, written by FrozenTree<Key, Value, Compare>::save().
+* Throws std::runtime_error if the file cannot be opened or mapped, or if it is
+* not such a file for this Key and Value (wrong magic, version, sizes, or
+* arrays that would run past the end of the file). comp must order keys the
+* same way the tree that wrote the file did.
+*/
+template<class Key, class Value, class Compare>
+MappedTree<Key, Value, Compare>::MappedTree(const std::string& path, const Compare& comp) :
+    mapping_(NULL), mappingSize_(0), keys_(NULL), values_(NULL), size_(0), comp_(comp)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+        throw std::runtime_error("Could not open " + path);
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(typename Layout::FileHeader)){
+        close(fd);
+        throw std::runtime_error(path + " is not a tree snapshot");
+    }
+    mappingSize_ = info.st_size;
+    void* mapping = mmap(NULL, mappingSize_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); //the mapping keeps the file open
+    if(mapping == MAP_FAILED){
+        throw std::runtime_error("Could not map " + path);
+    }
+    mapping_ = mapping;
+
+    typename Layout::FileHeader header;
+    std::memcpy(&header, mapping_, sizeof(header));
+    const uint64_t count = header.count;
+    const bool valid = std::memcmp(header.magic, "BSTF", 4) == 0 &&
+        header.version == Layout::FILE_VERSION &&
+        header.keySize == sizeof(Key) && header.valueSize == sizeof(Value) &&
+        header.keysOffset % Layout::FILE_ALIGNMENT == 0 && header.valuesOffset % Layout::FILE_ALIGNMENT == 0 &&
+        header.keysOffset <= mappingSize_ && count <= (mappingSize_ - header.keysOffset) / sizeof(Key) &&
+        header.valuesOffset <= mappingSize_ && count <= (mappingSize_ - header.valuesOffset) / sizeof(Value);
+    if(!valid){
+        unmap();
+        throw std::runtime_error(path + " is not a snapshot of this kind of tree");
+    }
+    keys_ = reinterpret_cast<const Key*>(static_cast<const char*>(mapping_) + header.keysOffset);
+    values_ = reinterpret_cast<const Value*>(static_cast<const char*>(mapping_) + header.valuesOffset);
+    size_ = count;
+}
+
+/**
+* Move constructor, which takes over other's mapping and leaves other empty.
+*/
+template<class Key, class Value, class Compare>
+MappedTree<Key, Value, Compare>::MappedTree(MappedTree&& other) :
+    mapping_(other.mapping_), mappingSize_(other.mappingSize_), keys_(other.keys_),
+    values_(other.values_), size_(other.size_), comp_(other.comp_)
+{
+    other.mapping_ = NULL;
+    other.mappingSize_ = 0;
+    other.size_ = 0;
+}
+
+/**
+* Move assignment, which unmaps this view's file and then takes over other's.
+*/
+template<class Key, class Value, class Compare>
+MappedTree<Key, Value, Compare>& MappedTree<Key, Value, Compare>::operator=(MappedTree&& other)
+{
+    if(this != &other){
+        unmap();
+        mapping_ = other.mapping_;
+        mappingSize_ = other.mappingSize_;
+        keys_ = other.keys_;
+        values_ = other.values_;
+        size_ = other.size_;
+        comp_ = other.comp_;
+        other.mapping_ = NULL;
+        other.mappingSize_ = 0;
+        other.size_ = 0;
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+MappedTree<Key, Value, Compare>::~MappedTree()
+{
+    unmap();
+}
+
+/**
+* Releases the mapping, leaving an empty view.
+*/
+template<class Key, class Value, class Compare>
+void MappedTree<Key, Value, Compare>::unmap()
+{
+    if(mapping_ != NULL){
+        munmap(mapping_, mappingSize_);
+    }
+    mapping_ = NULL;
+    mappingSize_ = 0;
+    size_ = 0;
+}
+
+/**
+* Returns the number of items in the view.
+*/
+template<class Key, class Value, class Compare>
+size_t MappedTree<Key, Value, Compare>::size() const
+{
+    return size_;
+}
+
+/**
+* Returns true if the view holds no items.
+*/
+template<class Key, class Value, class Compare>
+bool MappedTree<Key, Value, Compare>::empty() const
+{
+    return size_ == 0;
+}
+
+/**
+* Returns an iterator to the item with the smallest key.
+*/
+template<class Key, class Value, class Compare>
+typename MappedTree<Key, Value, Compare>::iterator
+MappedTree<Key, Value, Compare>::begin() const
+{
+    return iterator(this, Layout::firstSlot(size_));
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value, class Compare>
+typename MappedTree<Key, Value, Compare>::iterator
+MappedTree<Key, Value, Compare>::end() const
+{
+    return iterator(this, 0);
+}
+
+/**
+* Returns an iterator to the item with the given key,
+* or the end iterator if the key is not in the view.
+*/
+template<class Key, class Value, class Compare>
+typename MappedTree<Key, Value, Compare>::iterator
+MappedTree<Key, Value, Compare>::find(const Key& key) const
+{
+    size_t slot = Layout::lowerBoundSlot(keys_, size_, key, comp_);
+    if(slot != 0 && comp_(key, keys_[slot - 1])){ //the lower bound is a bigger key
+        slot = 0;
+    }
+    return iterator(this, slot);
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key,
+* or the end iterator if there is none.
+*/
+template<class Key, class Value, class Compare>
+typename MappedTree<Key, Value, Compare>::iterator
+MappedTree<Key, Value, Compare>::lowerBound(const Key& key) const
+{
+    return iterator(this, Layout::lowerBoundSlot(keys_, size_, key, comp_));
+}
+
+/**
+ * @precondition The key exists in the view
+ * Returns the value associated with the key
+ */
+template<class Key, class Value, class Compare>
+Value const & MappedTree<Key, Value, Compare>::operator[](const Key& key) const
+{
+    size_t slot = Layout::lowerBoundSlot(keys_, size_, key, comp_);
+    if(slot == 0 || comp_(key, keys_[slot - 1])) throw std::out_of_range("Invalid key");
+    return values_[slot - 1];
+}
+
+/*
+---------------------------------------------
+End implementations for the MappedTree class.
+---------------------------------------------
+*/
+
+#endif
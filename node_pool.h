@@ -0,0 +1,300 @@
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+/**
+* A slab allocator for the fixed-size nodes of a single search tree.
+* Nodes are carved out of large slabs (each one twice the size of the last,
+* up to a cap) so that neighbouring nodes share cache lines, freed nodes go
+* onto a free list that the next allocation reuses, and release() hands every
+* slab back at once instead of freeing nodes one by one.
+*
+* When a tree is split, the nodes of both halves stay where they are, so
+* the two pools then share the slabs allocated so far (see share()); those
+* slabs are only returned once neither pool needs them anymore.
+*/
+class NodePool
+{
+public:
+    explicit NodePool(size_t slotSize);
+    ~NodePool();
+
+    void* allocate();
+    void deallocate(void* slot);
+    void release();
+    void swap(NodePool& other);
+    void splice(NodePool& other);
+    void share(NodePool& other);
+
+private:
+    // A pool owns its slabs, so it cannot be copied
+    NodePool(const NodePool& other);
+    NodePool& operator=(const NodePool& other);
+
+    // Header placed at the start of every slab so they can be chained together
+    struct Slab
+    {
+        Slab* next;
+    };
+
+    // Free slots are linked through their own storage
+    struct FreeSlot
+    {
+        FreeSlot* next;
+    };
+
+    // Slabs that more than one pool hands out slots from, freed with the last owner
+    struct SharedSlabs
+    {
+        explicit SharedSlabs(Slab* head) : slabs(head) {}
+        ~SharedSlabs();
+
+        Slab* slabs;
+    };
+
+    static const size_t FIRST_SLAB_SLOTS = 32;
+    static const size_t MAX_SLAB_SLOTS = 8192;
+
+    static size_t roundUp(size_t bytes);
+    void grow();
+    void adoptShared(const std::vector<std::shared_ptr<SharedSlabs> >& shared);
+
+    size_t slotSize_;
+    size_t nextSlabSlots_;
+    Slab* slabs_;     // slabs only this pool hands out slots from
+    Slab* slabsTail_; // the oldest of them, so chains can be joined in O(1)
+    char* bump_;
+    char* bumpEnd_;
+    FreeSlot* free_;
+    FreeSlot* freeTail_; // last slot of the free list, valid while free_ is not NULL
+    std::vector<std::shared_ptr<SharedSlabs> > shared_;
+};
+
+/*
+  -----------------------------------------
+  Begin implementations for the NodePool class.
+  -----------------------------------------
+*/
+
+/**
+* Creates an empty pool handing out slots of at least slotSize bytes.
+* No memory is reserved until the first allocation.
+*/
+inline NodePool::NodePool(size_t slotSize) :
+    slotSize_(roundUp(slotSize < sizeof(FreeSlot) ? sizeof(FreeSlot) : slotSize)),
+    nextSlabSlots_(FIRST_SLAB_SLOTS),
+    slabs_(NULL),
+    slabsTail_(NULL),
+    bump_(NULL),
+    bumpEnd_(NULL),
+    free_(NULL),
+    freeTail_(NULL)
+{
+
+}
+
+/**
+* Destructor, which returns every slab. The objects living in the slots
+* must already have been destroyed by the owner.
+*/
+inline NodePool::~NodePool()
+{
+    release();
+}
+
+/**
+* Rounds a size up to the strictest fundamental alignment so that
+* consecutive slots (and the slab header) stay properly aligned.
+*/
+inline size_t NodePool::roundUp(size_t bytes)
+{
+    const size_t align = alignof(std::max_align_t);
+    return (bytes + align - 1) / align * align;
+}
+
+/**
+* Returns uninitialized storage for one node, preferring recently freed slots.
+*/
+inline void* NodePool::allocate()
+{
+    if(free_ != NULL){ //reuse a slot given back by a removal
+        FreeSlot* slot = free_;
+        free_ = slot->next;
+        return slot;
+    }
+    if(bump_ == bumpEnd_){ //current slab is used up
+        grow();
+    }
+    void* slot = bump_;
+    bump_ += slotSize_;
+    return slot;
+}
+
+/**
+* Puts a slot back on the free list. The object in it must already be destroyed.
+*/
+inline void NodePool::deallocate(void* slot)
+{
+    FreeSlot* freed = static_cast<FreeSlot*>(slot);
+    if(free_ == NULL){
+        freeTail_ = freed;
+    }
+    freed->next = free_;
+    free_ = freed;
+}
+
+/**
+* Returns every slab to the system at once and resets the pool to empty.
+* The objects living in the slots must already be destroyed (or be trivially
+* destructible). Shared slabs are only let go of; the last pool sharing them
+* returns them.
+*/
+inline void NodePool::release()
+{
+    while(slabs_ != NULL){
+        Slab* next = slabs_->next;
+        ::operator delete(slabs_);
+        slabs_ = next;
+    }
+    slabsTail_ = NULL;
+    shared_.clear();
+    nextSlabSlots_ = FIRST_SLAB_SLOTS;
+    bump_ = NULL;
+    bumpEnd_ = NULL;
+    free_ = NULL;
+    freeTail_ = NULL;
+}
+
+/**
+* Exchanges the slabs (and everything allocated from them) with another pool
+* of the same slot size, which is how trees hand their nodes off in O(1).
+*/
+inline void NodePool::swap(NodePool& other)
+{
+    std::swap(slotSize_, other.slotSize_);
+    std::swap(nextSlabSlots_, other.nextSlabSlots_);
+    std::swap(slabs_, other.slabs_);
+    std::swap(slabsTail_, other.slabsTail_);
+    std::swap(bump_, other.bump_);
+    std::swap(bumpEnd_, other.bumpEnd_);
+    std::swap(free_, other.free_);
+    std::swap(freeTail_, other.freeTail_);
+    shared_.swap(other.shared_);
+}
+
+/**
+* Takes over every slab of another pool of the same slot size, leaving it
+* empty, so that nodes allocated from either pool can live in one tree.
+* Other's free slots join this pool's free list; whatever is left of its
+* current slab stays unused until release(). Runs in O(1) plus the number
+* of slab groups the two pools share.
+*/
+inline void NodePool::splice(NodePool& other)
+{
+    if(other.slabs_ != NULL){
+        other.slabsTail_->next = slabs_;
+        if(slabs_ == NULL){
+            slabsTail_ = other.slabsTail_;
+        }
+        slabs_ = other.slabs_;
+    }
+    if(bump_ == NULL){ //nothing of our own to bump from yet, so continue with other's slab
+        bump_ = other.bump_;
+        bumpEnd_ = other.bumpEnd_;
+        nextSlabSlots_ = other.nextSlabSlots_;
+    }
+    if(other.free_ != NULL){
+        other.freeTail_->next = free_;
+        if(free_ == NULL){
+            freeTail_ = other.freeTail_;
+        }
+        free_ = other.free_;
+    }
+    adoptShared(other.shared_);
+
+    other.slabs_ = NULL;
+    other.slabsTail_ = NULL;
+    other.bump_ = NULL;
+    other.bumpEnd_ = NULL;
+    other.free_ = NULL;
+    other.freeTail_ = NULL;
+    other.shared_.clear();
+    other.nextSlabSlots_ = FIRST_SLAB_SLOTS;
+}
+
+/**
+* Lets another pool of the same slot size hold on to every slab allocated so
+* far, for when some of this pool's slots end up in the other pool's tree.
+* The slabs are handed to a shared owner that both pools keep a reference to.
+* Either pool may then deallocate() any of those slots, and allocates further
+* slots as usual. Runs in O(1) plus the number of slab groups already shared.
+*/
+inline void NodePool::share(NodePool& other)
+{
+    if(slabs_ != NULL){
+        shared_.push_back(std::shared_ptr<SharedSlabs>(new SharedSlabs(slabs_)));
+        slabs_ = NULL;
+        slabsTail_ = NULL;
+    }
+    other.adoptShared(shared_);
+}
+
+/**
+* Adds references to the given shared slab groups, skipping ones already held.
+*/
+inline void NodePool::adoptShared(const std::vector<std::shared_ptr<SharedSlabs> >& shared)
+{
+    for(size_t i = 0; i < shared.size(); ++i){
+        if(std::find(shared_.begin(), shared_.end(), shared[i]) == shared_.end()){
+            shared_.push_back(shared[i]);
+        }
+    }
+}
+
+/**
+* Returns a group of shared slabs once the last pool using them lets go.
+*/
+inline NodePool::SharedSlabs::~SharedSlabs()
+{
+    while(slabs != NULL){
+        Slab* next = slabs->next;
+        ::operator delete(slabs);
+        slabs = next;
+    }
+}
+
+/**
+* Allocates a new slab and makes it the one slots are bumped out of.
+*/
+inline void NodePool::grow()
+{
+    const size_t header = roundUp(sizeof(Slab));
+    char* memory = static_cast<char*>(::operator new(header + nextSlabSlots_ * slotSize_));
+
+    Slab* slab = reinterpret_cast<Slab*>(memory);
+    slab->next = slabs_;
+    if(slabs_ == NULL){
+        slabsTail_ = slab;
+    }
+    slabs_ = slab;
+
+    bump_ = memory + header;
+    bumpEnd_ = bump_ + nextSlabSlots_ * slotSize_;
+    if(nextSlabSlots_ < MAX_SLAB_SLOTS){
+        nextSlabSlots_ *= 2;
+    }
+}
+
+/*
+  ---------------------------------------
+  End implementations for the NodePool class.
+  ---------------------------------------
+*/
+
+#endif
@@ -0,0 +1,539 @@
+#ifndef RBBST_H
+#define RBBST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+#include "bst.h"
+
+/**
+* A node for a red-black tree, which adds its color to the BasicNode. New
+* nodes are red, since linking in a red leaf never changes a black height.
+*/
+template <typename Key, typename Value>
+class RBNode : public BasicNode<Key, Value, RBNode<Key, Value> >
+{
+public:
+    // Constructor.
+    RBNode(const Key& key, const Value& value, RBNode<Key, Value>* parent);
+    template<typename... ItemArgs>
+    explicit RBNode(RBNode<Key, Value>* parent, ItemArgs&&... itemArgs);
+
+    // Getter/setter for the node's color.
+    bool isRed() const;
+    void setRed(bool red);
+
+    // The color belongs to the position, so a node moving into another's place takes it over.
+    void copySubtreeData(const RBNode<Key, Value>& other);
+    // Snapshots carry the color, so load() needs no recoloring.
+    bool getSnapshotBit() const;
+    void setSnapshotBit(bool bit);
+
+protected:
+    bool red_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the RBNode class.
+  -------------------------------------------------
+*/
+
+/**
+* An explicit constructor to initialize the elements by calling the base class constructor and setting
+* the color to red since every new node will be red when it is first inserted.
+*/
+template<class Key, class Value>
+RBNode<Key, Value>::RBNode(const Key& key, const Value& value, RBNode<Key, Value>* parent) :
+    BasicNode<Key, Value, RBNode<Key, Value> >(key, value, parent), red_(true)
+{
+
+}
+
+/**
+* A constructor that builds the item in place from the given arguments,
+* so keys and values can be moved in. See BasicNode in bst.h.
+*/
+template<class Key, class Value>
+template<typename... ItemArgs>
+RBNode<Key, Value>::RBNode(RBNode<Key, Value>* parent, ItemArgs&&... itemArgs) :
+    BasicNode<Key, Value, RBNode<Key, Value> >(parent, std::forward<ItemArgs>(itemArgs)...), red_(true)
+{
+
+}
+
+/**
+* A getter for the color of a RBNode.
+*/
+template<class Key, class Value>
+bool RBNode<Key, Value>::isRed() const
+{
+    return red_;
+}
+
+/**
+* A setter for the color of a RBNode.
+*/
+template<class Key, class Value>
+void RBNode<Key, Value>::setRed(bool red)
+{
+    red_ = red;
+}
+
+/**
+* Takes over other's color when this node moves into its place, so the
+* color that actually leaves the tree is the one this node had.
+*/
+template<class Key, class Value>
+void RBNode<Key, Value>::copySubtreeData(const RBNode<Key, Value>& other)
+{
+    red_ = other.red_;
+}
+
+/**
+* The bit a snapshot keeps for this node is its color.
+*/
+template<class Key, class Value>
+bool RBNode<Key, Value>::getSnapshotBit() const
+{
+    return red_;
+}
+
+/**
+* Restores the color saved in a snapshot.
+*/
+template<class Key, class Value>
+void RBNode<Key, Value>::setSnapshotBit(bool bit)
+{
+    red_ = bit;
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the RBNode class.
+  -----------------------------------------------
+*/
+
+/**
+* A red-black tree: every node is red or black, a red node has no red child,
+* and every path from a node down to a missing child passes the same number of
+* black nodes. That keeps the height under 2 log2(n + 1), a little looser than
+* AVLTree's bound, in exchange for cheaper updates: an insert rotates at most
+* twice and a removal at most three times, and the rest of the fixing up is
+* recoloring, which stops on average after a constant number of levels. The
+* search, iterator and snapshot API is BinarySearchTree's.
+*/
+template <class Key, class Value, class Compare = std::less<Key>, class Stats = NoStats>
+class RedBlackTree : public BinarySearchTree<Key, Value, RBNode<Key, Value>, Compare, Stats>
+{
+public:
+    typedef typename BinarySearchTree<Key, Value, RBNode<Key, Value>, Compare, Stats>::iterator iterator;
+
+    RedBlackTree();
+    explicit RedBlackTree(const Compare& comp);
+    template<typename ForwardIt>
+    RedBlackTree(ForwardIt first, ForwardIt last, const Compare& comp = Compare());
+    RedBlackTree(RedBlackTree&& other);
+    RedBlackTree& operator=(RedBlackTree&& other);
+    virtual bool isBalanced() const; // checks the red-black rules rather than the AVL one
+
+protected:
+    virtual void insertFix(RBNode<Key, Value>* node);
+    virtual void removeStart(RBNode<Key, Value>* node);
+    virtual void removeFix(RBNode<Key, Value>* node);
+    virtual void assignFix();
+    virtual uint8_t snapshotKind() const;
+
+    static bool isRedNode(RBNode<Key, Value>* node); //a missing child counts as black
+    void rightRotate(RBNode<Key, Value>* y);
+    void leftRotate(RBNode<Key, Value>* x);
+    static void colorBalanced(RBNode<Key, Value>* node, size_t depth, size_t redDepth); //colors a tree built by assign()
+
+protected:
+    // What removeStart() found out about the node leaving the tree, for removeFix()
+    bool removedBlack_;               // a black node left, so one side is a black short
+    RBNode<Key, Value>* fixChild_;    // the child that moved up into its place, maybe NULL
+    bool fixLeft_;                    // which side of removeFix()'s node that child is on
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the RedBlackTree class.
+  -----------------------------------------------
+*/
+
+/**
+* Default constructor for an empty red-black tree.
+*/
+template<class Key, class Value, class Compare, class Stats>
+RedBlackTree<Key, Value, Compare, Stats>::RedBlackTree() :
+    removedBlack_(false), fixChild_(NULL), fixLeft_(false)
+{
+
+}
+
+/**
+* Constructor for an empty red-black tree that orders its keys with comp.
+*/
+template<class Key, class Value, class Compare, class Stats>
+RedBlackTree<Key, Value, Compare, Stats>::RedBlackTree(const Compare& comp) :
+    BinarySearchTree<Key, Value, RBNode<Key, Value>, Compare, Stats>(comp),
+    removedBlack_(false), fixChild_(NULL), fixLeft_(false)
+{
+
+}
+
+/**
+* Builds a red-black tree from a range of key/value pairs sorted by key in
+* O(n). See assign().
+*/
+template<class Key, class Value, class Compare, class Stats>
+template<typename ForwardIt>
+RedBlackTree<Key, Value, Compare, Stats>::RedBlackTree(ForwardIt first, ForwardIt last, const Compare& comp) :
+    BinarySearchTree<Key, Value, RBNode<Key, Value>, Compare, Stats>(comp),
+    removedBlack_(false), fixChild_(NULL), fixLeft_(false)
+{
+    this->assign(first, last);
+}
+
+/**
+* Move constructor, which takes over other's nodes in O(1).
+*/
+template<class Key, class Value, class Compare, class Stats>
+RedBlackTree<Key, Value, Compare, Stats>::RedBlackTree(RedBlackTree&& other) :
+    BinarySearchTree<Key, Value, RBNode<Key, Value>, Compare, Stats>(std::move(other)),
+    removedBlack_(false), fixChild_(NULL), fixLeft_(false)
+{
+
+}
+
+/**
+* Move assignment, which frees this tree's nodes and takes over other's in O(1).
+*/
+template<class Key, class Value, class Compare, class Stats>
+RedBlackTree<Key, Value, Compare, Stats>& RedBlackTree<Key, Value, Compare, Stats>::operator=(RedBlackTree&& other)
+{
+    BinarySearchTree<Key, Value, RBNode<Key, Value>, Compare, Stats>::operator=(std::move(other));
+    return *this;
+}
+
+/**
+* Called by BinarySearchTree::assign() once it has built its perfectly
+* balanced tree, whose nodes are all still red. Every level of that tree is
+* full except perhaps the last one, so coloring the nodes of an unfilled last
+* level red and all the others black satisfies the red-black rules.
+*/
+template<class Key, class Value, class Compare, class Stats>
+void RedBlackTree<Key, Value, Compare, Stats>::assignFix()
+{
+    if(this->root_ == NULL){
+        return;
+    }
+    //the middle item becomes each root with the smaller half on the left, so the
+    //leftmost path is the shortest one and the rightmost path the longest
+    size_t shortest = 0, longest = 0;
+    for(RBNode<Key, Value>* n = this->root_; n != NULL; n = n->getLeft()){
+        ++shortest;
+    }
+    for(RBNode<Key, Value>* n = this->root_; n != NULL; n = n->getRight()){
+        ++longest;
+    }
+    colorBalanced(this->root_, 0, shortest == longest ? longest : longest - 1);
+}
+
+/**
+* Helper for assignFix(): makes the nodes at depth redDepth red and the rest
+* black. The tree is balanced, so the recursion is only O(log n) deep.
+*/
+template<class Key, class Value, class Compare, class Stats>
+void RedBlackTree<Key, Value, Compare, Stats>::colorBalanced(RBNode<Key, Value>* node, size_t depth, size_t redDepth)
+{
+    if(node == NULL){
+        return;
+    }
+    node->setRed(depth == redDepth);
+    colorBalanced(node->getLeft(), depth + 1, redDepth);
+    colorBalanced(node->getRight(), depth + 1, redDepth);
+}
+
+/**
+* Return true iff the tree follows the red-black rules: the root is black, no
+* red node has a red child, and every path down from a node to a missing
+* child passes the same number of black nodes. The walk is the postorder one
+* save() uses, so it needs no recursion even on a broken tree.
+*/
+template<class Key, class Value, class Compare, class Stats>
+bool RedBlackTree<Key, Value, Compare, Stats>::isBalanced() const
+{
+    if(isRedNode(this->root_)){
+        return false;
+    }
+    std::vector<size_t> blackHeights; //of finished subtrees, in postorder
+    for(RBNode<Key, Value>* n = this->postorderFirst(this->root_); n != NULL; n = this->postorderNext(n)){
+        size_t rightHeight = 0, leftHeight = 0;
+        if(n->getRight() != NULL){
+            rightHeight = blackHeights.back();
+            blackHeights.pop_back();
+        }
+        if(n->getLeft() != NULL){
+            leftHeight = blackHeights.back();
+            blackHeights.pop_back();
+        }
+        if(leftHeight != rightHeight || (n->isRed() && (isRedNode(n->getLeft()) || isRedNode(n->getRight())))){
+            return false;
+        }
+        blackHeights.push_back(leftHeight + (n->isRed() ? 0 : 1));
+    }
+    return true;
+}
+
+/*
+ * Called by BinarySearchTree::linkNode() right after the new (red) node has
+ * been linked in. The only rule that can break is a red node under a red
+ * parent. While the parent's sibling is red too, recoloring the parent and
+ * its sibling black and the grandparent red moves the problem two levels up
+ * without rotating. Otherwise one single or double rotation at the
+ * grandparent ends it.
+ */
+template<class Key, class Value, class Compare, class Stats>
+void RedBlackTree<Key, Value, Compare, Stats>::insertFix(RBNode<Key, Value>* node)
+{
+		while(isRedNode(node->getParent())){
+			RBNode<Key, Value>* parent = node->getParent();
+			RBNode<Key, Value>* grandparent = parent->getParent(); //exists, since the root is black
+
+			if(parent == grandparent->getLeft()){
+				RBNode<Key, Value>* uncle = grandparent->getRight();
+				if(isRedNode(uncle)){ //recolor and carry on from the grandparent
+					parent->setRed(false);
+					uncle->setRed(false);
+					grandparent->setRed(true);
+					node = grandparent;
+					continue;
+				}
+				if(node == parent->getRight()){ //zig-zag: straighten it out first
+					leftRotate(parent);
+					parent = node;
+				}
+				parent->setRed(false);
+				grandparent->setRed(true);
+				rightRotate(grandparent);
+			}
+			else{ //mirror image of the above
+				RBNode<Key, Value>* uncle = grandparent->getLeft();
+				if(isRedNode(uncle)){
+					parent->setRed(false);
+					uncle->setRed(false);
+					grandparent->setRed(true);
+					node = grandparent;
+					continue;
+				}
+				if(node == parent->getLeft()){
+					rightRotate(parent);
+					parent = node;
+				}
+				parent->setRed(false);
+				grandparent->setRed(true);
+				leftRotate(grandparent);
+			}
+			break; //the subtree now has a black root, so nothing above changes
+		}
+
+		this->root_->setRed(false);
+}
+
+/*
+ * Called by BinarySearchTree::unlinkNode() before node comes out. The node
+ * that really leaves its position is node itself, or its predecessor if node
+ * has two children (the predecessor then takes over node's place and color).
+ * Records whether that position held a black node, and which child moves up
+ * into it and on which side, for removeFix().
+ */
+template<class Key, class Value, class Compare, class Stats>
+void RedBlackTree<Key, Value, Compare, Stats>::removeStart(RBNode<Key, Value>* node)
+{
+		RBNode<Key, Value>* gone = node;
+		if(node->getLeft() != NULL && node->getRight() != NULL){
+			gone = this->predecessor(node);
+			fixLeft_ = gone == node->getLeft(); //it moves up, keeping its left child on its left
+		}
+		else{
+			fixLeft_ = node->getParent() != NULL && node->getParent()->getLeft() == node;
+		}
+		removedBlack_ = !gone->isRed();
+		fixChild_ = gone->getLeft() != NULL ? gone->getLeft() : gone->getRight();
+}
+
+/*
+ * Called by BinarySearchTree::remove() and erase() once the node is out of
+ * the tree, with the node the moved-up child (fixChild_) now hangs from. If
+ * a black node went, every path through that child is one black short. A
+ * red child just turns black. Otherwise the shortage is pushed up by turning
+ * the sibling red while the sibling and its children are all black, and
+ * settled by at most three rotations as soon as it is not.
+ */
+template<class Key, class Value, class Compare, class Stats>
+void RedBlackTree<Key, Value, Compare, Stats>::removeFix(RBNode<Key, Value>* node)
+{
+		if(!removedBlack_){
+			return;
+		}
+		RBNode<Key, Value>* child = fixChild_;
+		RBNode<Key, Value>* parent = node;
+		bool onLeft = fixLeft_;
+
+		while(parent != NULL && !isRedNode(child)){
+			if(onLeft){
+				RBNode<Key, Value>* sibling = parent->getRight(); //never NULL: that side has a black more
+				if(sibling->isRed()){ //make the sibling black, so one of the cases below applies
+					sibling->setRed(false);
+					parent->setRed(true);
+					leftRotate(parent);
+					sibling = parent->getRight();
+				}
+				if(!isRedNode(sibling->getLeft()) && !isRedNode(sibling->getRight())){ //recolor and move up
+					sibling->setRed(true);
+					child = parent;
+					parent = child->getParent();
+					onLeft = parent != NULL && parent->getLeft() == child;
+					continue;
+				}
+				if(!isRedNode(sibling->getRight())){ //the red nephew is the inner one: rotate it outside
+					sibling->getLeft()->setRed(false);
+					sibling->setRed(true);
+					rightRotate(sibling);
+					sibling = parent->getRight();
+				}
+				sibling->setRed(parent->isRed());
+				parent->setRed(false);
+				sibling->getRight()->setRed(false);
+				leftRotate(parent);
+			}
+			else{ //mirror image of the above
+				RBNode<Key, Value>* sibling = parent->getLeft();
+				if(sibling->isRed()){
+					sibling->setRed(false);
+					parent->setRed(true);
+					rightRotate(parent);
+					sibling = parent->getLeft();
+				}
+				if(!isRedNode(sibling->getLeft()) && !isRedNode(sibling->getRight())){
+					sibling->setRed(true);
+					child = parent;
+					parent = child->getParent();
+					onLeft = parent != NULL && parent->getLeft() == child;
+					continue;
+				}
+				if(!isRedNode(sibling->getLeft())){
+					sibling->getRight()->setRed(false);
+					sibling->setRed(true);
+					leftRotate(sibling);
+					sibling = parent->getLeft();
+				}
+				sibling->setRed(parent->isRed());
+				parent->setRed(false);
+				sibling->getLeft()->setRed(false);
+				rightRotate(parent);
+			}
+			child = NULL; //the black count is restored
+			break;
+		}
+
+		if(child != NULL){ //a red node absorbs the missing black, as does the root
+			child->setRed(false);
+		}
+		if(this->root_ != NULL){
+			this->root_->setRed(false);
+		}
+}
+
+/**
+ * Snapshots of a red-black tree carry the colors, and only those can be
+ * loaded into one: load() keeps the saved shape and colors as they are.
+ */
+template<class Key, class Value, class Compare, class Stats>
+uint8_t RedBlackTree<Key, Value, Compare, Stats>::snapshotKind() const
+{
+    return this->RED_BLACK_SHAPE;
+}
+
+/**
+* Returns true if node is red; missing children are black.
+*/
+template<class Key, class Value, class Compare, class Stats>
+bool RedBlackTree<Key, Value, Compare, Stats>::isRedNode(RBNode<Key, Value>* node)
+{
+    return node != NULL && node->isRed();
+}
+
+/**
+* Rotates y's left child x up into y's place, making y its right child.
+* Colors are left to the caller.
+*/
+template<class Key, class Value, class Compare, class Stats>
+void RedBlackTree<Key, Value, Compare, Stats>::rightRotate(RBNode<Key, Value>* y)
+{
+	RBNode<Key, Value>* p = y->getParent();
+	RBNode<Key, Value>* x = y->getLeft();
+	RBNode<Key, Value>* b = x->getRight();
+	this->stats_.rotated();
+
+	y->setLeft(b); //b moves across from x to y
+	if(b != NULL){
+		b->setParent(y);
+	}
+	x->setRight(y);
+	y->setParent(x);
+	x->setParent(p);
+
+	if(p == NULL){ //y was the root
+		this->root_ = x;
+	}
+	else if(p->getLeft() == y){
+		p->setLeft(x);
+	}
+	else{
+		p->setRight(x);
+	}
+}
+
+/**
+* Rotates x's right child y up into x's place, making x its left child.
+* Colors are left to the caller.
+*/
+template<class Key, class Value, class Compare, class Stats>
+void RedBlackTree<Key, Value, Compare, Stats>::leftRotate(RBNode<Key, Value>* x)
+{
+	RBNode<Key, Value>* p = x->getParent();
+	RBNode<Key, Value>* y = x->getRight();
+	RBNode<Key, Value>* b = y->getLeft();
+	this->stats_.rotated();
+
+	x->setRight(b); //b moves across from y to x
+	if(b != NULL){
+		b->setParent(x);
+	}
+	y->setLeft(x);
+	x->setParent(y);
+	y->setParent(p);
+
+	if(p == NULL){ //x was the root
+		this->root_ = y;
+	}
+	else if(p->getLeft() == x){
+		p->setLeft(y);
+	}
+	else{
+		p->setRight(y);
+	}
+}
+
+/*
+  ---------------------------------------------
+  End implementations for the RedBlackTree class.
+  ---------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,384 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+* A fixed set of worker threads that run fork/join style recursions with
+* work stealing.
+*
+* A recursion is started with run(), which hands the outermost call to a
+* worker and waits for it. Inside, fork2(f, g) runs f itself and offers g to
+* the other workers: g goes on the back of the worker's own deque, and idle
+* workers steal from the front of other workers' deques. The front holds the
+* oldest, and so the biggest, pieces of the recursion, so one steal moves a
+* large amount of work. When f is done the worker takes g back if nobody
+* stole it, otherwise it runs other tasks until g has been finished.
+*
+* Each deque is guarded by a mutex rather than being lock-free: tasks are
+* meant to be coarse (whole subtrees of hundreds of nodes or more), so the
+* lock is taken rarely compared to the work done per task.
+*
+* Tasks must not outlive the fork2() or run() call that made them, so they
+* live on the stack of the forking thread and nothing is allocated per task.
+*/
+class TaskPool
+{
+public:
+    explicit TaskPool(unsigned threads = std::thread::hardware_concurrency());
+    ~TaskPool();
+
+    unsigned size() const;
+    template<typename F>
+    void run(F&& f);
+    template<typename F, typename G>
+    void fork2(F&& f, G&& g);
+
+    static TaskPool& shared();
+
+private:
+    TaskPool(const TaskPool& other);
+    TaskPool& operator=(const TaskPool& other);
+
+    // A unit of work that can be stolen; done is set once it has run
+    struct Task
+    {
+        Task() : done(false) {}
+        virtual ~Task() {}
+        virtual void execute() = 0;
+
+        std::atomic<bool> done;
+        std::exception_ptr error; // what the work threw, rethrown by whoever waits
+    };
+
+    template<typename F>
+    struct FunctionTask : public Task
+    {
+        explicit FunctionTask(F& function) : f(function) {}
+        void execute();
+
+        F& f;
+    };
+
+    struct Worker
+    {
+        std::mutex lock;
+        std::deque<Task*> tasks; // the owner works at the back, thieves take from the front
+        std::thread thread;
+    };
+
+    // The pool (if any) the calling thread works for, and its index there
+    struct Membership
+    {
+        TaskPool* pool;
+        size_t index;
+    };
+
+    static Membership& membership();
+    void workerLoop(size_t index);
+    bool runOne(size_t index);
+    bool hasWork();
+    void push(size_t index, Task* task);
+    void wakeOne();
+
+    std::vector<std::unique_ptr<Worker> > workers_;
+    std::mutex injectLock_;
+    std::deque<Task*> injected_; // tasks handed in by run() from outside the pool
+    std::mutex sleepLock_;
+    std::condition_variable wakeup_;
+    std::atomic<int> sleepers_;
+    std::condition_variable finished_; // signalled (under sleepLock_) when an injected task completes
+    std::atomic<bool> stopping_;
+};
+
+/*
+  -----------------------------------------
+  Begin implementations for the TaskPool class.
+  -----------------------------------------
+*/
+
+/**
+* Runs the work, keeping whatever it throws for the thread waiting on it.
+*/
+template<typename F>
+void TaskPool::FunctionTask<F>::execute()
+{
+    try{
+        f();
+    }
+    catch(...){
+        this->error = std::current_exception();
+    }
+    this->done.store(true, std::memory_order_release);
+}
+
+/**
+* Starts the given number of worker threads (at least one).
+*/
+inline TaskPool::TaskPool(unsigned threads) : sleepers_(0), stopping_(false)
+{
+    threads = std::max(1u, threads);
+    for(unsigned i = 0; i < threads; ++i){ //every worker exists before any thread looks for victims
+        workers_.push_back(std::unique_ptr<Worker>(new Worker()));
+    }
+    for(unsigned i = 0; i < threads; ++i){
+        workers_[i]->thread = std::thread(&TaskPool::workerLoop, this, (size_t)i);
+    }
+}
+
+/**
+* Destructor, which stops and joins the workers. No run() may be in progress.
+*/
+inline TaskPool::~TaskPool()
+{
+    stopping_.store(true);
+    {
+        std::lock_guard<std::mutex> hold(sleepLock_);
+        wakeup_.notify_all();
+    }
+    for(size_t i = 0; i < workers_.size(); ++i){
+        workers_[i]->thread.join();
+    }
+}
+
+/**
+* Returns the number of worker threads.
+*/
+inline unsigned TaskPool::size() const
+{
+    return (unsigned)workers_.size();
+}
+
+/**
+* A process-wide pool with one worker per hardware thread, started on first use.
+*/
+inline TaskPool& TaskPool::shared()
+{
+    static TaskPool pool;
+    return pool;
+}
+
+/**
+* Returns the calling thread's record of which pool it works for.
+*/
+inline TaskPool::Membership& TaskPool::membership()
+{
+    static thread_local Membership member = { NULL, 0 };
+    return member;
+}
+
+/**
+* Runs f on one of the workers and returns once it is done, rethrowing what
+* it threw. Called from a worker of this pool, it just calls f.
+*/
+template<typename F>
+void TaskPool::run(F&& f)
+{
+    if(membership().pool == this){
+        f();
+        return;
+    }
+    FunctionTask<F> task(f);
+    {
+        std::lock_guard<std::mutex> hold(injectLock_);
+        injected_.push_back(&task);
+    }
+    wakeOne();
+    {
+        std::unique_lock<std::mutex> hold(sleepLock_);
+        while(!task.done.load(std::memory_order_acquire)){
+            finished_.wait(hold);
+        }
+    }
+    if(task.error){
+        std::rethrow_exception(task.error);
+    }
+}
+
+/**
+* Runs f and g, possibly at the same time, and returns once both are done.
+* If either throws, the exception is rethrown after both have finished.
+* Outside of a worker of this pool, f and g simply run one after the other.
+*/
+template<typename F, typename G>
+void TaskPool::fork2(F&& f, G&& g)
+{
+    Membership& member = membership();
+    if(member.pool != this){
+        f();
+        g();
+        return;
+    }
+
+    FunctionTask<G> second(g);
+    push(member.index, &second);
+
+    std::exception_ptr firstError;
+    try{
+        f();
+    }
+    catch(...){
+        firstError = std::current_exception();
+    }
+
+    // f leaves the deque as it found it, so g is still at the back unless it was stolen
+    bool stolen = true;
+    {
+        Worker& self = *workers_[member.index];
+        std::lock_guard<std::mutex> hold(self.lock);
+        if(!self.tasks.empty() && self.tasks.back() == &second){
+            self.tasks.pop_back();
+            stolen = false;
+        }
+    }
+    if(!stolen){
+        second.execute();
+    }
+    while(!second.done.load(std::memory_order_acquire)){ //help out until the thief is done with g
+        if(!runOne(member.index)){
+            std::this_thread::yield();
+        }
+    }
+
+    if(firstError){
+        std::rethrow_exception(firstError);
+    }
+    if(second.error){
+        std::rethrow_exception(second.error);
+    }
+}
+
+/**
+* Puts a task on the back of a worker's deque and wakes a sleeping worker to steal it.
+*/
+inline void TaskPool::push(size_t index, Task* task)
+{
+    {
+        Worker& self = *workers_[index];
+        std::lock_guard<std::mutex> hold(self.lock);
+        self.tasks.push_back(task);
+    }
+    wakeOne();
+}
+
+/**
+* Wakes one sleeping worker, if there is any. The fence pairs with the one in
+* workerLoop(): either this sees the sleeper, or the sleeper sees the new task.
+*/
+inline void TaskPool::wakeOne()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(sleepers_.load() > 0){
+        std::lock_guard<std::mutex> hold(sleepLock_);
+        wakeup_.notify_one();
+    }
+}
+
+/**
+* Finds and runs one task: the newest of the worker's own, else the oldest
+* of another worker's, else one handed in from outside. Returns false if
+* there was nothing to run.
+*/
+inline bool TaskPool::runOne(size_t index)
+{
+    Task* task = NULL;
+    {
+        Worker& self = *workers_[index];
+        std::lock_guard<std::mutex> hold(self.lock);
+        if(!self.tasks.empty()){
+            task = self.tasks.back();
+            self.tasks.pop_back();
+        }
+    }
+    for(size_t i = 1; task == NULL && i < workers_.size(); ++i){
+        Worker& victim = *workers_[(index + i) % workers_.size()];
+        std::lock_guard<std::mutex> hold(victim.lock);
+        if(!victim.tasks.empty()){
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+        }
+    }
+    if(task != NULL){
+        task->execute();
+        return true;
+    }
+
+    {
+        std::lock_guard<std::mutex> hold(injectLock_);
+        if(!injected_.empty()){
+            task = injected_.front();
+            injected_.pop_front();
+        }
+    }
+    if(task == NULL){
+        return false;
+    }
+    task->execute();
+    std::lock_guard<std::mutex> hold(sleepLock_); //the thread in run() waits under this lock
+    finished_.notify_all();
+    return true;
+}
+
+/**
+* Returns true if any deque or the injection queue holds a task.
+*/
+inline bool TaskPool::hasWork()
+{
+    for(size_t i = 0; i < workers_.size(); ++i){
+        std::lock_guard<std::mutex> hold(workers_[i]->lock);
+        if(!workers_[i]->tasks.empty()){
+            return true;
+        }
+    }
+    std::lock_guard<std::mutex> hold(injectLock_);
+    return !injected_.empty();
+}
+
+/**
+* The body of a worker thread: run tasks while there are any, spin politely
+* for a while when there are none, then sleep until a task is pushed.
+*/
+inline void TaskPool::workerLoop(size_t index)
+{
+    Membership& member = membership();
+    member.pool = this;
+    member.index = index;
+
+    const int SPIN_ROUNDS = 64;
+    int idle = 0;
+    while(!stopping_.load()){
+        if(runOne(index)){
+            idle = 0;
+            continue;
+        }
+        if(++idle < SPIN_ROUNDS){
+            std::this_thread::yield();
+            continue;
+        }
+        std::unique_lock<std::mutex> hold(sleepLock_);
+        ++sleepers_;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(!stopping_.load() && !hasWork()){
+            wakeup_.wait(hold);
+        }
+        --sleepers_;
+        idle = 0;
+    }
+}
+
+/*
+  ---------------------------------------
+  End implementations for the TaskPool class.
+  ---------------------------------------
+*/
+
+#endif